@@ -22,6 +22,7 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "line-history.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1931,6 +1932,40 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+static int origin_has_textconv(struct diff_options *opt,
+			       struct blame_origin *o)
+{
+	struct diff_filespec *df;
+	int ret;
+
+	if (!opt->flags.allow_textconv)
+		return 0;
+	df = alloc_filespec(o->path);
+	fill_filespec(df, &o->blob_oid, 1, o->mode);
+	ret = !!get_textconv(opt->repo, df);
+	free_filespec(df);
+	return ret;
+}
+
+/*
+ * Feed the hunks between the blobs of 'parent' and 'target' from the
+ * line-history index to blame_chunk_cb(), without reading either blob.
+ * The index records diffs of the raw blob contents, so it cannot be
+ * used when a textconv filter applies.
+ */
+static int replay_blame_hunks(struct blame_scoreboard *sb,
+			      struct blame_origin *parent,
+			      struct blame_origin *target,
+			      struct blame_chunk_cb_data *d)
+{
+	if (origin_has_textconv(&sb->revs->diffopt, parent) ||
+	    origin_has_textconv(&sb->revs->diffopt, target))
+		return 0;
+	return line_history_replay(sb->repo, &parent->blob_oid,
+				   &target->blob_oid, sb->xdl_opts,
+				   blame_chunk_cb, d) > 0;
+}
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
@@ -1953,16 +1988,18 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	d.ignore_diffs = ignore_diffs;
 	d.dstq = &newdest; d.srcq = &target->suspects;
 
-	fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
-			 &sb->num_read_blob, ignore_diffs);
-	fill_origin_blob(&sb->revs->diffopt, target, &file_o,
-			 &sb->num_read_blob, ignore_diffs);
-	sb->num_get_patch++;
-
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
-		die("unable to generate diff (%s -> %s)",
-		    oid_to_hex(&parent->commit->object.oid),
-		    oid_to_hex(&target->commit->object.oid));
+	if (ignore_diffs || !replay_blame_hunks(sb, parent, target, &d)) {
+		fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
+				 &sb->num_read_blob, ignore_diffs);
+		fill_origin_blob(&sb->revs->diffopt, target, &file_o,
+				 &sb->num_read_blob, ignore_diffs);
+		sb->num_get_patch++;
+
+		if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+			die("unable to generate diff (%s -> %s)",
+			    oid_to_hex(&parent->commit->object.oid),
+			    oid_to_hex(&target->commit->object.oid));
+	}
 	/* The rest are the same as the parent */
 	blame_chunk(&d.dstq, &d.srcq, INT_MAX, d.offset, INT_MAX, 0,
 		    parent, target, 0);
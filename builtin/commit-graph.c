@@ -20,7 +20,8 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
+	   "                       [--changed-paths] [--reachability-index]\n" \
+	   "                       [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
 	   "                       <split-options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
@@ -49,6 +50,7 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int enable_reachability_index;
 } opts;
 
 static struct option common_opts[] = {
@@ -236,6 +238,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "reachability-index", &opts.enable_reachability_index,
+			N_("enable computation of reachability labels")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
@@ -257,6 +261,7 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.enable_reachability_index = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
@@ -287,6 +292,10 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (!opts.enable_reachability_index)
+		flags |= COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX;
+	if (opts.enable_reachability_index == 1)
+		flags |= COMMIT_GRAPH_WRITE_REACHABILITY_INDEX;
 
 	odb = find_odb(the_repository, opts.obj_dir);
 
@@ -8,11 +8,23 @@
 #include "read-cache-ll.h"
 #include "repository.h"
 #include "revision.h"
+#include "strvec.h"
 #include "tmp-objdir.h"
 #include "tree.h"
 
 static struct rev_info log_tree_opt;
 
+/* with --diff-jobs, the diffs of the lines read with --stdin */
+static struct log_tree_pipeline pipeline;
+static int pipelined;
+
+static void queue_stdin_diff(struct commit *commit, const char *line)
+{
+	if (log_tree_pipeline_full(&pipeline))
+		log_tree_pipeline_show(&pipeline, NULL);
+	log_tree_pipeline_queue(&pipeline, commit, line);
+}
+
 static int diff_tree_commit_oid(const struct object_id *oid)
 {
 	struct commit *commit = lookup_commit_reference(the_repository, oid);
@@ -26,6 +38,7 @@ static int stdin_diff_commit(struct commit *commit, const char *p)
 {
 	struct object_id oid;
 	struct commit_list **pptr = NULL;
+	const char *parents = p;
 
 	/* Graft the fake parents locally to the commit */
 	while (isspace(*p++) && !parse_oid_hex(p, &oid, &p)) {
@@ -40,6 +53,13 @@ static int stdin_diff_commit(struct commit *commit, const char *p)
 			pptr = &commit_list_insert(parent, pptr)->next;
 		}
 	}
+	if (pipelined) {
+		char *line = xstrfmt("%s%s", oid_to_hex(&commit->object.oid),
+				     parents);
+		queue_stdin_diff(commit, line);
+		free(line);
+		return 0;
+	}
 	return log_tree_commit(&log_tree_opt, commit);
 }
 
@@ -53,6 +73,13 @@ static int stdin_diff_trees(struct tree *tree1, const char *p)
 	tree2 = lookup_tree(the_repository, &oid);
 	if (!tree2 || parse_tree(tree2))
 		return -1;
+	if (pipelined) {
+		char *line = xstrfmt("%s %s", oid_to_hex(&tree1->object.oid),
+				     oid_to_hex(&tree2->object.oid));
+		queue_stdin_diff(NULL, line);
+		free(line);
+		return 0;
+	}
 	printf("%s %s\n", oid_to_hex(&tree1->object.oid),
 			  oid_to_hex(&tree2->object.oid));
 	diff_tree_oid(&tree1->object.oid, &tree2->object.oid,
@@ -85,6 +112,27 @@ static int diff_tree_stdin(char *line)
 	return -1;
 }
 
+static int diff_tree_worker_line(struct rev_info *opt UNUSED,
+				 const char *line)
+{
+	char *buf = xstrfmt("%s\n", line);
+	int ret = diff_tree_stdin(buf);
+
+	free(buf);
+	return ret;
+}
+
+static void prepare_stdin_diff(struct rev_info *opt)
+{
+	opt->diffopt.rotate_to_strict = 0;
+	opt->diffopt.no_free = 1;
+	if (opt->diffopt.detect_rename) {
+		if (the_repository->index->cache)
+			repo_read_index(the_repository);
+		opt->diffopt.setup |= DIFF_SETUP_USE_SIZE_CACHE;
+	}
+}
+
 static const char diff_tree_usage[] =
 "git diff-tree [--stdin] [-m] [-s] [-v] [--no-commit-id] [--pretty]\n"
 "              [-t] [-r] [-c | --cc] [--combined-all-paths] [--root] [--merge-base]\n"
@@ -115,6 +163,7 @@ int cmd_diff_tree(int argc, const char **argv, const char *prefix)
 	static struct rev_info *opt = &log_tree_opt;
 	struct setup_revision_opt s_r_opt;
 	struct userformat_want w;
+	struct strvec args = STRVEC_INIT;
 	int read_stdin = 0;
 	int merge_base = 0;
 
@@ -136,6 +185,7 @@ int cmd_diff_tree(int argc, const char **argv, const char *prefix)
 	s_r_opt.tweak = diff_tree_tweak_rev;
 
 	prefix = precompose_argv_prefix(argc, argv, prefix);
+	strvec_pushv(&args, argv);
 	argc = setup_revisions(argc, argv, opt, &s_r_opt);
 
 	memset(&w, 0, sizeof(w));
@@ -165,6 +215,12 @@ int cmd_diff_tree(int argc, const char **argv, const char *prefix)
 	if (merge_base && opt->pending.nr != 2)
 		die(_("--merge-base only works with two commits"));
 
+	if (opt->diff_worker) {
+		strvec_clear(&args);
+		prepare_stdin_diff(opt);
+		return log_tree_worker(opt, diff_tree_worker_line);
+	}
+
 	opt->diffopt.rotate_to_strict = 1;
 
 	if (opt->remerge_diff) {
@@ -210,27 +266,34 @@ int cmd_diff_tree(int argc, const char **argv, const char *prefix)
 		int saved_nrl = 0;
 		int saved_dcctc = 0;
 
-		opt->diffopt.rotate_to_strict = 0;
-		opt->diffopt.no_free = 1;
-		if (opt->diffopt.detect_rename) {
-			if (the_repository->index->cache)
-				repo_read_index(the_repository);
-			opt->diffopt.setup |= DIFF_SETUP_USE_SIZE_CACHE;
-		}
+		prepare_stdin_diff(opt);
+		pipelined = log_tree_pipeline_start(&pipeline, opt, args.v);
 		while (fgets(line, sizeof(line), stdin)) {
 			struct object_id oid;
 
 			if (get_oid_hex(line, &oid)) {
+				/* everything before it has to be shown first */
+				while (pipelined && pipeline.queued)
+					log_tree_pipeline_show(&pipeline, NULL);
 				fputs(line, stdout);
 				fflush(stdout);
 			}
 			else {
 				diff_tree_stdin(line);
-				if (saved_nrl < opt->diffopt.needed_rename_limit)
-					saved_nrl = opt->diffopt.needed_rename_limit;
-				if (opt->diffopt.degraded_cc_to_c)
-					saved_dcctc = 1;
 			}
+			if (saved_nrl < opt->diffopt.needed_rename_limit)
+				saved_nrl = opt->diffopt.needed_rename_limit;
+			if (opt->diffopt.degraded_cc_to_c)
+				saved_dcctc = 1;
+		}
+		if (pipelined) {
+			while (pipeline.queued)
+				log_tree_pipeline_show(&pipeline, NULL);
+			log_tree_pipeline_finish(&pipeline);
+			if (saved_nrl < opt->diffopt.needed_rename_limit)
+				saved_nrl = opt->diffopt.needed_rename_limit;
+			if (opt->diffopt.degraded_cc_to_c)
+				saved_dcctc = 1;
 		}
 		opt->diffopt.degraded_cc_to_c = saved_dcctc;
 		opt->diffopt.needed_rename_limit = saved_nrl;
@@ -243,5 +306,6 @@ int cmd_diff_tree(int argc, const char **argv, const char *prefix)
 		opt->remerge_objdir = NULL;
 	}
 
+	strvec_clear(&args);
 	return diff_result_code(&opt->diffopt);
 }
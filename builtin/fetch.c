@@ -1159,6 +1159,7 @@ static int store_updated_refs(struct display_state *display_state,
 		struct check_connected_options opt = CHECK_CONNECTED_INIT;
 
 		opt.exclude_hidden_refs_section = "fetch";
+		opt.in_process = 1;
 		rm = ref_map;
 		if (check_connected(iterate_ref_map, &rm, &opt)) {
 			rc = error(_("%s did not send all necessary objects\n"),
@@ -1337,6 +1338,7 @@ static int check_exist_and_connected(struct ref *ref_map)
 
 	opt.quiet = 1;
 	opt.exclude_hidden_refs_section = "fetch";
+	opt.in_process = 1;
 	return check_connected(iterate_ref_map, &rm, &opt);
 }
 
@@ -25,6 +25,8 @@
 #include "strvec.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "line-history.h"
+#include "patch-id-cache.h"
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
@@ -273,6 +275,26 @@ static int maintenance_task_pack_refs(MAYBE_UNUSED struct maintenance_run_opts *
 	return run_command(&cmd);
 }
 
+static int maintenance_task_line_history(struct maintenance_run_opts *opts,
+					 UNUSED struct gc_config *cfg)
+{
+	enum line_history_write_flags flags = 0;
+
+	if (!opts->quiet)
+		flags |= LINE_HISTORY_WRITE_PROGRESS;
+	return !!write_line_history_index(the_repository, flags);
+}
+
+static int maintenance_task_patch_ids(struct maintenance_run_opts *opts,
+				      UNUSED struct gc_config *cfg)
+{
+	enum patch_id_cache_write_flags flags = 0;
+
+	if (!opts->quiet)
+		flags |= PATCH_ID_CACHE_WRITE_PROGRESS;
+	return !!write_patch_id_cache(the_repository, flags);
+}
+
 static int too_many_loose_objects(struct gc_config *cfg)
 {
 	/*
@@ -410,7 +432,7 @@ static uint64_t estimate_repack_memory(struct gc_config *cfg,
 	 */
 	heap += sizeof(struct tree) * nr_objects / 2;
 	/* and then obj_hash[], underestimated in fact */
-	heap += sizeof(struct object *) * nr_objects;
+	heap += (sizeof(struct object *) + sizeof(uint16_t)) * nr_objects;
 	/* revindex is used also */
 	heap += (sizeof(off_t) + sizeof(uint32_t)) * nr_objects;
 	/*
@@ -1363,6 +1385,8 @@ enum maintenance_task_label {
 	TASK_GC,
 	TASK_COMMIT_GRAPH,
 	TASK_PACK_REFS,
+	TASK_LINE_HISTORY,
+	TASK_PATCH_IDS,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1399,6 +1423,14 @@ static struct maintenance_task tasks[] = {
 		maintenance_task_pack_refs,
 		pack_refs_condition,
 	},
+	[TASK_LINE_HISTORY] = {
+		"line-history",
+		maintenance_task_line_history,
+	},
+	[TASK_PATCH_IDS] = {
+		"patch-ids",
+		maintenance_task_patch_ids,
+	},
 };
 
 static int compare_tasks_by_selection(const void *a_, const void *b_)
@@ -151,6 +151,12 @@ static struct thread_local *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
+/*
+ * Set while the first pass hands non-delta objects over to worker
+ * threads, which then compute their object names instead of the reader.
+ */
+static int defer_base_hashing;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -460,16 +466,16 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (type == OBJ_BLOB && size > big_file_threshold)
+		buf = fixed_buf;
+	else
+		buf = xmallocz(size);
+	if (!is_delta_type(type) && (buf == fixed_buf || !defer_base_hashing)) {
 		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
 		the_hash_algo->init_fn(&c);
 		the_hash_algo->update_fn(&c, hdr, hdrlen);
 	} else
 		oid = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
-	else
-		buf = xmallocz(size);
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -1153,11 +1159,127 @@ static void *threaded_second_pass(void *data)
 	return NULL;
 }
 
+/*
+ * The first pass can only find where an object ends by inflating it, so
+ * reading the pack stays serial. What can be spread over threads is the
+ * rest of the work on non-delta objects: computing their names and
+ * checking them with sha1_object(). The reader queues the inflated data
+ * of these objects, and worker threads take it from there.
+ *
+ * The queue is bounded, both in number of objects and in bytes of data
+ * it holds, so that a slow worker does not make the reader inflate the
+ * whole pack into memory. An object larger than the byte limit is still
+ * queued once the queue is empty.
+ */
+#define BASE_QUEUE_SIZE 1024
+
+struct base_job {
+	struct object_entry *obj;
+	void *data;
+};
+
+static struct base_job base_queue[BASE_QUEUE_SIZE];
+static int base_queue_first, base_queue_nr;
+static size_t base_queue_bytes;
+static int base_queue_closed;
+static pthread_mutex_t base_queue_mutex;
+static pthread_cond_t base_queue_not_empty;
+static pthread_cond_t base_queue_not_full;
+
+static void queue_base_object(struct object_entry *obj, void *data)
+{
+	struct base_job *job;
+
+	pthread_mutex_lock(&base_queue_mutex);
+	while (base_queue_nr == BASE_QUEUE_SIZE ||
+	       (base_queue_nr &&
+		base_queue_bytes + obj->size > delta_base_cache_limit))
+		pthread_cond_wait(&base_queue_not_full, &base_queue_mutex);
+	job = &base_queue[(base_queue_first + base_queue_nr) % BASE_QUEUE_SIZE];
+	job->obj = obj;
+	job->data = data;
+	base_queue_nr++;
+	base_queue_bytes += obj->size;
+	pthread_cond_signal(&base_queue_not_empty);
+	pthread_mutex_unlock(&base_queue_mutex);
+}
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct base_job job;
+
+		pthread_mutex_lock(&base_queue_mutex);
+		while (!base_queue_nr && !base_queue_closed)
+			pthread_cond_wait(&base_queue_not_empty,
+					  &base_queue_mutex);
+		if (!base_queue_nr) {
+			pthread_mutex_unlock(&base_queue_mutex);
+			break;
+		}
+		job = base_queue[base_queue_first];
+		base_queue_first = (base_queue_first + 1) % BASE_QUEUE_SIZE;
+		base_queue_nr--;
+		base_queue_bytes -= job.obj->size;
+		pthread_cond_signal(&base_queue_not_full);
+		pthread_mutex_unlock(&base_queue_mutex);
+
+		hash_object_file(the_hash_algo, job.data, job.obj->size,
+				 job.obj->type, &job.obj->idx.oid);
+		sha1_object(job.data, NULL, job.obj->size, job.obj->type,
+			    &job.obj->idx.oid);
+		free(job.data);
+	}
+	return NULL;
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	pthread_mutex_init(&base_queue_mutex, NULL);
+	pthread_cond_init(&base_queue_not_empty, NULL);
+	pthread_cond_init(&base_queue_not_full, NULL);
+	base_queue_closed = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	defer_base_hashing = 1;
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	pthread_mutex_lock(&base_queue_mutex);
+	base_queue_closed = 1;
+	pthread_cond_broadcast(&base_queue_not_empty);
+	pthread_mutex_unlock(&base_queue_mutex);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	defer_base_hashing = 0;
+
+	pthread_cond_destroy(&base_queue_not_full);
+	pthread_cond_destroy(&base_queue_not_empty);
+	pthread_mutex_destroy(&base_queue_mutex);
+	cleanup_thread();
+}
+
 /*
  * First pass:
  * - find locations of all objects;
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
+ *
+ * With threads, the SHA1 of non-delta objects is computed by
+ * threaded_first_pass() while the reader moves on, and is known once
+ * all threads are done.
  */
 static void parse_pack_objects(unsigned char *hash)
 {
@@ -1166,12 +1288,16 @@ static void parse_pack_objects(unsigned char *hash)
 	struct object_id ref_delta_oid;
 	struct stat st;
 	git_hash_ctx tmp_ctx;
+	int threaded = HAVE_THREADS &&
+		(nr_threads > 1 || getenv("GIT_FORCE_THREADS"));
 
 	if (verbose)
 		progress = start_progress(
 				progress_title ? progress_title :
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	if (threaded)
+		start_first_pass_threads();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1191,6 +1317,9 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (defer_base_hashing) {
+			queue_base_object(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
@@ -1198,6 +1327,8 @@ static void parse_pack_objects(unsigned char *hash)
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (threaded)
+		finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
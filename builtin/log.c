@@ -29,6 +29,7 @@
 #include "shortlog.h"
 #include "remote.h"
 #include "string-list.h"
+#include "strvec.h"
 #include "parse-options.h"
 #include "line-log.h"
 #include "branch.h"
@@ -499,11 +500,39 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
-static int cmd_log_walk_no_free(struct rev_info *rev)
+static void log_walk_shown(struct rev_info *rev, struct commit *commit,
+			   int *saved_nrl, int *saved_dcctc)
 {
+	if (!rev->reflog_info) {
+		/*
+		 * We may show a given commit multiple times when
+		 * walking the reflogs.
+		 */
+		free_commit_buffer(the_repository->parsed_objects,
+				   commit);
+		free_commit_list(commit->parents);
+		commit->parents = NULL;
+	}
+	if (*saved_nrl < rev->diffopt.needed_rename_limit)
+		*saved_nrl = rev->diffopt.needed_rename_limit;
+	if (rev->diffopt.degraded_cc_to_c)
+		*saved_dcctc = 1;
+}
+
+/*
+ * "argv" is what the command was run with, to start diff workers with
+ * --diff-jobs, or NULL if they are not supported.
+ */
+static int cmd_log_walk_no_free(struct rev_info *rev, const char **argv)
+{
+	struct log_tree_pipeline pipeline;
 	struct commit *commit;
 	int saved_nrl = 0;
 	int saved_dcctc = 0;
+	int pipelined;
+
+	if (rev->diff_worker)
+		return log_tree_worker(rev, NULL);
 
 	if (rev->remerge_diff) {
 		rev->remerge_objdir = tmp_objdir_create("remerge-diff");
@@ -521,32 +550,33 @@ static int cmd_log_walk_no_free(struct rev_info *rev)
 	if (rev->early_output)
 		finish_early_output(rev);
 
+	pipelined = argv && log_tree_pipeline_start(&pipeline, rev, argv);
+
 	/*
 	 * For --check and --exit-code, the exit code is based on CHECK_FAILED
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
 	while ((commit = get_revision(rev)) != NULL) {
-		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
+		if (pipelined) {
+			log_tree_pipeline_queue(&pipeline, commit, NULL);
+			if (!log_tree_pipeline_full(&pipeline))
+				continue;
+			commit = log_tree_pipeline_show(&pipeline, NULL);
+		} else if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
 			/*
 			 * We decremented max_count in get_revision,
 			 * but we didn't actually show the commit.
 			 */
 			rev->max_count++;
-		if (!rev->reflog_info) {
-			/*
-			 * We may show a given commit multiple times when
-			 * walking the reflogs.
-			 */
-			free_commit_buffer(the_repository->parsed_objects,
-					   commit);
-			free_commit_list(commit->parents);
-			commit->parents = NULL;
+		log_walk_shown(rev, commit, &saved_nrl, &saved_dcctc);
+	}
+	if (pipelined) {
+		while (pipeline.queued) {
+			commit = log_tree_pipeline_show(&pipeline, NULL);
+			log_walk_shown(rev, commit, &saved_nrl, &saved_dcctc);
 		}
-		if (saved_nrl < rev->diffopt.needed_rename_limit)
-			saved_nrl = rev->diffopt.needed_rename_limit;
-		if (rev->diffopt.degraded_cc_to_c)
-			saved_dcctc = 1;
+		log_tree_pipeline_finish(&pipeline);
 	}
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
@@ -563,12 +593,12 @@ static int cmd_log_walk_no_free(struct rev_info *rev)
 	return diff_result_code(&rev->diffopt);
 }
 
-static int cmd_log_walk(struct rev_info *rev)
+static int cmd_log_walk(struct rev_info *rev, const char **argv)
 {
 	int retval;
 
 	rev->diffopt.no_free = 1;
-	retval = cmd_log_walk_no_free(rev);
+	retval = cmd_log_walk_no_free(rev, argv);
 	rev->diffopt.no_free = 0;
 	diff_free(&rev->diffopt);
 	return retval;
@@ -642,6 +672,7 @@ int cmd_whatchanged(int argc, const char **argv, const char *prefix)
 	struct log_config cfg;
 	struct rev_info rev;
 	struct setup_revision_opt opt;
+	struct strvec args = STRVEC_INIT;
 	int ret;
 
 	log_config_init(&cfg);
@@ -656,12 +687,14 @@ int cmd_whatchanged(int argc, const char **argv, const char *prefix)
 	memset(&opt, 0, sizeof(opt));
 	opt.def = "HEAD";
 	opt.revarg_opt = REVARG_COMMITTISH;
+	strvec_pushv(&args, argv);
 	cmd_log_init(argc, argv, prefix, &rev, &opt, &cfg);
 	if (!rev.diffopt.output_format)
 		rev.diffopt.output_format = DIFF_FORMAT_RAW;
 
-	ret = cmd_log_walk(&rev);
+	ret = cmd_log_walk(&rev, args.v);
 
+	strvec_clear(&args);
 	release_revisions(&rev);
 	log_config_release(&cfg);
 	return ret;
@@ -791,7 +824,7 @@ int cmd_show(int argc, const char **argv, const char *prefix)
 	cmd_log_init(argc, argv, prefix, &rev, &opt, &cfg);
 
 	if (!rev.no_walk) {
-		ret = cmd_log_walk(&rev);
+		ret = cmd_log_walk(&rev, NULL);
 		release_revisions(&rev);
 		log_config_release(&cfg);
 		return ret;
@@ -848,7 +881,7 @@ int cmd_show(int argc, const char **argv, const char *prefix)
 			memcpy(&rev.pending, &blank, sizeof(rev.pending));
 
 			add_object_array(o, name, &rev.pending);
-			ret = cmd_log_walk_no_free(&rev);
+			ret = cmd_log_walk_no_free(&rev, NULL);
 
 			/*
 			 * No need for
@@ -899,7 +932,7 @@ int cmd_log_reflog(int argc, const char **argv, const char *prefix)
 	rev.always_show_header = 1;
 	cmd_log_init_finish(argc, argv, prefix, &rev, &opt, &cfg);
 
-	ret = cmd_log_walk(&rev);
+	ret = cmd_log_walk(&rev, NULL);
 
 	release_revisions(&rev);
 	log_config_release(&cfg);
@@ -921,6 +954,7 @@ int cmd_log(int argc, const char **argv, const char *prefix)
 	struct log_config cfg;
 	struct rev_info rev;
 	struct setup_revision_opt opt;
+	struct strvec args = STRVEC_INIT;
 	int ret;
 
 	log_config_init(&cfg);
@@ -935,10 +969,12 @@ int cmd_log(int argc, const char **argv, const char *prefix)
 	opt.def = "HEAD";
 	opt.revarg_opt = REVARG_COMMITTISH;
 	opt.tweak = log_setup_revisions_tweak;
+	strvec_pushv(&args, argv);
 	cmd_log_init(argc, argv, prefix, &rev, &opt, &cfg);
 
-	ret = cmd_log_walk(&rev);
+	ret = cmd_log_walk(&rev, args.v);
 
+	strvec_clear(&args);
 	release_revisions(&rev);
 	log_config_release(&cfg);
 	return ret;
@@ -2028,6 +2064,9 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 	const char *signature = git_version_string;
 	char *signature_to_free = NULL;
 	char *signature_file_arg = NULL;
+	struct strvec args = STRVEC_INIT;
+	struct log_tree_pipeline pipeline;
+	int pipelined, to_queue;
 	struct keep_callback_data keep_callback_data = {
 		.cfg = &cfg,
 		.revs = &rev,
@@ -2154,6 +2193,8 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 		rev.no_inline = 1;
 	}
 
+	strvec_pushv(&args, argv);
+
 	/*
 	 * Parse the arguments before setup_revisions(), or something
 	 * like "git format-patch -o a123 HEAD^.." may fail; a123 is
@@ -2282,6 +2323,15 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 	if (use_stdout && stdout_mboxrd)
 		rev.commit_format = CMIT_FMT_MBOXRD;
 
+	if (rev.diff_worker) {
+		/* set up the diff the same way as below */
+		if (!use_stdout && rev.diffopt.use_color != GIT_COLOR_ALWAYS)
+			rev.diffopt.use_color = GIT_COLOR_NEVER;
+		rev.show_root_diff = 1;
+		log_tree_worker(&rev, NULL);
+		goto done;
+	}
+
 	if (use_stdout) {
 		setup_pager();
 	} else if (!rev.diffopt.close_file) {
@@ -2487,6 +2537,8 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 
 	if (show_progress)
 		progress = start_delayed_progress(_("Generating patches"), total);
+	pipelined = log_tree_pipeline_start(&pipeline, &rev, args.v);
+	to_queue = nr;
 	while (0 <= --nr) {
 		int shown;
 		display_progress(progress, total - nr);
@@ -2531,7 +2583,14 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 		if (output_directory &&
 		    open_next_file(rev.numbered_files ? NULL : commit, NULL, &rev, quiet))
 			die(_("failed to create output files"));
-		shown = log_tree_commit(&rev, commit);
+		if (pipelined) {
+			while (to_queue && !log_tree_pipeline_full(&pipeline))
+				log_tree_pipeline_queue(&pipeline,
+							list[--to_queue], NULL);
+			log_tree_pipeline_show(&pipeline, &shown);
+		} else {
+			shown = log_tree_commit(&rev, commit);
+		}
 		free_commit_buffer(the_repository->parsed_objects,
 				   commit);
 
@@ -2557,12 +2616,15 @@ int cmd_format_patch(int argc, const char **argv, const char *prefix)
 			rev.diffopt.file = NULL;
 		}
 	}
+	if (pipelined)
+		log_tree_pipeline_finish(&pipeline);
 	stop_progress(&progress);
 	free(list);
 	if (ignore_if_in_upstream)
 		free_patch_ids(&ids);
 
 done:
+	strvec_clear(&args);
 	oid_array_clear(&idiff_prev);
 	strbuf_release(&idiff_title);
 	strbuf_release(&rdiff1);
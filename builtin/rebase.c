@@ -1303,6 +1303,9 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 		if (repo_get_oid(the_repository, "HEAD", &head))
 			die(_("Cannot read HEAD"));
 
+		if (sequencer_update_deferred_worktree(the_repository, 0))
+			exit(1);
+
 		fd = repo_hold_locked_index(the_repository, &lock_file, 0);
 		if (repo_read_index(the_repository) < 0)
 			die(_("could not read index"));
@@ -1329,6 +1332,7 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 		ropts.flags = RESET_HEAD_HARD;
 		if (reset_head(the_repository, &ropts) < 0)
 			die(_("could not discard worktree changes"));
+		sequencer_update_deferred_worktree(the_repository, 1);
 		remove_branch_state(the_repository, 0);
 		if (read_basic_state(&options))
 			exit(1);
@@ -1361,6 +1365,8 @@ int cmd_rebase(int argc, const char **argv, const char *prefix)
 		goto cleanup;
 	}
 	case ACTION_QUIT: {
+		if (sequencer_update_deferred_worktree(the_repository, 0))
+			exit(1);
 		save_autostash(state_dir_path("autostash", &options));
 		if (options.type == REBASE_MERGE) {
 			struct replay_opts replay = REPLAY_OPTS_INIT;
@@ -272,10 +272,13 @@ static int receive_pack_config(const char *var, const char *value,
 	return git_default_config(var, value, ctx, cb);
 }
 
+/* gathers the ref advertisement, see write_head_info() */
+static struct packet_writer advertisement;
+
 static void show_ref(const char *path, const struct object_id *oid)
 {
 	if (sent_capabilities) {
-		packet_write_fmt(1, "%s %s\n", oid_to_hex(oid), path);
+		packet_writer_write(&advertisement, "%s %s\n", oid_to_hex(oid), path);
 	} else {
 		struct strbuf cap = STRBUF_INIT;
 
@@ -293,8 +296,8 @@ static void show_ref(const char *path, const struct object_id *oid)
 			strbuf_addf(&cap, " session-id=%s", trace2_session_id());
 		strbuf_addf(&cap, " object-format=%s", the_hash_algo->name);
 		strbuf_addf(&cap, " agent=%s", git_user_agent_sanitized());
-		packet_write_fmt(1, "%s %s%c%s\n",
-			     oid_to_hex(oid), path, 0, cap.buf);
+		packet_writer_write(&advertisement, "%s %s%c%s\n",
+				    oid_to_hex(oid), path, 0, cap.buf);
 		strbuf_release(&cap);
 		sent_capabilities = 1;
 	}
@@ -340,6 +343,7 @@ static void write_head_info(void)
 {
 	static struct oidset seen = OIDSET_INIT;
 
+	packet_writer_init_buffered(&advertisement, 1);
 	refs_for_each_fullref_in(get_main_ref_store(the_repository), "",
 				 hidden_refs_to_excludes(&hidden_refs),
 				 show_ref_cb, &seen);
@@ -347,6 +351,7 @@ static void write_head_info(void)
 	oidset_clear(&seen);
 	if (!sent_capabilities)
 		show_ref("capabilities^{}", null_oid());
+	packet_writer_release(&advertisement);
 
 	advertise_shallow_grafts(1);
 
@@ -1930,6 +1935,8 @@ static void execute_commands(struct command *commands,
 	opt.progress = err_fd && !quiet;
 	opt.env = tmp_objdir_env(tmp_objdir);
 	opt.exclude_hidden_refs_section = "receive";
+	/* tmp_objdir has been added as an alternate by unpack() */
+	opt.in_process = 1;
 
 	if (check_connected(iterate_receive_command_list, &data, &opt))
 		set_connectivity_errors(commands, si);
@@ -5,6 +5,7 @@
 #include "git-compat-util.h"
 
 #include "builtin.h"
+#include "bulk-checkin.h"
 #include "environment.h"
 #include "hex.h"
 #include "lockfile.h"
@@ -13,7 +14,10 @@
 #include "parse-options.h"
 #include "refs.h"
 #include "revision.h"
+#include "run-command.h"
+#include "sigchain.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include <oidset.h>
 #include <tree.h>
 
@@ -274,6 +278,252 @@ static struct commit *pick_regular_commit(struct commit *pickme,
 	return create_commit(result->tree, pickme, replayed_base);
 }
 
+/*
+ * With --jobs, the commits to replay are split into chains: each commit
+ * is replayed on top of the replayed version of its parent, or on top of
+ * "onto" if its parent is not replayed, so commits only depend on other
+ * commits of the same chain. The chains are spread over several
+ * "git replay --worker" processes, as merge-ort and the object store
+ * cannot be used from several threads.
+ *
+ * A worker reads the commits to pick from its standard input, one object
+ * name per line, parents before their children. Once done, it prints
+ * "<old> <new>" for every commit it replayed. It exits with 1 after a
+ * conflict, having reported the commits replayed until then.
+ */
+static int replay_worker(struct commit *onto)
+{
+	struct merge_options merge_opt;
+	struct merge_result result;
+	kh_oid_map_t *replayed_commits;
+	struct commit **picks = NULL;
+	size_t picks_nr = 0, picks_alloc = 0, i;
+	struct strbuf buf = STRBUF_INIT;
+
+	/* read all of our input first, so that the parent can move on */
+	while (strbuf_getline_lf(&buf, stdin) != EOF) {
+		struct object_id oid;
+		struct commit *commit;
+
+		if (get_oid_hex(buf.buf, &oid) ||
+		    !(commit = lookup_commit_reference(the_repository, &oid)))
+			die(_("invalid commit to replay: '%s'"), buf.buf);
+		if (!commit->parents || commit->parents->next ||
+		    repo_parse_commit(the_repository, commit->parents->item))
+			die(_("cannot replay commit %s"), buf.buf);
+		ALLOC_GROW(picks, picks_nr + 1, picks_alloc);
+		picks[picks_nr++] = commit;
+	}
+	strbuf_reset(&buf);
+
+	init_basic_merge_options(&merge_opt, the_repository);
+	memset(&result, 0, sizeof(result));
+	result.clean = 1;
+	merge_opt.show_rename_progress = 0;
+	replayed_commits = kh_init_oid_map();
+
+	begin_odb_pack_transaction();
+	for (i = 0; i < picks_nr; i++) {
+		struct commit *replayed;
+		khint_t pos;
+		int hr;
+
+		replayed = pick_regular_commit(picks[i], replayed_commits, onto,
+					       &merge_opt, &result);
+		if (!replayed)
+			break;
+		pos = kh_put_oid_map(replayed_commits, picks[i]->object.oid, &hr);
+		kh_value(replayed_commits, pos) = replayed;
+		strbuf_addf(&buf, "%s ", oid_to_hex(&picks[i]->object.oid));
+		strbuf_addf(&buf, "%s\n", oid_to_hex(&replayed->object.oid));
+	}
+	end_odb_transaction();
+	fwrite(buf.buf, 1, buf.len, stdout);
+
+	merge_finalize(&merge_opt, &result);
+	kh_destroy_oid_map(replayed_commits);
+	strbuf_release(&buf);
+	free(picks);
+	return result.clean;
+}
+
+struct ref_update {
+	const char *refname;
+	struct commit *commit;
+};
+
+/*
+ * Walk the commits to replay, hand their chains out to "jobs" workers and
+ * collect the ref updates in "ref_updates", in the same order as a
+ * replay without workers would produce them. Chains that do not lead to
+ * any ref update are not replayed at all. Returns 1 if everything was
+ * replayed cleanly, 0 after a conflict and -1 on error.
+ */
+static int replay_with_workers(struct rev_info *revs, struct commit *onto,
+			       int contained, struct strset *update_refs,
+			       int jobs, struct strbuf *ref_updates)
+{
+	kh_oid_pos_t *chain_of = kh_init_oid_pos();
+	kh_oid_map_t *replayed_commits = kh_init_oid_map();
+	struct commit **picks = NULL;
+	int *pick_chain = NULL;
+	size_t picks_nr = 0, picks_alloc = 0, pick_chain_alloc = 0;
+	size_t *chain_size = NULL;
+	int *chain_job = NULL;
+	int chains_nr = 0;
+	size_t chain_size_alloc = 0, chain_job_alloc = 0;
+	struct ref_update *updates = NULL;
+	size_t updates_nr = 0, updates_alloc = 0;
+	struct child_process *workers;
+	size_t *job_size;
+	struct strbuf buf = STRBUF_INIT;
+	struct commit *commit;
+	size_t i;
+	int j, ret = 1;
+
+	while ((commit = get_revision(revs))) {
+		const struct name_decoration *decoration;
+		khint_t pos;
+		int hr, chain;
+
+		if (!commit->parents)
+			die(_("replaying down to root commit is not supported yet!"));
+		if (commit->parents->next)
+			die(_("replaying merge commits is not supported yet!"));
+
+		pos = kh_get_oid_pos(chain_of, commit->parents->item->object.oid);
+		if (pos == kh_end(chain_of)) {
+			ALLOC_GROW(chain_size, chains_nr + 1, chain_size_alloc);
+			ALLOC_GROW(chain_job, chains_nr + 1, chain_job_alloc);
+			chain_size[chains_nr] = 0;
+			chain_job[chains_nr] = -1;
+			chain = chains_nr++;
+		} else {
+			chain = kh_value(chain_of, pos);
+		}
+		pos = kh_put_oid_pos(chain_of, commit->object.oid, &hr);
+		kh_value(chain_of, pos) = chain;
+		chain_size[chain]++;
+
+		ALLOC_GROW(picks, picks_nr + 1, picks_alloc);
+		ALLOC_GROW(pick_chain, picks_nr + 1, pick_chain_alloc);
+		picks[picks_nr] = commit;
+		pick_chain[picks_nr++] = chain;
+
+		for (decoration = get_name_decoration(&commit->object);
+		     decoration;
+		     decoration = decoration->next) {
+			if (decoration->type != DECORATION_REF_LOCAL ||
+			    !(contained || strset_contains(update_refs,
+							   decoration->name)))
+				continue;
+			ALLOC_GROW(updates, updates_nr + 1, updates_alloc);
+			updates[updates_nr].refname = decoration->name;
+			updates[updates_nr++].commit = commit;
+			chain_job[chain] = 0;
+		}
+	}
+
+	/* give each chain we need to the least busy worker */
+	CALLOC_ARRAY(job_size, jobs);
+	for (i = 0; i < chains_nr; i++) {
+		int least = 0;
+
+		if (chain_job[i] < 0)
+			continue;
+		for (j = 1; j < jobs; j++)
+			if (job_size[j] < job_size[least])
+				least = j;
+		chain_job[i] = least;
+		job_size[least] += chain_size[i];
+	}
+
+	CALLOC_ARRAY(workers, jobs);
+	sigchain_push(SIGPIPE, SIG_IGN);
+	for (j = 0; j < jobs; j++) {
+		struct child_process *cp = &workers[j];
+
+		child_process_init(cp);
+		if (!job_size[j])
+			continue;
+
+		strbuf_reset(&buf);
+		for (i = 0; i < picks_nr; i++)
+			if (chain_job[pick_chain[i]] == j)
+				strbuf_addf(&buf, "%s\n",
+					    oid_to_hex(&picks[i]->object.oid));
+
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		strvec_pushl(&cp->args, "replay", "--worker", "--onto",
+			     oid_to_hex(&onto->object.oid), NULL);
+		if (start_command(cp))
+			die(_("unable to start replay worker"));
+		/* a worker that died is reported by finish_command() below */
+		if (write_in_full(cp->in, buf.buf, buf.len) < 0)
+			error_errno(_("unable to send commits to replay worker"));
+		close(cp->in);
+	}
+	sigchain_pop(SIGPIPE);
+
+	for (j = 0; j < jobs; j++) {
+		struct child_process *cp = &workers[j];
+		const char *p;
+		int code;
+
+		if (!job_size[j])
+			continue;
+
+		strbuf_reset(&buf);
+		if (strbuf_read(&buf, cp->out, 0) < 0)
+			die_errno(_("unable to read from replay worker"));
+		close(cp->out);
+		code = finish_command(cp);
+		if (code == 1)
+			ret = ret < 0 ? ret : 0;
+		else if (code)
+			ret = error(_("replay worker failed"));
+
+		for (p = buf.buf; *p; p++) {
+			struct object_id old_oid, new_oid;
+			khint_t pos;
+			int hr;
+
+			if (parse_oid_hex(p, &old_oid, &p) || *p++ != ' ' ||
+			    parse_oid_hex(p, &new_oid, &p) || *p != '\n')
+				die(_("malformed output from replay worker"));
+			pos = kh_put_oid_map(replayed_commits, old_oid, &hr);
+			kh_value(replayed_commits, pos) =
+				lookup_commit(the_repository, &new_oid);
+		}
+	}
+
+	for (i = 0; i < updates_nr; i++) {
+		struct commit *replayed = mapped_commit(replayed_commits,
+							updates[i].commit, NULL);
+
+		if (!replayed)
+			continue;
+		strbuf_addf(ref_updates, "update %s %s %s\n",
+			    updates[i].refname,
+			    oid_to_hex(&replayed->object.oid),
+			    oid_to_hex(&updates[i].commit->object.oid));
+	}
+
+	kh_destroy_oid_pos(chain_of);
+	kh_destroy_oid_map(replayed_commits);
+	strbuf_release(&buf);
+	free(workers);
+	free(job_size);
+	free(updates);
+	free(chain_job);
+	free(chain_size);
+	free(pick_chain);
+	free(picks);
+	return ret;
+}
+
 int cmd_replay(int argc, const char **argv, const char *prefix)
 {
 	const char *advance_name_opt = NULL;
@@ -281,6 +531,8 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 	struct commit *onto = NULL;
 	const char *onto_name = NULL;
 	int contained = 0;
+	int jobs = 1;
+	int worker = 0;
 
 	struct rev_info revs;
 	struct commit *last_commit = NULL;
@@ -289,6 +541,7 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 	struct merge_result result;
 	struct strset *update_refs = NULL;
 	kh_oid_map_t *replayed_commits;
+	struct strbuf ref_updates = STRBUF_INIT;
 	int ret = 0;
 
 	const char * const replay_usage[] = {
@@ -298,6 +551,10 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 		NULL
 	};
 	struct option replay_options[] = {
+		OPT_INTEGER('j', "jobs", &jobs,
+			    N_("number of processes replaying independent branches")),
+		OPT_HIDDEN_BOOL(0, "worker", &worker,
+				N_("replay the commits listed on the standard input")),
 		OPT_STRING(0, "advance", &advance_name_opt,
 			   N_("branch"),
 			   N_("make replay advance given branch")),
@@ -320,6 +577,26 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 	if (advance_name_opt && contained)
 		die(_("options '%s' and '%s' cannot be used together"),
 		    "--advance", "--contained");
+	if (jobs < 0)
+		die(_("invalid number of jobs: %d"), jobs);
+	if (!jobs)
+		jobs = online_cpus();
+
+	if (worker) {
+		if (!onto_name)
+			die(_("the option '%s' requires '%s'"),
+			    "--worker", "--onto");
+		if (advance_name_opt)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--worker", "--advance");
+		if (argc > 1)
+			die(_("%s takes no arguments"), "--worker");
+		onto = peel_committish(onto_name);
+		if (!onto)
+			die(_("'%s' is not a commit"), onto_name);
+		return replay_worker(onto) ? 0 : 1;
+	}
+
 	advance_name = xstrdup_or_null(advance_name_opt);
 
 	repo_init_revisions(the_repository, &revs, prefix);
@@ -384,11 +661,25 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 		goto cleanup;
 	}
 
+	if (jobs > 1 && !advance_name) {
+		ret = replay_with_workers(&revs, onto, contained, update_refs,
+					  jobs, &ref_updates);
+		goto out;
+	}
+
 	init_basic_merge_options(&merge_opt, the_repository);
 	memset(&result, 0, sizeof(result));
 	merge_opt.show_rename_progress = 0;
 	last_commit = onto;
 	replayed_commits = kh_init_oid_map();
+
+	/*
+	 * Write the new trees, blobs and commits into a single pack rather
+	 * than as loose objects. The ref updates are only printed once it
+	 * is in place, so that they never name objects that are not
+	 * visible yet.
+	 */
+	begin_odb_pack_transaction();
 	while ((commit = get_revision(&revs))) {
 		const struct name_decoration *decoration;
 		khint_t pos;
@@ -421,10 +712,10 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 			if (decoration->type == DECORATION_REF_LOCAL &&
 			    (contained || strset_contains(update_refs,
 							  decoration->name))) {
-				printf("update %s %s %s\n",
-				       decoration->name,
-				       oid_to_hex(&last_commit->object.oid),
-				       oid_to_hex(&commit->object.oid));
+				strbuf_addf(&ref_updates, "update %s %s %s\n",
+					    decoration->name,
+					    oid_to_hex(&last_commit->object.oid),
+					    oid_to_hex(&commit->object.oid));
 			}
 			decoration = decoration->next;
 		}
@@ -432,22 +723,27 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 
 	/* In --advance mode, advance the target ref */
 	if (result.clean == 1 && advance_name) {
-		printf("update %s %s %s\n",
-		       advance_name,
-		       oid_to_hex(&last_commit->object.oid),
-		       oid_to_hex(&onto->object.oid));
+		strbuf_addf(&ref_updates, "update %s %s %s\n",
+			    advance_name,
+			    oid_to_hex(&last_commit->object.oid),
+			    oid_to_hex(&onto->object.oid));
 	}
 
+	end_odb_transaction();
 	merge_finalize(&merge_opt, &result);
 	kh_destroy_oid_map(replayed_commits);
+	ret = result.clean;
+
+out:
+	fwrite(ref_updates.buf, 1, ref_updates.len, stdout);
 	if (update_refs) {
 		strset_clear(update_refs);
 		free(update_refs);
 	}
-	ret = result.clean;
 
 cleanup:
 	release_revisions(&revs);
+	strbuf_release(&ref_updates);
 	free(advance_name);
 
 	/* Return */
@@ -1,6 +1,7 @@
 #include "builtin.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph-walk.h"
 #include "diff.h"
 #include "environment.h"
 #include "gettext.h"
@@ -20,6 +21,8 @@
 #include "reflog-walk.h"
 #include "oidset.h"
 #include "packfile.h"
+#include "tag.h"
+#include "trace2.h"
 
 static const char rev_list_usage[] =
 "git rev-list [<options>] <commit>... [--] [<path>...]\n"
@@ -472,6 +475,75 @@ static int try_bitmap_count(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * Count the commits of a plain "rev-list --count A ^B" by walking the
+ * commit-graph directly, without parsing a single commit.
+ */
+static int try_graph_count(struct rev_info *revs, struct rev_list_info *info)
+{
+	struct graph_walk walk;
+	uint32_t pos;
+	int commit_count = 0, ret = -1;
+	size_t i;
+
+	if (!revs->count || (info->flags & REV_LIST_QUIET))
+		return -1;
+
+	/* Anything that needs more than reachability is left to the walk. */
+	if (revs->left_right || revs->left_only || revs->right_only ||
+	    revs->cherry_mark || revs->cherry_pick ||
+	    revs->tag_objects || revs->tree_objects || revs->blob_objects ||
+	    revs->prune || revs->no_walk || revs->boundary ||
+	    revs->first_parent_only || revs->exclude_first_parent_only ||
+	    revs->ancestry_path || revs->simplify_by_decoration ||
+	    revs->unpacked || revs->no_kept_objects ||
+	    revs->line_level_traverse || revs->reflog_info ||
+	    revs->ignore_missing_links || revs->do_not_die_on_missing_objects ||
+	    revs->exclude_promisor_objects || revs->graph || revs->sources ||
+	    revs->grep_filter.pattern_list || revs->grep_filter.header_list ||
+	    revs->max_age != -1 || revs->max_age_as_filter != -1 ||
+	    revs->min_age != -1 || revs->skip_count >= 0 ||
+	    revs->min_parents || revs->max_parents >= 0 ||
+	    revs->filter.choice || revs->commits || !revs->pending.nr)
+		return -1;
+
+	if (graph_walk_init(&walk, the_repository) < 0)
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		struct commit *commit;
+
+		commit = (struct commit *)deref_tag(the_repository, obj,
+						    NULL, 0);
+		if (!commit || commit->object.type != OBJ_COMMIT ||
+		    repo_parse_commit(the_repository, commit) ||
+		    graph_walk_add_tip(&walk, commit,
+				       !!(obj->flags & UNINTERESTING)) < 0)
+			goto out;
+	}
+
+	ret = 0;
+	trace2_region_enter("rev-list", "graph-count", the_repository);
+	while (revs->max_count < 0 || commit_count < revs->max_count) {
+		ret = graph_walk_next(&walk, &pos);
+		if (ret <= 0)
+			break;
+		commit_count++;
+	}
+	trace2_data_intmax("rev-list", the_repository, "graph-count/visited",
+			   walk.visited);
+	trace2_region_leave("rev-list", "graph-count", the_repository);
+
+	if (ret < 0)
+		goto out;
+	printf("%d\n", commit_count);
+	ret = 0;
+out:
+	graph_walk_release(&walk);
+	return ret;
+}
+
 static int try_bitmap_traversal(struct rev_info *revs,
 				int filter_provided_objects)
 {
@@ -733,6 +805,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			goto cleanup;
 	}
 
+	if (!filter_provided_objects && !bisect_list && !show_progress &&
+	    !show_disk_usage && !try_graph_count(&revs, &info))
+		goto cleanup;
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -18,9 +18,16 @@
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
+#include "oidmap.h"
 
 static int odb_transaction_nesting;
 
+/*
+ * The nesting level of the outermost transaction started with
+ * begin_odb_pack_transaction(), or 0 if there is none.
+ */
+static int odb_pack_transaction_nesting;
+
 static struct tmp_objdir *bulk_fsync_objdir;
 
 static struct bulk_checkin_packfile {
@@ -32,8 +39,42 @@ static struct bulk_checkin_packfile {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+
+	/* The objects in the pack so far, to find and read them back. */
+	struct oidmap objects;
 } bulk_checkin_packfile;
 
+struct bulk_checkin_object {
+	struct oidmap_entry entry;
+	enum object_type type;
+	size_t size;
+
+	/* where the deflated data starts in the pack, and its length */
+	off_t offset;
+	size_t disk_size;
+};
+
+static void add_written_object(struct bulk_checkin_packfile *state,
+			       struct pack_idx_entry *idx,
+			       enum object_type type, size_t size,
+			       off_t data_offset)
+{
+	struct bulk_checkin_object *obj;
+
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = idx;
+
+	CALLOC_ARRAY(obj, 1);
+	oidcpy(&obj->entry.oid, &idx->oid);
+	obj->type = type;
+	obj->size = size;
+	obj->offset = data_offset;
+	obj->disk_size = state->offset - data_offset;
+	oidmap_put(&state->objects, obj);
+}
+
 static void finish_tmp_packfile(struct strbuf *basename,
 				const char *pack_tmp_name,
 				struct pack_idx_entry **written_list,
@@ -86,6 +127,7 @@ static void flush_bulk_checkin_packfile(struct bulk_checkin_packfile *state)
 clear_exit:
 	free(state->pack_tmp_name);
 	free(state->written);
+	oidmap_free(&state->objects, 1);
 	memset(state, 0, sizeof(*state));
 
 	strbuf_release(&packname);
@@ -127,18 +169,15 @@ static void flush_batch_fsync(void)
 	bulk_fsync_objdir = NULL;
 }
 
-static int already_written(struct bulk_checkin_packfile *state, struct object_id *oid)
+static int already_written(struct bulk_checkin_packfile *state,
+			   const struct object_id *oid)
 {
-	int i;
-
 	/* The object may already exist in the repository */
 	if (repo_has_object_file(the_repository, oid))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (oideq(&state->written[i]->oid, oid))
-			return 1;
+	if (oidmap_get(&state->objects, oid))
+		return 1;
 
 	/* This is a new object we need to keep */
 	return 0;
@@ -244,6 +283,7 @@ static void prepare_to_stream(struct bulk_checkin_packfile *state,
 
 	state->f = create_tmp_packfile(&state->pack_tmp_name);
 	reset_pack_idx_option(&state->pack_idx_opts);
+	oidmap_init(&state->objects, 0);
 
 	/* Pretend we are going to write only one object */
 	state->offset = write_pack_header(state->f, 1);
@@ -312,15 +352,98 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 		state->offset = checkpoint.offset;
 		free(idx);
 	} else {
+		unsigned char hdr[16];
+
 		oidcpy(&idx->oid, result_oid);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		add_written_object(state, idx, OBJ_BLOB, size,
+				   idx->offset +
+				   encode_in_pack_object_header(hdr, sizeof(hdr),
+								OBJ_BLOB, size));
 	}
 	return 0;
 }
 
+static int deflate_buffer_to_pack(struct bulk_checkin_packfile *state,
+				  const void *buf, size_t len,
+				  enum object_type type,
+				  const struct object_id *oid)
+{
+	git_zstream s;
+	unsigned char hdr[16];
+	unsigned hdrlen;
+	unsigned char *out;
+	unsigned long out_size;
+	struct pack_idx_entry *idx;
+	int status;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, pack_compression_level);
+	out_size = git_deflate_bound(&s, len);
+	out = xmalloc(out_size);
+	s.next_in = (unsigned char *)buf;
+	s.avail_in = len;
+	s.next_out = out;
+	s.avail_out = out_size;
+	while ((status = git_deflate(&s, Z_FINISH)) == Z_OK)
+		; /* nothing */
+	if (status != Z_STREAM_END)
+		die("unable to deflate new object %s (%d)",
+		    oid_to_hex(oid), status);
+	git_deflate_end(&s);
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, len);
+
+	/* would we bust the size limit? */
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + s.total_out)
+		flush_bulk_checkin_packfile(state);
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+
+	CALLOC_ARRAY(idx, 1);
+	oidcpy(&idx->oid, oid);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	hashwrite(state->f, hdr, hdrlen);
+	hashwrite(state->f, out, s.total_out);
+	idx->crc32 = crc32_end(state->f);
+	state->offset += hdrlen + s.total_out;
+	free(out);
+
+	add_written_object(state, idx, type, len, idx->offset + hdrlen);
+	return 0;
+}
+
+static void *read_written_object(struct bulk_checkin_packfile *state,
+				 struct bulk_checkin_object *obj)
+{
+	git_zstream s;
+	unsigned char *in = xmalloc(obj->disk_size);
+	unsigned char *out = xmallocz(obj->size);
+	int status;
+
+	/* the end of the object may still sit in the hashfile's buffer */
+	hashflush(state->f);
+	if (pread_in_full(state->f->fd, in, obj->disk_size, obj->offset) !=
+	    obj->disk_size)
+		die_errno("unable to read back new object %s",
+			  oid_to_hex(&obj->entry.oid));
+
+	memset(&s, 0, sizeof(s));
+	git_inflate_init(&s);
+	s.next_in = in;
+	s.avail_in = obj->disk_size;
+	s.next_out = out;
+	s.avail_out = obj->size + 1;
+	while ((status = git_inflate(&s, Z_FINISH)) == Z_OK)
+		; /* nothing */
+	git_inflate_end(&s);
+	if (status != Z_STREAM_END || s.total_out != obj->size)
+		die("corrupt new object %s", oid_to_hex(&obj->entry.oid));
+
+	free(in);
+	return out;
+}
+
 void prepare_loose_object_bulk_checkin(void)
 {
 	/*
@@ -365,11 +488,59 @@ int index_blob_bulk_checkin(struct object_id *oid,
 	return status;
 }
 
+int write_object_bulk_checkin(const void *buf, unsigned long len,
+			      enum object_type type,
+			      const struct object_id *oid)
+{
+	struct bulk_checkin_packfile *state = &bulk_checkin_packfile;
+
+	if (!odb_pack_transaction_nesting)
+		return 1;
+	if (state->f && oidmap_get(&state->objects, oid))
+		return 0;
+	return deflate_buffer_to_pack(state, buf, len, type, oid);
+}
+
+int bulk_checkin_object_info(const struct object_id *oid,
+			     struct object_info *oi)
+{
+	struct bulk_checkin_packfile *state = &bulk_checkin_packfile;
+	struct bulk_checkin_object *obj;
+
+	if (!state->f)
+		return -1;
+	obj = oidmap_get(&state->objects, oid);
+	if (!obj)
+		return -1;
+
+	if (oi->typep)
+		*oi->typep = obj->type;
+	if (oi->sizep)
+		*oi->sizep = obj->size;
+	if (oi->disk_sizep)
+		*oi->disk_sizep = obj->disk_size;
+	if (oi->delta_base_oid)
+		oidclr(oi->delta_base_oid, the_repository->hash_algo);
+	if (oi->type_name)
+		strbuf_addstr(oi->type_name, type_name(obj->type));
+	if (oi->contentp)
+		*oi->contentp = read_written_object(state, obj);
+	oi->whence = OI_CACHED;
+	return 0;
+}
+
 void begin_odb_transaction(void)
 {
 	odb_transaction_nesting += 1;
 }
 
+void begin_odb_pack_transaction(void)
+{
+	begin_odb_transaction();
+	if (!odb_pack_transaction_nesting)
+		odb_pack_transaction_nesting = odb_transaction_nesting;
+}
+
 void flush_odb_transaction(void)
 {
 	flush_batch_fsync();
@@ -381,6 +552,8 @@ void end_odb_transaction(void)
 	odb_transaction_nesting -= 1;
 	if (odb_transaction_nesting < 0)
 		BUG("Unbalanced ODB transaction nesting");
+	if (odb_transaction_nesting < odb_pack_transaction_nesting)
+		odb_pack_transaction_nesting = 0;
 
 	if (odb_transaction_nesting)
 		return;
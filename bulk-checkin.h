@@ -13,6 +13,25 @@ int index_blob_bulk_checkin(struct object_id *oid,
 			    int fd, size_t size,
 			    const char *path, unsigned flags);
 
+/*
+ * If a transaction started with begin_odb_pack_transaction() is active,
+ * add the object "oid" with the given contents to its packfile and
+ * return 0. Otherwise return 1, and the object has to be written some
+ * other way.
+ */
+int write_object_bulk_checkin(const void *buf, unsigned long len,
+			      enum object_type type,
+			      const struct object_id *oid);
+
+/*
+ * Look up an object written to the packfile of the current transaction,
+ * which is not visible to the rest of the object database yet. Returns
+ * 0 and fills "oi" if found, or -1 otherwise.
+ */
+struct object_info;
+int bulk_checkin_object_info(const struct object_id *oid,
+			     struct object_info *oi);
+
 /*
  * Tell the object database to optimize for adding
  * multiple objects. end_odb_transaction must be called
@@ -22,6 +41,15 @@ int index_blob_bulk_checkin(struct object_id *oid,
  */
 void begin_odb_transaction(void);
 
+/*
+ * Like begin_odb_transaction(), but until the matching
+ * end_odb_transaction(), objects written with write_object_file() go
+ * to the transaction's packfile instead of becoming loose objects.
+ * The process can read them back right away; other processes see them
+ * once the transaction is flushed.
+ */
+void begin_odb_pack_transaction(void);
+
 /*
  * Make any objects that are currently part of a pending object
  * database transaction visible. It is valid to call this function
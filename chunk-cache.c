@@ -0,0 +1,306 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "chunk-cache.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "repository.h"
+
+#define CHUNK_CACHE_HEADER_SIZE 8
+#define CHUNK_CACHE_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define CHUNK_CACHE_FANOUT_SIZE (4 * 256)
+
+static char *get_chunk_cache_filename(struct object_directory *odb,
+				      const struct chunk_cache_format *format)
+{
+	return xstrfmt("%s/info/%s", odb->path, format->filename);
+}
+
+static void free_chunk_cache(struct chunk_cache *c)
+{
+	if (!c)
+		return;
+	munmap((void *)c->data, c->data_len);
+	free(c);
+}
+
+void close_chunk_cache(struct chunk_cache_slot *slot)
+{
+	free_chunk_cache(slot->cache);
+	slot->cache = NULL;
+	slot->attempted = 0;
+}
+
+static size_t chunk_record_size(const struct chunk_cache_chunk *chunk)
+{
+	return st_add(st_mult(chunk->oids, the_hash_algo->rawsz), chunk->bytes);
+}
+
+static int chunk_cache_read_oid_fanout(const unsigned char *chunk_start,
+				       size_t chunk_size, void *data)
+{
+	struct chunk_cache *c = data;
+	int i;
+
+	if (chunk_size != CHUNK_CACHE_FANOUT_SIZE)
+		return error(_("%s oid fanout chunk is wrong size"),
+			     c->format->desc);
+	c->oid_fanout = (const uint32_t *)chunk_start;
+	c->nr = ntohl(c->oid_fanout[255]);
+
+	for (i = 0; i < 255; i++)
+		if (ntohl(c->oid_fanout[i]) > ntohl(c->oid_fanout[i + 1]))
+			return error(_("%s fanout values out of order"),
+				     c->format->desc);
+	return 0;
+}
+
+struct chunk_cache_read_context {
+	struct chunk_cache *cache;
+	int chunk;
+};
+
+static int chunk_cache_read_chunk(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct chunk_cache_read_context *ctx = data;
+	struct chunk_cache *c = ctx->cache;
+	const struct chunk_cache_chunk *chunk = &c->format->chunks[ctx->chunk];
+	size_t record_size = chunk_record_size(chunk);
+
+	if (chunk->per_key ?
+	    chunk_size != st_mult(record_size, c->nr) :
+	    chunk_size % record_size || chunk_size / record_size > UINT32_MAX)
+		return error(_("%s %s chunk is wrong size"),
+			     c->format->desc, chunk->desc);
+	c->chunk[ctx->chunk] = chunk_start;
+	c->record_size[ctx->chunk] = record_size;
+	c->chunk_nr[ctx->chunk] = chunk_size / record_size;
+	return 0;
+}
+
+static struct chunk_cache *parse_chunk_cache(
+		const struct chunk_cache_format *format,
+		const unsigned char *data, size_t data_len)
+{
+	struct chunk_cache *c;
+	struct chunkfile *cf = NULL;
+	int nr_chunks, i;
+
+	if (data_len < CHUNK_CACHE_HEADER_SIZE + CHUNK_TOC_ENTRY_SIZE +
+		       the_hash_algo->rawsz) {
+		error(_("%s file is too small"), format->desc);
+		return NULL;
+	}
+	if (get_be32(data) != format->signature) {
+		error(_("%s signature %X does not match signature %X"),
+		      format->desc, get_be32(data), format->signature);
+		return NULL;
+	}
+	if (data[4] != format->version) {
+		error(_("%s version %X does not match version %X"),
+		      format->desc, data[4], format->version);
+		return NULL;
+	}
+	if (data[5] != oid_version(the_hash_algo)) {
+		error(_("%s hash version %X does not match version %X"),
+		      format->desc, data[5], oid_version(the_hash_algo));
+		return NULL;
+	}
+	nr_chunks = data[6];
+	if (data_len < CHUNK_CACHE_HEADER_SIZE +
+		       (nr_chunks + 1) * CHUNK_TOC_ENTRY_SIZE +
+		       the_hash_algo->rawsz) {
+		error(_("%s file is too small to hold %d chunks"),
+		      format->desc, nr_chunks);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(c, 1);
+	c->format = format;
+	c->data = data;
+	c->data_len = data_len;
+
+	cf = init_chunkfile(NULL);
+	if (read_table_of_contents(cf, data, data_len,
+				   CHUNK_CACHE_HEADER_SIZE, nr_chunks, 1))
+		goto corrupt;
+	if (read_chunk(cf, CHUNK_CACHE_CHUNKID_OIDFANOUT,
+		       chunk_cache_read_oid_fanout, c))
+		goto missing;
+	for (i = 0; i < format->nr_chunks; i++) {
+		struct chunk_cache_read_context ctx = {
+			.cache = c,
+			.chunk = i,
+		};
+
+		if (read_chunk(cf, format->chunks[i].id,
+			       chunk_cache_read_chunk, &ctx))
+			goto missing;
+	}
+
+	free_chunkfile(cf);
+	return c;
+
+missing:
+	error(_("%s required chunk missing or corrupted"), format->desc);
+corrupt:
+	free_chunkfile(cf);
+	free(c);
+	return NULL;
+}
+
+static struct chunk_cache *load_chunk_cache(
+		struct repository *r, const struct chunk_cache_format *format)
+{
+	struct chunk_cache *c;
+	char *path;
+	struct stat st;
+	void *map;
+	size_t len;
+	int fd;
+
+	path = get_chunk_cache_filename(r->objects->odb, format);
+	fd = git_open(path);
+	free(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	len = xsize_t(st.st_size);
+	map = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	c = parse_chunk_cache(format, map, len);
+	if (!c)
+		munmap(map, len);
+	return c;
+}
+
+struct chunk_cache *prepare_chunk_cache(struct repository *r,
+					const struct chunk_cache_format *format,
+					struct chunk_cache_slot *slot)
+{
+	if (!slot->attempted) {
+		slot->attempted = 1;
+		slot->cache = load_chunk_cache(r, format);
+	}
+	return slot->cache;
+}
+
+int chunk_cache_find(const struct chunk_cache *c,
+		     const unsigned char *key, size_t len, uint32_t *pos)
+{
+	uint32_t lo, hi;
+	int first = key[0];
+
+	lo = first ? ntohl(c->oid_fanout[first - 1]) : 0;
+	hi = ntohl(c->oid_fanout[first]);
+	if (hi > c->nr)
+		return 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = memcmp(chunk_cache_record(c, 0, mi), key, len);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+struct chunk_cache_write_context {
+	const struct chunk_cache_format *format;
+	const uint32_t *counts;
+	void *data;
+	/* the chunk of the format that is written next */
+	int chunk;
+};
+
+static int write_chunk_cache_oid_fanout(struct hashfile *f, void *data)
+{
+	struct chunk_cache_write_context *ctx = data;
+	uint32_t total = 0;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		total += ctx->counts[i];
+		hashwrite_be32(f, total);
+	}
+	return 0;
+}
+
+/* write_chunkfile() writes the chunks in the order they were added */
+static int write_chunk_cache_chunk(struct hashfile *f, void *data)
+{
+	struct chunk_cache_write_context *ctx = data;
+
+	return ctx->format->chunks[ctx->chunk++].write(f, ctx->data);
+}
+
+int write_chunk_cache(struct repository *r,
+		      const struct chunk_cache_format *format,
+		      struct chunk_cache_slot *slot,
+		      const uint32_t counts[256], const size_t *chunk_nr,
+		      void *data)
+{
+	struct chunk_cache_write_context ctx = {
+		.format = format,
+		.counts = counts,
+		.data = data,
+	};
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	struct chunkfile *cf;
+	char *path = get_chunk_cache_filename(r->objects->odb, format);
+	int i, ret = 0;
+
+	if (safe_create_leading_directories(path)) {
+		ret = error(_("unable to create leading directories of %s"),
+			    path);
+		goto out;
+	}
+
+	hold_lock_file_for_update_mode(&lk, path, LOCK_DIE_ON_ERROR, 0444);
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	cf = init_chunkfile(f);
+	add_chunk(cf, CHUNK_CACHE_CHUNKID_OIDFANOUT, CHUNK_CACHE_FANOUT_SIZE,
+		  write_chunk_cache_oid_fanout);
+	for (i = 0; i < format->nr_chunks; i++)
+		add_chunk(cf, format->chunks[i].id,
+			  st_mult(chunk_record_size(&format->chunks[i]),
+				  chunk_nr[i]),
+			  write_chunk_cache_chunk);
+
+	hashwrite_be32(f, format->signature);
+	hashwrite_u8(f, format->version);
+	hashwrite_u8(f, oid_version(the_hash_algo));
+	hashwrite_u8(f, get_num_chunks(cf));
+	hashwrite_u8(f, 0); /* unused padding byte */
+
+	write_chunkfile(cf, &ctx);
+	free_chunkfile(cf);
+
+	close_chunk_cache(slot);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("could not write '%s'"), path);
+
+out:
+	free(path);
+	return ret;
+}
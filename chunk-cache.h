@@ -0,0 +1,111 @@
+#ifndef CHUNK_CACHE_H
+#define CHUNK_CACHE_H
+
+#include "chunk-format.h"
+
+struct repository;
+
+/*
+ * Caches that live in objects/info as chunk files, such as the
+ * line-history index and the patch-id cache, share the same layout:
+ *
+ *  - an 8-byte header: a 4-byte signature, the version, the hash
+ *    version, the number of chunks and an unused padding byte;
+ *  - the table of contents;
+ *  - an OID fanout chunk, counting the keys by their first byte;
+ *  - the chunks of the format. The first one holds the keys, sorted,
+ *    each starting with an object ID. The others hold either one
+ *    record per key, or any number of records that the per-key ones
+ *    point into.
+ *
+ * This file reads and writes that layout; what the records mean is up
+ * to the users of each format.
+ */
+
+#define CHUNK_CACHE_MAX_CHUNKS 4
+
+struct chunk_cache_chunk {
+	uint32_t id;
+	/* for messages, e.g. "blob pair" */
+	const char *desc;
+	/* each record is this many object IDs, then this many bytes */
+	unsigned oids;
+	size_t bytes;
+	/* one record per key, rather than any number of them */
+	unsigned per_key : 1;
+	/* writes all records of the chunk, see write_chunk_cache() */
+	chunk_write_fn write;
+};
+
+struct chunk_cache_format {
+	/* the name of the file in objects/info */
+	const char *filename;
+	/* for messages, e.g. "patch-id cache" */
+	const char *desc;
+	uint32_t signature;
+	unsigned char version;
+	/* the chunks after the OID fanout, the keys first */
+	struct chunk_cache_chunk chunks[CHUNK_CACHE_MAX_CHUNKS];
+	int nr_chunks;
+};
+
+struct chunk_cache {
+	const struct chunk_cache_format *format;
+	const unsigned char *data;
+	size_t data_len;
+
+	/* the number of keys */
+	uint32_t nr;
+	const uint32_t *oid_fanout;
+
+	/* for each chunk of the format, where it is and how many records */
+	const unsigned char *chunk[CHUNK_CACHE_MAX_CHUNKS];
+	size_t record_size[CHUNK_CACHE_MAX_CHUNKS];
+	uint32_t chunk_nr[CHUNK_CACHE_MAX_CHUNKS];
+};
+
+/* How a cache is hooked up to a `struct raw_object_store`. */
+struct chunk_cache_slot {
+	struct chunk_cache *cache;
+	unsigned attempted : 1; /* if loading has been attempted */
+};
+
+/*
+ * Return the cache of 'format' for the main object directory of 'r',
+ * loading it into 'slot' on first use. Returns NULL if there is no such
+ * file, or if it is corrupt, in which case an error has been printed.
+ */
+struct chunk_cache *prepare_chunk_cache(struct repository *r,
+					const struct chunk_cache_format *format,
+					struct chunk_cache_slot *slot);
+
+/* Unmap the cache in 'slot', if any, so that it is loaded again. */
+void close_chunk_cache(struct chunk_cache_slot *slot);
+
+/* Return record 'pos' of chunk 'chunk'. */
+static inline const unsigned char *chunk_cache_record(
+		const struct chunk_cache *c, int chunk, uint32_t pos)
+{
+	return c->chunk[chunk] + st_mult(c->record_size[chunk], pos);
+}
+
+/*
+ * Look for the key that starts with the 'len' bytes of 'key'. Returns 1
+ * and sets 'pos' if it is found, and 0 otherwise.
+ */
+int chunk_cache_find(const struct chunk_cache *c,
+		     const unsigned char *key, size_t len, uint32_t *pos);
+
+/*
+ * Write a cache of 'format' to the main object directory of 'r', and
+ * close the one in 'slot'. 'counts' holds the number of keys by their
+ * first byte. Each chunk of the format gets 'chunk_nr' records, written
+ * by its write function, which is passed 'data'.
+ */
+int write_chunk_cache(struct repository *r,
+		      const struct chunk_cache_format *format,
+		      struct chunk_cache_slot *slot,
+		      const uint32_t counts[256], const size_t *chunk_nr,
+		      void *data);
+
+#endif
@@ -0,0 +1,157 @@
+#include "git-compat-util.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "commit-graph-walk.h"
+#include "ewah/ewok.h"
+#include "repository.h"
+
+static int entry_before(const struct graph_walk_entry *a,
+			const struct graph_walk_entry *b)
+{
+	if (a->generation != b->generation)
+		return a->generation > b->generation;
+	return a->pos > b->pos;
+}
+
+void graph_queue_put(struct graph_queue *queue, struct commit_graph *g,
+		     uint32_t pos)
+{
+	struct graph_walk_entry e;
+	size_t ix, parent;
+
+	e.generation = commit_graph_generation_at(g, pos);
+	e.pos = pos;
+
+	ALLOC_GROW(queue->entries, queue->nr + 1, queue->alloc);
+	for (ix = queue->nr++; ix; ix = parent) {
+		parent = (ix - 1) / 2;
+		if (!entry_before(&e, &queue->entries[parent]))
+			break;
+		queue->entries[ix] = queue->entries[parent];
+	}
+	queue->entries[ix] = e;
+}
+
+uint32_t graph_queue_get(struct graph_queue *queue)
+{
+	struct graph_walk_entry last;
+	uint32_t result = queue->entries[0].pos;
+	size_t ix, child;
+
+	last = queue->entries[--queue->nr];
+	for (ix = 0; (child = 2 * ix + 1) < queue->nr; ix = child) {
+		if (child + 1 < queue->nr &&
+		    entry_before(&queue->entries[child + 1], &queue->entries[child]))
+			child++;
+		if (!entry_before(&queue->entries[child], &last))
+			break;
+		queue->entries[ix] = queue->entries[child];
+	}
+	queue->entries[ix] = last;
+	return result;
+}
+
+void graph_queue_clear(struct graph_queue *queue)
+{
+	FREE_AND_NULL(queue->entries);
+	queue->nr = queue->alloc = 0;
+}
+
+/*
+ * Queue 'pos' if it has not been seen yet, and mark it uninteresting if
+ * asked to. Generation numbers guarantee that a commit is only popped
+ * after all of its descendants in the walk, so a seen commit that gets
+ * here is still in the queue and its flags can be updated in place.
+ */
+static void add_pos(struct graph_walk *walk, uint32_t pos, int uninteresting)
+{
+	if (!bitmap_get(walk->seen, pos)) {
+		bitmap_set(walk->seen, pos);
+		if (uninteresting)
+			bitmap_set(walk->uninteresting, pos);
+		else
+			walk->queue_interesting++;
+		graph_queue_put(&walk->queue, walk->graph, pos);
+	} else if (uninteresting && !bitmap_get(walk->uninteresting, pos)) {
+		bitmap_set(walk->uninteresting, pos);
+		walk->queue_interesting--;
+	}
+}
+
+int graph_walk_init(struct graph_walk *walk, struct repository *r)
+{
+	size_t words;
+
+	memset(walk, 0, sizeof(*walk));
+
+	if (!generation_numbers_enabled(r))
+		return -1;
+
+	walk->repo = r;
+	walk->graph = r->objects->commit_graph;
+	words = DIV_ROUND_UP(walk->graph->num_commits +
+			     walk->graph->num_commits_in_base, BITS_IN_EWORD);
+	walk->seen = bitmap_word_alloc(words);
+	walk->uninteresting = bitmap_word_alloc(words);
+	return 0;
+}
+
+int graph_walk_add_tip(struct graph_walk *walk, struct commit *commit,
+		       int uninteresting)
+{
+	uint32_t pos;
+
+	if (!repo_find_commit_pos_in_graph(walk->repo, commit, &pos))
+		return -1;
+	add_pos(walk, pos, uninteresting);
+	return 0;
+}
+
+int graph_walk_next(struct graph_walk *walk, uint32_t *pos)
+{
+	while (walk->queue_interesting) {
+		uint32_t p = graph_queue_get(&walk->queue);
+		int uninteresting = bitmap_get(walk->uninteresting, p);
+		size_t i;
+
+		walk->visited++;
+		if (!uninteresting)
+			walk->queue_interesting--;
+
+		if (commit_graph_parents_at(walk->graph, p, &walk->parents,
+					    &walk->parents_nr,
+					    &walk->parents_alloc) < 0)
+			return -1;
+		for (i = 0; i < walk->parents_nr; i++)
+			add_pos(walk, walk->parents[i], uninteresting);
+
+		if (!uninteresting) {
+			*pos = p;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void graph_walk_oid(struct graph_walk *walk, uint32_t pos,
+		    struct object_id *oid)
+{
+	commit_graph_oid_at(walk->graph, pos, oid);
+}
+
+struct commit *graph_walk_commit(struct graph_walk *walk, uint32_t pos)
+{
+	struct object_id oid;
+
+	commit_graph_oid_at(walk->graph, pos, &oid);
+	return lookup_commit_in_graph(walk->repo, &oid);
+}
+
+void graph_walk_release(struct graph_walk *walk)
+{
+	bitmap_free(walk->seen);
+	bitmap_free(walk->uninteresting);
+	graph_queue_clear(&walk->queue);
+	free(walk->parents);
+	memset(walk, 0, sizeof(*walk));
+}
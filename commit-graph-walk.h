@@ -0,0 +1,111 @@
+#ifndef COMMIT_GRAPH_WALK_H
+#define COMMIT_GRAPH_WALK_H
+
+struct bitmap;
+struct commit;
+struct commit_graph;
+struct object_id;
+struct repository;
+
+/*
+ * A history walk that works on commit-graph positions instead of
+ * 'struct commit' objects: parents are read straight from the graph
+ * file, the SEEN and UNINTERESTING flags live in dense bit arrays
+ * indexed by position, and the queue holds positions ordered by
+ * generation number. Nothing is allocated per visited commit, which
+ * makes walks over very large histories much cheaper than the general
+ * revision machinery when the caller only needs positions or object
+ * IDs.
+ *
+ * The walk returns every commit reachable from an interesting tip but
+ * not from an uninteresting one, in descending order of generation
+ * number, and stops as soon as only uninteresting commits are left to
+ * explore. Because generation numbers never lie about reachability,
+ * the result is exact even in the presence of clock skew.
+ *
+ *	struct graph_walk walk;
+ *	uint32_t pos;
+ *
+ *	if (graph_walk_init(&walk, r) < 0)
+ *		return -1; // no usable commit-graph
+ *	if (graph_walk_add_tip(&walk, tip, 0) < 0 ||
+ *	    graph_walk_add_tip(&walk, base, 1) < 0)
+ *		goto fallback; // a tip is not in the commit-graph
+ *	while (graph_walk_next(&walk, &pos) > 0)
+ *		...;
+ *	graph_walk_release(&walk);
+ */
+
+struct graph_walk_entry {
+	timestamp_t generation;
+	uint32_t pos;
+};
+
+/*
+ * A priority queue of commit-graph positions, which hands out the
+ * position with the highest generation number first. Ties are broken by
+ * position, so that the order does not depend on the order of insertion.
+ * A commit is therefore only handed out after all of its descendants
+ * that are in the queue.
+ */
+struct graph_queue {
+	struct graph_walk_entry *entries;
+	size_t nr, alloc;
+};
+
+void graph_queue_put(struct graph_queue *queue, struct commit_graph *g,
+		     uint32_t pos);
+/* The queue must not be empty. */
+uint32_t graph_queue_get(struct graph_queue *queue);
+void graph_queue_clear(struct graph_queue *queue);
+
+struct graph_walk {
+	struct repository *repo;
+	struct commit_graph *graph;
+
+	struct bitmap *seen;
+	struct bitmap *uninteresting;
+
+	struct graph_queue queue;
+	/* number of queued entries that are not uninteresting */
+	size_t queue_interesting;
+
+	uint32_t *parents;
+	size_t parents_nr, parents_alloc;
+
+	/* number of commits popped from the queue */
+	size_t visited;
+};
+
+/*
+ * Prepare a walk over the commit-graph of 'r'. Returns -1 if the
+ * repository has no commit-graph, or one without generation numbers.
+ */
+int graph_walk_init(struct graph_walk *walk, struct repository *r);
+
+/*
+ * Start the walk at 'commit', which must have been parsed. Returns -1 if
+ * the commit is not in the commit-graph; the caller should then fall
+ * back to the revision machinery.
+ */
+int graph_walk_add_tip(struct graph_walk *walk, struct commit *commit,
+		       int uninteresting);
+
+/*
+ * Store the position of the next commit of the walk in '*pos' and return
+ * 1, or return 0 once the walk is over and -1 if the commit-graph turns
+ * out to be corrupt.
+ */
+int graph_walk_next(struct graph_walk *walk, uint32_t *pos);
+
+/*
+ * Materialize a position returned by graph_walk_next(), either as an
+ * object ID or as a parsed commit.
+ */
+void graph_walk_oid(struct graph_walk *walk, uint32_t pos,
+		    struct object_id *oid);
+struct commit *graph_walk_commit(struct graph_walk *walk, uint32_t pos);
+
+void graph_walk_release(struct graph_walk *walk);
+
+#endif
@@ -52,9 +52,17 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_REACHABILITY 0x524c424c /* "RLBL" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
+/*
+ * Each commit gets two reachability labels, one per depth-first
+ * traversal order, stored as (low, post) pairs.
+ */
+#define GRAPH_REACH_DIMENSIONS 2
+#define GRAPH_REACH_LABEL_WIDTH (GRAPH_REACH_DIMENSIONS * 2 * sizeof(uint32_t))
+
 #define GRAPH_VERSION_1 0x1
 #define GRAPH_VERSION GRAPH_VERSION_1
 
@@ -367,6 +375,18 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_reachability(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / GRAPH_REACH_LABEL_WIDTH != g->num_commits) {
+		warning(_("commit-graph reachability index chunk is wrong size"));
+		return -1;
+	}
+	g->chunk_reachability = chunk_start;
+	return 0;
+}
+
 struct commit_graph *parse_commit_graph(struct repo_settings *s,
 					void *graph_map, size_t graph_size)
 {
@@ -463,6 +483,9 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 			   graph_read_bloom_data, graph);
 	}
 
+	read_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+		   graph_read_reachability, graph);
+
 	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
 		init_bloom_filters();
 	} else {
@@ -566,6 +589,19 @@ static void validate_mixed_bloom_settings(struct commit_graph *g)
 	}
 }
 
+/*
+ * The reachability labels of a layer are computed on top of the labels of
+ * its base layers, so they are only usable if all base layers have them.
+ */
+static int validate_reachability_chain(struct commit_graph *g)
+{
+	if (!g)
+		return 1;
+	if (!validate_reachability_chain(g->base_graph))
+		g->chunk_reachability = NULL;
+	return !!g->chunk_reachability;
+}
+
 static int add_graph_to_chain(struct commit_graph *g,
 			      struct commit_graph *chain,
 			      struct object_id *oids,
@@ -691,6 +727,7 @@ struct commit_graph *load_commit_graph_chain_fd_st(struct repository *r,
 
 	validate_mixed_generation_chain(graph_chain);
 	validate_mixed_bloom_settings(graph_chain);
+	validate_reachability_chain(graph_chain);
 
 	free(oids);
 	fclose(fp);
@@ -886,12 +923,46 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t commit_date_at(struct commit_graph *g,
+				  const unsigned char *commit_data)
+{
+	uint64_t date_high, date_low;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+static timestamp_t generation_at(struct commit_graph *g, uint32_t lex_index,
+				 const unsigned char *commit_data,
+				 timestamp_t date)
+{
+	uint32_t offset_pos;
+	uint64_t offset;
+
+	if (!g->read_generation_data)
+		return get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	offset = (timestamp_t)get_be32(g->chunk_generation_data + st_mult(sizeof(uint32_t), lex_index));
+
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+
+		offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+		if (g->chunk_generation_data_overflow_size / sizeof(uint64_t) <= offset_pos)
+			die(_("commit-graph overflow generation data is too small"));
+		return date +
+			get_be64(g->chunk_generation_data_overflow + sizeof(uint64_t) * offset_pos);
+	}
+	return date + offset;
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	const unsigned char *commit_data;
 	struct commit_graph_data *graph_data;
-	uint32_t lex_index, offset_pos;
-	uint64_t date_high, date_low, offset;
+	uint32_t lex_index;
 
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
@@ -905,26 +976,9 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	graph_data = commit_graph_data_at(item);
 	graph_data->graph_pos = pos;
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	if (g->read_generation_data) {
-		offset = (timestamp_t)get_be32(g->chunk_generation_data + st_mult(sizeof(uint32_t), lex_index));
-
-		if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
-			if (!g->chunk_generation_data_overflow)
-				die(_("commit-graph requires overflow generation data but has none"));
-
-			offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
-			if (g->chunk_generation_data_overflow_size / sizeof(uint64_t) <= offset_pos)
-				die(_("commit-graph overflow generation data is too small"));
-			graph_data->generation = item->date +
-				get_be64(g->chunk_generation_data_overflow + sizeof(uint64_t) * offset_pos);
-		} else
-			graph_data->generation = item->date + offset;
-	} else
-		graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = commit_date_at(g, commit_data);
+	graph_data->generation = generation_at(g, lex_index, commit_data,
+					       item->date);
 
 	if (g->topo_levels)
 		*topo_level_slab_at(g->topo_levels, item) = get_be32(commit_data + g->hash_len + 8) >> 2;
@@ -1129,6 +1183,158 @@ struct tree *get_commit_tree_in_graph(struct repository *r, const struct commit
 	return get_commit_tree_in_graph_one(r, r->objects->commit_graph, c);
 }
 
+static const unsigned char *commit_data_at(struct commit_graph **gp,
+					   uint32_t pos, uint32_t *lex_index)
+{
+	struct commit_graph *g = *gp;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g)
+		BUG("NULL commit-graph");
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
+	*gp = g;
+	*lex_index = pos - g->num_commits_in_base;
+	return g->chunk_commit_data + st_mult(GRAPH_DATA_WIDTH, *lex_index);
+}
+
+void commit_graph_oid_at(struct commit_graph *g, uint32_t pos,
+			 struct object_id *oid)
+{
+	load_oid_from_graph(g, pos, oid);
+}
+
+timestamp_t commit_graph_generation_at(struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	commit_data = commit_data_at(&g, pos, &lex_index);
+	return generation_at(g, lex_index, commit_data,
+			     commit_date_at(g, commit_data));
+}
+
+static void append_parent_pos(struct commit_graph *g, uint32_t parent,
+			      uint32_t **parents, size_t *nr, size_t *alloc)
+{
+	if (parent >= g->num_commits + g->num_commits_in_base)
+		die("invalid parent position %"PRIu32, parent);
+	ALLOC_GROW(*parents, *nr + 1, *alloc);
+	(*parents)[(*nr)++] = parent;
+}
+
+int commit_graph_parents_at(struct commit_graph *g, uint32_t pos,
+			    uint32_t **parents, size_t *nr, size_t *alloc)
+{
+	struct commit_graph *top = g;
+	const unsigned char *commit_data;
+	uint32_t lex_index, edge_value, parent_data_pos;
+
+	*nr = 0;
+	commit_data = commit_data_at(&g, pos, &lex_index);
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	append_parent_pos(top, edge_value, parents, nr, alloc);
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		append_parent_pos(top, edge_value, parents, nr, alloc);
+		return 0;
+	}
+
+	parent_data_pos = edge_value & GRAPH_EDGE_LAST_MASK;
+	do {
+		if (g->chunk_extra_edges_size / sizeof(uint32_t) <= parent_data_pos)
+			return error(_("commit-graph extra-edges pointer out of bounds"));
+		edge_value = get_be32(g->chunk_extra_edges +
+				      sizeof(uint32_t) * parent_data_pos);
+		append_parent_pos(top, edge_value & GRAPH_EDGE_LAST_MASK,
+				  parents, nr, alloc);
+		parent_data_pos++;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 0;
+}
+
+/*
+ * A reachability label assigns each commit an interval [low, post] per
+ * dimension, where 'post' is the commit's rank in a depth-first
+ * post-order traversal along parent links and 'low' is the smallest
+ * 'post' among the commit and all of its ancestors. If 'to' is reachable
+ * from 'from', the interval of 'to' is contained in that of 'from' in
+ * every dimension; the converse does not hold, so a containment means
+ * "maybe" and the caller has to walk.
+ */
+struct reach_label {
+	uint32_t low[GRAPH_REACH_DIMENSIONS];
+	uint32_t post[GRAPH_REACH_DIMENSIONS];
+};
+
+static int read_reach_label(struct commit_graph *g, const struct commit *c,
+			    struct reach_label *label)
+{
+	uint32_t graph_pos = commit_graph_position(c);
+	const unsigned char *p;
+	int i;
+
+	if (graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return 0;
+	while (g && graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || !g->chunk_reachability ||
+	    graph_pos >= g->num_commits + g->num_commits_in_base)
+		return 0;
+
+	p = g->chunk_reachability +
+		st_mult(GRAPH_REACH_LABEL_WIDTH, graph_pos - g->num_commits_in_base);
+	for (i = 0; i < GRAPH_REACH_DIMENSIONS; i++) {
+		label->low[i] = get_be32(p + 8 * i);
+		label->post[i] = get_be32(p + 8 * i + 4);
+	}
+	return 1;
+}
+
+static int reach_labels_exclude(const struct reach_label *from,
+				const struct reach_label *to)
+{
+	int i;
+
+	for (i = 0; i < GRAPH_REACH_DIMENSIONS; i++)
+		if (to->low[i] < from->low[i] || to->post[i] > from->post[i])
+			return 1;
+	return 0;
+}
+
+int commit_graph_excludes_reach(struct repository *r,
+				const struct commit *from,
+				const struct commit *to)
+{
+	struct reach_label from_label, to_label;
+
+	if (!read_reach_label(r->objects->commit_graph, from, &from_label) ||
+	    !read_reach_label(r->objects->commit_graph, to, &to_label) ||
+	    !reach_labels_exclude(&from_label, &to_label))
+		return 0;
+
+	trace2_counter_add(TRACE2_COUNTER_ID_COMMIT_GRAPH_REACH_EXCLUDED, 1);
+	return 1;
+}
+
+struct reach_label_state {
+	struct reach_label label;
+	unsigned in_layer:1,
+		 loaded:1,
+		 done:GRAPH_REACH_DIMENSIONS;
+};
+
+define_commit_slab(reach_label_slab, struct reach_label_state);
+
 struct packed_commit_list {
 	struct commit **list;
 	size_t nr;
@@ -1163,9 +1369,11 @@ struct write_commit_graph_context {
 		 changed_paths:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
-		 trust_generation_numbers:1;
+		 trust_generation_numbers:1,
+		 reachability_index:1;
 
 	struct topo_level_slab *topo_levels;
+	struct reach_label_slab *reach_labels;
 	const struct commit_graph_opts *opts;
 	size_t total_bloom_filter_data_size;
 	const struct bloom_filter_settings *bloom_settings;
@@ -1708,6 +1916,134 @@ static void set_generation_v2(struct commit *c, timestamp_t t,
 	g->generation = t;
 }
 
+/*
+ * Look up the 'low' value of a parent for the given dimension. Returns -1
+ * if the parent is in the layer being written and not labelled yet, and
+ * -2 if it is in a base layer without labels.
+ */
+static int get_parent_reach_low(struct write_commit_graph_context *ctx,
+				struct commit *parent, int dim, uint32_t *low)
+{
+	struct reach_label_state *st = reach_label_slab_at(ctx->reach_labels, parent);
+
+	if (st->in_layer) {
+		if (!(st->done & (1 << dim)))
+			return -1;
+	} else if (!st->loaded) {
+		if (!read_reach_label(ctx->r->objects->commit_graph, parent,
+				      &st->label))
+			return -2;
+		st->loaded = 1;
+	}
+	*low = st->label.low[dim];
+	return 0;
+}
+
+/*
+ * Assign 'post' ranks in depth-first post-order, continuing after the
+ * commits of the base layers so that labels stay comparable across a
+ * split commit-graph chain. The first dimension visits commits and their
+ * parents in order, the second in reverse order, which makes the two
+ * labels prune different pairs.
+ */
+static int compute_reach_labels_dim(struct write_commit_graph_context *ctx,
+				    int dim)
+{
+	uint32_t next_post = ctx->new_num_commits_in_base;
+	struct commit_list *stack = NULL;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[dim ? ctx->commits.nr - 1 - i : i];
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		if (reach_label_slab_at(ctx->reach_labels, c)->done & (1 << dim))
+			continue;
+
+		commit_list_insert(c, &stack);
+		while (stack) {
+			struct commit *cur = stack->item;
+			struct reach_label_state *st =
+				reach_label_slab_at(ctx->reach_labels, cur);
+			struct commit *pending = NULL;
+			struct commit_list *parent;
+			uint32_t low = UINT32_MAX;
+
+			if (st->done & (1 << dim)) {
+				pop_commit(&stack);
+				continue;
+			}
+
+			repo_parse_commit(ctx->r, cur);
+			for (parent = cur->parents; parent; parent = parent->next) {
+				uint32_t parent_low;
+
+				switch (get_parent_reach_low(ctx, parent->item,
+							     dim, &parent_low)) {
+				case 0:
+					if (parent_low < low)
+						low = parent_low;
+					break;
+				case -1:
+					pending = parent->item;
+					break;
+				default:
+					free_commit_list(stack);
+					return -1;
+				}
+				if (pending && !dim)
+					break;
+			}
+
+			if (pending) {
+				commit_list_insert(pending, &stack);
+				continue;
+			}
+
+			st->label.post[dim] = ++next_post;
+			st->label.low[dim] = low < next_post ? low : next_post;
+			st->done |= 1 << dim;
+			pop_commit(&stack);
+		}
+	}
+	return 0;
+}
+
+static void compute_reachability_labels(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g;
+	int i;
+
+	for (g = ctx->new_base_graph; g; g = g->base_graph) {
+		if (!g->chunk_reachability) {
+			warning(_("not writing a reachability index: "
+				  "base commit-graph layer '%s' has none"),
+				oid_to_hex(&g->oid));
+			ctx->reachability_index = 0;
+			return;
+		}
+	}
+
+	for (i = 0; i < ctx->commits.nr; i++)
+		reach_label_slab_at(ctx->reach_labels, ctx->commits.list[i])->in_layer = 1;
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Computing commit graph reachability index"),
+					st_mult(GRAPH_REACH_DIMENSIONS, ctx->commits.nr));
+	ctx->progress_cnt = 0;
+
+	for (i = 0; i < GRAPH_REACH_DIMENSIONS; i++) {
+		if (compute_reach_labels_dim(ctx, i)) {
+			warning(_("not writing a reachability index: "
+				  "some parents are not labelled"));
+			ctx->reachability_index = 0;
+			break;
+		}
+	}
+	stop_progress(&ctx->progress);
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -2018,6 +2354,25 @@ static int write_graph_chunk_base_1(struct hashfile *f,
 	return num + 1;
 }
 
+static int write_graph_chunk_reachability(struct hashfile *f,
+					  void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	int i, j;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct reach_label_state *st =
+			reach_label_slab_at(ctx->reach_labels, ctx->commits.list[i]);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		for (j = 0; j < GRAPH_REACH_DIMENSIONS; j++) {
+			hashwrite_be32(f, st->label.low[j]);
+			hashwrite_be32(f, st->label.post[j]);
+		}
+	}
+	return 0;
+}
+
 static int write_graph_chunk_base(struct hashfile *f,
 				    void *data)
 {
@@ -2108,6 +2463,10 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		add_chunk(cf, GRAPH_CHUNKID_EXTRAEDGES,
 			  st_mult(4, ctx->num_extra_edges),
 			  write_graph_chunk_extra_edges);
+	if (ctx->reachability_index)
+		add_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+			  st_mult(GRAPH_REACH_LABEL_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_reachability);
 	if (ctx->changed_paths) {
 		add_chunk(cf, GRAPH_CHUNKID_BLOOMINDEXES,
 			  st_mult(sizeof(uint32_t), ctx->commits.nr),
@@ -2501,6 +2860,7 @@ int write_commit_graph(struct object_directory *odb,
 	int replace = 0;
 	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 	struct topo_level_slab topo_levels;
+	struct reach_label_slab reach_labels;
 
 	prepare_repo_settings(r);
 	if (!r->settings.core_commit_graph) {
@@ -2539,6 +2899,8 @@ int write_commit_graph(struct object_directory *odb,
 
 	init_topo_level_slab(&topo_levels);
 	ctx->topo_levels = &topo_levels;
+	init_reach_label_slab(&reach_labels);
+	ctx->reach_labels = &reach_labels;
 
 	prepare_commit_graph(ctx->r);
 	if (ctx->r->objects->commit_graph) {
@@ -2572,6 +2934,16 @@ int write_commit_graph(struct object_directory *odb,
 
 	bloom_settings.hash_version = bloom_settings.hash_version == 2 ? 2 : 1;
 
+	if (flags & COMMIT_GRAPH_WRITE_REACHABILITY_INDEX)
+		ctx->reachability_index = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* Keep the reachability index if we have one already. */
+		if (g && g->chunk_reachability)
+			ctx->reachability_index = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
 
@@ -2650,6 +3022,9 @@ int write_commit_graph(struct object_directory *odb,
 	if (ctx->write_generation_data)
 		compute_generation_numbers(ctx);
 
+	if (ctx->reachability_index)
+		compute_reachability_labels(ctx);
+
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
 
@@ -2669,6 +3044,7 @@ int write_commit_graph(struct object_directory *odb,
 	free(ctx->commits.list);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
+	clear_reach_label_slab(&reach_labels);
 
 	for (i = 0; i < ctx->num_commit_graphs_before; i++)
 		free(ctx->commit_graph_filenames_before[i]);
@@ -2810,6 +3186,17 @@ static int verify_one_commit_graph(struct repository *r,
 			if (generation > max_generation)
 				max_generation = generation;
 
+			if (g->chunk_reachability) {
+				struct reach_label commit_label, parent_label;
+
+				if (read_reach_label(g, graph_commit, &commit_label) &&
+				    read_reach_label(g, graph_parents->item, &parent_label) &&
+				    reach_labels_exclude(&commit_label, &parent_label))
+					graph_report(_("commit-graph reachability label for commit %s excludes its parent %s"),
+						     oid_to_hex(&cur_oid),
+						     oid_to_hex(&graph_parents->item->object.oid));
+			}
+
 			graph_parents = graph_parents->next;
 			odb_parents = odb_parents->next;
 		}
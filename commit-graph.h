@@ -25,6 +25,7 @@ void git_test_write_commit_graph_or_die(void);
 
 struct commit;
 struct bloom_filter_settings;
+struct commit_graph;
 struct repository;
 struct raw_object_store;
 struct string_list;
@@ -80,6 +81,32 @@ void load_commit_graph_info(struct repository *r, struct commit *item);
 struct tree *get_commit_tree_in_graph(struct repository *r,
 				      const struct commit *c);
 
+/*
+ * Position-based accessors for callers that walk the graph without
+ * materializing a 'struct commit' per commit (see commit-graph-walk.h).
+ * 'g' is the top-most layer and 'pos' a position in the whole chain, as
+ * returned by repo_find_commit_pos_in_graph().
+ *
+ * commit_graph_parents_at() stores the parent positions of 'pos' in
+ * '*parents', growing it with ALLOC_GROW() so the buffer can be reused
+ * across calls, and returns 0 on success or -1 if the graph is corrupt.
+ */
+void commit_graph_oid_at(struct commit_graph *g, uint32_t pos,
+			 struct object_id *oid);
+timestamp_t commit_graph_generation_at(struct commit_graph *g, uint32_t pos);
+int commit_graph_parents_at(struct commit_graph *g, uint32_t pos,
+			    uint32_t **parents, size_t *nr, size_t *alloc);
+
+/*
+ * Return 1 if the reachability index of the commit-graph proves that 'to'
+ * cannot be reached from 'from' by following parent links, and 0 if the
+ * index is not available for either commit or cannot rule it out. Both
+ * commits must have been parsed.
+ */
+int commit_graph_excludes_reach(struct repository *r,
+				const struct commit *from,
+				const struct commit *to);
+
 struct commit_graph {
 	const unsigned char *data;
 	size_t data_len;
@@ -108,6 +135,7 @@ struct commit_graph {
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
 	size_t chunk_bloom_data_size;
+	const unsigned char *chunk_reachability;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -151,6 +179,8 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_REACHABILITY_INDEX = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_REACHABILITY_INDEX = (1 << 6),
 };
 
 enum commit_graph_split_flags {
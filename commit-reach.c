@@ -3,6 +3,7 @@
 #include "git-compat-util.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "commit-graph-walk.h"
 #include "decorate.h"
 #include "hex.h"
 #include "prio-queue.h"
@@ -11,6 +12,9 @@
 #include "tag.h"
 #include "commit-reach.h"
 #include "ewah/ewok.h"
+#include "parse.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 /* Remember to update object flag allocation in object.h */
 #define PARENT1		(1u<<16)
@@ -521,6 +525,20 @@ int repo_is_descendant_of(struct repository *r,
 	}
 }
 
+/*
+ * Can the reachability index in the commit-graph prove that none of the
+ * commits in "to" is reachable from "from"?
+ */
+static int reach_excluded_for_all(struct repository *r,
+				  const struct commit *from,
+				  const struct commit_list *to)
+{
+	for (; to; to = to->next)
+		if (!commit_graph_excludes_reach(r, from, to->item))
+			return 0;
+	return 1;
+}
+
 /*
  * Is "commit" an ancestor of one of the "references"?
  */
@@ -547,6 +565,12 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 	if (generation > max_generation)
 		return ret;
 
+	for (i = 0; i < nr_reference; i++)
+		if (!commit_graph_excludes_reach(r, reference[i], commit))
+			break;
+	if (i == nr_reference)
+		return ret;
+
 	if (paint_down_to_common(r, commit,
 				 nr_reference, reference,
 				 generation, ignore_missing_commits, &bases))
@@ -706,6 +730,11 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (commit_graph_generation(candidate) < cutoff)
 		return CONTAINS_NO;
 
+	if (reach_excluded_for_all(the_repository, candidate, want)) {
+		*cached = CONTAINS_NO;
+		return CONTAINS_NO;
+	}
+
 	return CONTAINS_UNKNOWN;
 }
 
@@ -920,8 +949,15 @@ int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 		to_iter = to_iter->next;
 	}
 
-	result = can_all_from_reach_with_flag(&from_objs, PARENT2, PARENT1,
-					      min_commit_date, min_generation);
+	for (from_iter = from; from_iter; from_iter = from_iter->next)
+		if (reach_excluded_for_all(the_repository, from_iter->item, to))
+			break;
+
+	if (from_iter)
+		result = 0;
+	else
+		result = can_all_from_reach_with_flag(&from_objs, PARENT2, PARENT1,
+						      min_commit_date, min_generation);
 
 	while (from) {
 		clear_commit_marks(from->item, PARENT1);
@@ -1038,12 +1074,265 @@ static void free_bit_array(struct commit *c)
 	*bitmap = NULL;
 }
 
+/*
+ * Below this many counts per thread, repeating the common part of the
+ * walk in every thread costs more than the threads save.
+ */
+#define AHEAD_BEHIND_THREAD_COST 256
+#define AHEAD_BEHIND_MAX_THREADS 32
+
+/*
+ * A share of the counts of ahead_behind(), computed on its own thread by
+ * walking the commit-graph directly. The commits that the counts refer
+ * to are numbered again within the group, and these local indices are
+ * the bits of the group's bit arrays.
+ */
+struct ahead_behind_group {
+	pthread_t thread;
+	struct commit_graph *graph;
+	uint32_t nr_positions;
+
+	/* graph positions of the group's commits, by local index */
+	uint32_t *positions;
+	size_t positions_nr, positions_alloc;
+
+	struct ahead_behind_count *counts;
+	size_t counts_nr;
+	/* local indices of the tip and base of each count */
+	size_t *tip_bit;
+	size_t *base_bit;
+
+	int ret;
+};
+
+/* Per-position flags of a group walk. */
+#define AB_QUEUED (1u<<0)
+#define AB_STALE  (1u<<1)
+
+/*
+ * This is the walk of ahead_behind(), except that every piece of state
+ * that it keeps in 'struct commit' is kept in arrays indexed by graph
+ * position that belong to this thread, and that parents and generation
+ * numbers are read from the commit-graph, which is never written to.
+ * Generation numbers order the walk the same way, so the counts are the
+ * same.
+ */
+static void *ahead_behind_group_walk(void *data)
+{
+	struct ahead_behind_group *group = data;
+	size_t width = DIV_ROUND_UP(group->positions_nr, BITS_IN_EWORD);
+	struct bitmap **bit_array;
+	unsigned char *flags;
+	struct graph_queue queue = { 0 };
+	size_t nonstale = 0;
+	uint32_t *parents = NULL;
+	size_t parents_nr = 0, parents_alloc = 0;
+
+	CALLOC_ARRAY(bit_array, group->nr_positions);
+	CALLOC_ARRAY(flags, group->nr_positions);
+
+	for (size_t i = 0; i < group->positions_nr; i++) {
+		uint32_t pos = group->positions[i];
+
+		if (!bit_array[pos])
+			bit_array[pos] = bitmap_word_alloc(width);
+		bitmap_set(bit_array[pos], i);
+		if (!(flags[pos] & AB_QUEUED)) {
+			flags[pos] |= AB_QUEUED;
+			nonstale++;
+			graph_queue_put(&queue, group->graph, pos);
+		}
+	}
+
+	while (nonstale) {
+		uint32_t pos = graph_queue_get(&queue);
+		struct bitmap *bitmap_c = bit_array[pos];
+
+		if (!(flags[pos] & AB_STALE))
+			nonstale--;
+
+		for (size_t i = 0; i < group->counts_nr; i++) {
+			int reach_from_tip = !!bitmap_get(bitmap_c, group->tip_bit[i]);
+			int reach_from_base = !!bitmap_get(bitmap_c, group->base_bit[i]);
+
+			if (reach_from_tip ^ reach_from_base) {
+				if (reach_from_base)
+					group->counts[i].behind++;
+				else
+					group->counts[i].ahead++;
+			}
+		}
+
+		if (commit_graph_parents_at(group->graph, pos, &parents,
+					    &parents_nr, &parents_alloc) < 0) {
+			group->ret = -1;
+			break;
+		}
+		for (size_t i = 0; i < parents_nr; i++) {
+			uint32_t p = parents[i];
+
+			if (!bit_array[p])
+				bit_array[p] = bitmap_word_alloc(width);
+			bitmap_or(bit_array[p], bitmap_c);
+
+			/* see ahead_behind() */
+			if (!(flags[p] & AB_STALE) &&
+			    bitmap_popcount(bit_array[p]) == group->positions_nr) {
+				flags[p] |= AB_STALE;
+				if (flags[p] & AB_QUEUED)
+					nonstale--;
+			}
+			if (!(flags[p] & AB_QUEUED)) {
+				flags[p] |= AB_QUEUED;
+				if (!(flags[p] & AB_STALE))
+					nonstale++;
+				graph_queue_put(&queue, group->graph, p);
+			}
+		}
+
+		bitmap_free(bitmap_c);
+		bit_array[pos] = NULL;
+	}
+
+	while (queue.nr) {
+		uint32_t pos = graph_queue_get(&queue);
+		bitmap_free(bit_array[pos]);
+	}
+	graph_queue_clear(&queue);
+	free(parents);
+	free(bit_array);
+	free(flags);
+	return NULL;
+}
+
+static int ahead_behind_threads(size_t counts_nr)
+{
+	int threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	threads = counts_nr / AHEAD_BEHIND_THREAD_COST;
+	if (threads > online_cpus())
+		threads = online_cpus();
+	if (counts_nr > 1 && threads < 2 &&
+	    git_env_bool("GIT_TEST_AHEAD_BEHIND_THREADS", 0))
+		threads = 2;
+	if (threads > AHEAD_BEHIND_MAX_THREADS)
+		threads = AHEAD_BEHIND_MAX_THREADS;
+	return threads;
+}
+
+/*
+ * Split the counts into one group per thread and walk for each group in
+ * parallel. Returns -1 without touching the counts if some commit is not
+ * in the commit-graph, in which case the caller has to do the walk.
+ */
+static int ahead_behind_parallel(struct repository *r,
+				 struct commit **commits, size_t commits_nr,
+				 struct ahead_behind_count *counts, size_t counts_nr,
+				 int threads)
+{
+	struct ahead_behind_group *groups;
+	struct commit_graph *g;
+	uint32_t *positions;
+	size_t *local;
+	size_t per_group = DIV_ROUND_UP(counts_nr, threads);
+	int ret = 0;
+
+	if (!generation_numbers_enabled(r))
+		return -1;
+	g = r->objects->commit_graph;
+
+	ALLOC_ARRAY(positions, commits_nr);
+	for (size_t i = 0; i < commits_nr; i++) {
+		if (!repo_find_commit_pos_in_graph(r, commits[i], &positions[i])) {
+			free(positions);
+			return -1;
+		}
+	}
+
+	trace2_region_enter("commit-reach", "ahead_behind/parallel", r);
+	CALLOC_ARRAY(groups, threads);
+	ALLOC_ARRAY(local, commits_nr);
+	for (int t = 0; t < threads; t++) {
+		struct ahead_behind_group *group = &groups[t];
+		size_t first = t * per_group;
+
+		if (first >= counts_nr)
+			break;
+
+		group->graph = g;
+		group->nr_positions = g->num_commits + g->num_commits_in_base;
+		group->counts = counts + first;
+		group->counts_nr = counts_nr - first < per_group ?
+				   counts_nr - first : per_group;
+		ALLOC_ARRAY(group->tip_bit, group->counts_nr);
+		ALLOC_ARRAY(group->base_bit, group->counts_nr);
+
+		for (size_t i = 0; i < commits_nr; i++)
+			local[i] = SIZE_MAX;
+		for (size_t i = 0; i < group->counts_nr; i++) {
+			size_t *idx[] = {
+				&group->counts[i].tip_index,
+				&group->counts[i].base_index,
+			};
+			size_t *bit[] = { &group->tip_bit[i], &group->base_bit[i] };
+
+			for (size_t j = 0; j < ARRAY_SIZE(idx); j++) {
+				if (local[*idx[j]] == SIZE_MAX) {
+					local[*idx[j]] = group->positions_nr;
+					ALLOC_GROW(group->positions,
+						   group->positions_nr + 1,
+						   group->positions_alloc);
+					group->positions[group->positions_nr++] =
+						positions[*idx[j]];
+				}
+				*bit[j] = local[*idx[j]];
+			}
+		}
+
+		if (pthread_create(&group->thread, NULL,
+				   ahead_behind_group_walk, group))
+			die(_("unable to create thread for ahead-behind"));
+	}
+
+	for (int t = 0; t < threads; t++) {
+		struct ahead_behind_group *group = &groups[t];
+
+		if (!group->graph)
+			break;
+		pthread_join(group->thread, NULL);
+		if (group->ret)
+			ret = -1;
+		free(group->positions);
+		free(group->tip_bit);
+		free(group->base_bit);
+	}
+	trace2_data_intmax("commit-reach", r, "ahead_behind/threads", threads);
+	trace2_region_leave("commit-reach", "ahead_behind/parallel", r);
+
+	/* let the caller start over */
+	if (ret) {
+		for (size_t i = 0; i < counts_nr; i++) {
+			counts[i].ahead = 0;
+			counts[i].behind = 0;
+		}
+	}
+
+	free(local);
+	free(groups);
+	free(positions);
+	return ret;
+}
+
 void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
 {
 	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
+	int threads;
 
 	if (!commits_nr || !counts_nr)
 		return;
@@ -1053,6 +1342,12 @@ void ahead_behind(struct repository *r,
 		counts[i].behind = 0;
 	}
 
+	threads = ahead_behind_threads(counts_nr);
+	if (threads > 1 &&
+	    !ahead_behind_parallel(r, commits, commits_nr, counts, counts_nr,
+				   threads))
+		return;
+
 	ensure_generations_valid(r, commits, commits_nr);
 
 	init_bit_arrays(&bit_arrays);
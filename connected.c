@@ -10,6 +10,283 @@
 #include "transport.h"
 #include "packfile.h"
 #include "promisor-remote.h"
+#include "oid-array.h"
+#include "oidset.h"
+#include "pack-bitmap.h"
+#include "progress.h"
+#include "revision.h"
+#include "shallow.h"
+#include "tree-walk.h"
+#include "environment.h"
+#include "trace2.h"
+
+struct connectivity_walk {
+	struct repository *repo;
+	struct check_connected_options *opt;
+	/* everything reachable from our refs */
+	struct bitmap_index *haves;
+	struct oidset seen;
+	struct connectivity_item {
+		struct object_id oid;
+		/* OBJ_NONE if the caller did not say */
+		enum object_type type;
+	} *queue;
+	size_t nr, alloc;
+	struct progress *progress;
+	uint64_t nr_checked;
+};
+
+__attribute__((format (printf, 2, 3)))
+static int connectivity_error(struct check_connected_options *opt,
+			      const char *fmt, ...)
+{
+	struct strbuf sb = STRBUF_INIT;
+	va_list ap;
+
+	if (opt->quiet && !opt->err_fd)
+		return -1;
+
+	strbuf_addstr(&sb, _("error: "));
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+	strbuf_addch(&sb, '\n');
+
+	if (opt->err_fd)
+		write_in_full(opt->err_fd, sb.buf, sb.len);
+	else
+		fputs(sb.buf, stderr);
+	strbuf_release(&sb);
+	return -1;
+}
+
+static void queue_object(struct connectivity_walk *walk,
+			 const struct object_id *oid, enum object_type type)
+{
+	if (bitmap_has_oid_in_uninteresting(walk->haves, oid))
+		return;
+	if (oidset_insert(&walk->seen, oid))
+		return;
+
+	ALLOC_GROW(walk->queue, walk->nr + 1, walk->alloc);
+	oidcpy(&walk->queue[walk->nr].oid, oid);
+	walk->queue[walk->nr].type = type;
+	walk->nr++;
+}
+
+static int queue_commit_links(struct connectivity_walk *walk,
+			      const char *buf)
+{
+	struct object_id oid;
+
+	if (!skip_prefix(buf, "tree ", &buf) ||
+	    parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n')
+		return -1;
+	queue_object(walk, &oid, OBJ_TREE);
+
+	while (skip_prefix(buf, "parent ", &buf)) {
+		if (parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n')
+			return -1;
+		queue_object(walk, &oid, OBJ_COMMIT);
+	}
+	return 0;
+}
+
+static int queue_tag_link(struct connectivity_walk *walk, const char *buf)
+{
+	struct object_id oid;
+	const char *type_end;
+	int type;
+
+	if (!skip_prefix(buf, "object ", &buf) ||
+	    parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n' ||
+	    !skip_prefix(buf, "type ", &buf))
+		return -1;
+
+	type_end = strchrnul(buf, '\n');
+	type = type_from_string_gently(buf, type_end - buf, 1);
+	if (type < 0)
+		return -1;
+	queue_object(walk, &oid, type);
+	return 0;
+}
+
+static int queue_tree_links(struct connectivity_walk *walk,
+			    const struct object_id *tree_oid,
+			    const void *buf, unsigned long size)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+
+	if (init_tree_desc_gently(&desc, tree_oid, buf, size, 0))
+		return -1;
+
+	while (tree_entry_gently(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		queue_object(walk, &entry.oid,
+			     S_ISDIR(entry.mode) ? OBJ_TREE : OBJ_BLOB);
+	}
+	return desc.size ? -1 : 0;
+}
+
+static int check_one_object(struct connectivity_walk *walk,
+			    const struct connectivity_item *item)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buf = NULL;
+	int ret = 0;
+
+	/* For blobs, existence is all we care about. */
+	if (item->type == OBJ_BLOB)
+		type = oid_object_info(walk->repo, &item->oid, NULL);
+	else if (!(buf = repo_read_object_file(walk->repo, &item->oid,
+					       &type, &size)))
+		type = OBJ_BAD;
+
+	if (type < 0) {
+		if (item->type == OBJ_NONE)
+			return connectivity_error(walk->opt, _("missing object %s"),
+						  oid_to_hex(&item->oid));
+		return connectivity_error(walk->opt, _("missing %s object %s"),
+					  type_name(item->type),
+					  oid_to_hex(&item->oid));
+	}
+	if (item->type != OBJ_NONE && type != item->type) {
+		ret = connectivity_error(walk->opt, _("object %s is a %s, not a %s"),
+					 oid_to_hex(&item->oid), type_name(type),
+					 type_name(item->type));
+		goto out;
+	}
+
+	switch (type) {
+	case OBJ_COMMIT:
+		ret = queue_commit_links(walk, buf);
+		break;
+	case OBJ_TREE:
+		ret = queue_tree_links(walk, &item->oid, buf, size);
+		break;
+	case OBJ_TAG:
+		ret = queue_tag_link(walk, buf);
+		break;
+	default:
+		break;
+	}
+	if (ret)
+		connectivity_error(walk->opt, _("unable to parse %s object %s"),
+				   type_name(type), oid_to_hex(&item->oid));
+
+out:
+	free(buf);
+	return ret;
+}
+
+static struct bitmap_index *bitmap_of_existing_refs(struct check_connected_options *opt)
+{
+	struct rev_info revs;
+	struct strvec args = STRVEC_INIT;
+	struct bitmap_index *bitmap_git;
+
+	strvec_pushl(&args, "rev-list", "--objects", "--ignore-missing",
+		     "--not", NULL);
+	if (opt->exclude_hidden_refs_section)
+		strvec_pushf(&args, "--exclude-hidden=%s",
+			     opt->exclude_hidden_refs_section);
+	strvec_pushl(&args, "--all", "--alternate-refs", NULL);
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	setup_revisions(args.nr, args.v, &revs, NULL);
+	bitmap_git = prepare_bitmap_haves(&revs);
+
+	/*
+	 * Unlike the rev-list we replace, we share the object pool with
+	 * our caller. Do not leave our marks on the tips behind, as
+	 * fetch-pack uses the same bit to find alternate refs it has not
+	 * seen yet.
+	 */
+	clear_object_flags(UNINTERESTING | BOTTOM);
+
+	release_revisions(&revs);
+	strvec_clear(&args);
+	return bitmap_git;
+}
+
+/*
+ * Do what "rev-list --objects --stdin --not --all" would do, without
+ * spawning it: walk from the given objects until we reach objects that
+ * the reachability bitmap says are reachable from our refs.
+ *
+ * Returns 0 if everything is connected, 1 if not, and -1 if there is no
+ * bitmap to stop the walk early, in which case the caller should run
+ * rev-list instead.
+ */
+static int check_connected_in_process(const struct oid_array *oids,
+				      struct check_connected_options *opt)
+{
+	struct connectivity_walk walk = {
+		.repo = the_repository,
+		.opt = opt,
+		.seen = OIDSET_INIT,
+	};
+	int ret = 0;
+
+	if (opt->shallow_file || opt->is_deepening_fetch ||
+	    getenv(GIT_SHALLOW_FILE_ENVIRONMENT) ||
+	    repo_has_promisor_remote(the_repository) ||
+	    is_repository_shallow(the_repository))
+		return -1;
+
+	trace2_region_enter("connectivity", "bitmap-haves", the_repository);
+	walk.haves = bitmap_of_existing_refs(opt);
+	trace2_region_leave("connectivity", "bitmap-haves", the_repository);
+	if (!walk.haves)
+		return -1;
+
+	/*
+	 * Progress goes to stderr, which is not where the caller wants
+	 * our messages to go when it gave us err_fd.
+	 */
+	if (opt->progress && !opt->err_fd)
+		walk.progress = start_delayed_progress(_("Checking connectivity"), 0);
+
+	trace2_region_enter("connectivity", "walk", the_repository);
+	for (size_t i = 0; i < oids->nr; i++)
+		queue_object(&walk, &oids->oid[i], OBJ_NONE);
+
+	while (walk.nr) {
+		struct connectivity_item item = walk.queue[--walk.nr];
+
+		if (check_one_object(&walk, &item)) {
+			ret = 1;
+			break;
+		}
+		display_progress(walk.progress, ++walk.nr_checked);
+	}
+	trace2_data_intmax("connectivity", the_repository, "checked",
+			   walk.nr_checked);
+	trace2_region_leave("connectivity", "walk", the_repository);
+
+	stop_progress(&walk.progress);
+	free_bitmap_index(walk.haves);
+	oidset_clear(&walk.seen);
+	free(walk.queue);
+	return ret;
+}
+
+struct oid_array_iter {
+	const struct oid_array *oids;
+	size_t pos;
+};
+
+static const struct object_id *iterate_oid_array(void *cb_data)
+{
+	struct oid_array_iter *iter = cb_data;
+
+	if (iter->pos >= iter->oids->nr)
+		return NULL;
+	return &iter->oids->oid[iter->pos++];
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -20,6 +297,9 @@
  * these commits locally exists and is connected to our existing refs.
  * Note that this does _not_ validate the individual objects.
  *
+ * When the caller allows it, the same walk is done in-process if a
+ * reachability bitmap can tell us what our refs already reach.
+ *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
 int check_connected(oid_iterate_fn fn, void *cb_data,
@@ -33,6 +313,8 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	struct packed_git *new_pack = NULL;
 	struct transport *transport;
 	size_t base_len;
+	struct oid_array oids = OID_ARRAY_INIT;
+	struct oid_array_iter oids_iter = { .oids = &oids };
 
 	if (!opt)
 		opt = &defaults;
@@ -94,6 +376,29 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	}
 
 no_promisor_pack_found:
+	if (opt->in_process) {
+		do {
+			if (new_pack && find_pack_entry_one(oid->hash, new_pack))
+				continue;
+			oid_array_append(&oids, oid);
+		} while ((oid = fn(cb_data)) != NULL);
+
+		err = oids.nr ? check_connected_in_process(&oids, opt) : 0;
+		if (err >= 0) {
+			if (opt->err_fd)
+				close(opt->err_fd);
+			oid_array_clear(&oids);
+			free(new_pack);
+			return err;
+		}
+
+		/* Feed what we have collected to rev-list instead. */
+		err = 0;
+		fn = iterate_oid_array;
+		cb_data = &oids_iter;
+		oid = fn(cb_data);
+	}
+
 	if (opt->shallow_file) {
 		strvec_push(&rev_list.args, "--shallow-file");
 		strvec_push(&rev_list.args, opt->shallow_file);
@@ -127,6 +432,7 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		rev_list.no_stderr = opt->quiet;
 
 	if (start_command(&rev_list)) {
+		oid_array_clear(&oids);
 		free(new_pack);
 		return error(_("Could not run 'git rev-list'"));
 	}
@@ -161,6 +467,7 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		err = error_errno(_("failed to close rev-list's stdin"));
 
 	sigchain_pop(SIGPIPE);
+	oid_array_clear(&oids);
 	free(new_pack);
 	return finish_command(&rev_list) || err;
 }
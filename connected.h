@@ -53,6 +53,15 @@ struct check_connected_options {
 	 * already-reachable refs.
 	 */
 	const char *exclude_hidden_refs_section;
+
+	/*
+	 * If non-zero, the objects to check are already visible to this
+	 * process (e.g. through tmp_objdir_add_as_alternate()), so the
+	 * check may be done in-process using a reachability bitmap instead
+	 * of spawning rev-list. `env` is then not used, and no progress is
+	 * shown if `err_fd` is set.
+	 */
+	unsigned in_process : 1;
 };
 
 #define CHECK_CONNECTED_INIT { 0 }
@@ -12,6 +12,22 @@
 #include "strbuf.h"
 #include "string-list.h"
 
+#if defined(NO_UNIX_SOCKETS) || defined(NO_POSIX_GOODIES)
+#define NO_WORKER_POOL
+#else
+#include "commit.h"
+#include "commit-graph.h"
+#include "hash.h"
+#include "hex.h"
+#include "packfile.h"
+#include "refs.h"
+#include "replace-object.h"
+#include "repository.h"
+#include "serve.h"
+#include "statinfo.h"
+#include "unix-socket.h"
+#endif
+
 #ifdef NO_INITGROUPS
 #define initgroups(x, y) (0) /* nothing */
 #endif
@@ -35,6 +51,7 @@ static const char daemon_usage[] =
 "           [--reuseaddr] [--pid-file=<file>]\n"
 "           [--(enable|disable|allow-override|forbid-override)=<service>]\n"
 "           [--access-hook=<path>]\n"
+"           [--worker-pool=<directory> [--worker-idle-timeout=<n>]]\n"
 "           [--inetd | [--listen=<host_or_ipaddr>] [--port=<n>]\n"
 "                      [--detach] [--user=<user> [--group=<group>]]\n"
 "           [--log-destination=(stderr|syslog|none)]\n"
@@ -62,6 +79,11 @@ static const char *user_path;
 static unsigned int timeout;
 static unsigned int init_timeout;
 
+/* Where workers for protocol v2 upload-pack listen, if enabled */
+static const char *worker_pool;
+static unsigned int worker_idle_timeout = 600;
+static const char *daemon_program;
+
 struct hostinfo {
 	struct strbuf hostname;
 	struct strbuf canon_hostname;
@@ -462,9 +484,416 @@ static int run_service_command(struct child_process *cld)
 	return finish_command(cld);
 }
 
+#ifndef NO_WORKER_POOL
+/*
+ * A worker keeps one repository open across connections. It is started
+ * on demand by the first protocol v2 upload-pack request for that
+ * repository, listens on a Unix socket in the --worker-pool directory,
+ * and receives later connections to the same repository from the
+ * serving processes of the main daemon. Each connection is served by a
+ * child forked off the worker, which inherits the object store with its
+ * pack indexes and commit-graph already loaded.
+ *
+ * Refs are not cached: every child reads them afresh. Changes that
+ * would leave the inherited state stale, like a new pack or a
+ * rewritten config, make the worker retire, and the next request
+ * starts a new one.
+ */
+static const char *worker_watched_paths[] = {
+	"config",
+	"shallow",
+	"objects/pack",
+	"objects/info/alternates",
+	"objects/info/commit-graph",
+	"objects/info/commit-graphs",
+};
+
+struct worker_state {
+	struct stat_data sd[ARRAY_SIZE(worker_watched_paths)];
+};
+
+static void worker_socket_path(struct strbuf *out, const char *gitdir)
+{
+	const struct git_hash_algo *algo = &hash_algos[GIT_HASH_SHA1];
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+
+	algo->init_fn(&ctx);
+	algo->update_fn(&ctx, gitdir, strlen(gitdir));
+	algo->final_fn(hash, &ctx);
+	strbuf_addf(out, "%s/%s", worker_pool, hash_to_hex_algop(hash, algo));
+}
+
+static void watch_path(struct stat_data *sd, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		memset(sd, 0, sizeof(*sd));
+	else
+		fill_stat_data(sd, &st);
+}
+
+static void worker_state_record(struct worker_state *state)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(worker_watched_paths); i++)
+		watch_path(&state->sd[i], worker_watched_paths[i]);
+}
+
+static int worker_state_changed(const struct worker_state *state)
+{
+	struct worker_state now;
+
+	worker_state_record(&now);
+	return !!memcmp(&now, state, sizeof(now));
+}
+
+static void warm_up_repository(struct repository *r)
+{
+	struct packed_git *p;
+
+	prepare_repo_settings(r);
+	for (p = get_all_packs(r); p; p = p->next)
+		open_pack_index(p);
+	/* loads the commit-graph */
+	generation_numbers_enabled(r);
+	get_main_ref_store(r);
+}
+
+/*
+ * Like determine_protocol_version_server(), but for the environment of
+ * the service instead of ours. Version 2 being the latest, a client
+ * that offers it gets it.
+ */
+static int requests_protocol_v2(const struct strvec *env)
+{
+	struct string_list list = STRING_LIST_INIT_DUP;
+	const char *value;
+	int ret;
+
+	for (size_t i = 0; i < env->nr; i++) {
+		if (skip_prefix(env->v[i], GIT_PROTOCOL_ENVIRONMENT "=", &value))
+			string_list_split(&list, value, ':', -1);
+	}
+	ret = unsorted_string_list_has_string(&list, "version=2");
+	string_list_clear(&list, 0);
+	return ret;
+}
+
+/*
+ * Only these variables are passed on to the children of a worker;
+ * anything else sent over the worker socket is ignored.
+ */
+static const char *handed_over_env[] = {
+	GIT_PROTOCOL_ENVIRONMENT,
+	"REMOTE_ADDR",
+	"REMOTE_PORT",
+};
+
+static int is_handed_over_env(const char *var)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(handed_over_env); i++) {
+		const char *p;
+
+		if (skip_prefix(var, handed_over_env[i], &p) && *p == '=')
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The pool holds the sockets of the workers, which trust what they are
+ * sent, so it must belong to the user the daemon runs as, and to nobody
+ * else. This is checked after dropping privileges.
+ */
+static void setup_worker_pool(void)
+{
+	struct stat st;
+
+	if (mkdir(worker_pool, 0700) && errno != EEXIST)
+		die_errno("unable to create worker pool '%s'", worker_pool);
+	if (lstat(worker_pool, &st))
+		die_errno("unable to stat worker pool '%s'", worker_pool);
+	if (!S_ISDIR(st.st_mode))
+		die("worker pool '%s' is not a directory", worker_pool);
+	if (st.st_uid != geteuid() || (st.st_mode & 07777) != 0700)
+		die("worker pool '%s' must be owned by the daemon user "
+		    "and have mode 0700", worker_pool);
+}
+
+static void spawn_worker(const char *gitdir)
+{
+	struct child_process cld = CHILD_PROCESS_INIT;
+
+	strvec_push(&cld.args, daemon_program);
+	strvec_pushf(&cld.args, "--worker=%s", gitdir);
+	strvec_pushf(&cld.args, "--worker-parent=%"PRIuMAX,
+		     (uintmax_t)getppid());
+	strvec_pushf(&cld.args, "--worker-pool=%s", worker_pool);
+	strvec_pushf(&cld.args, "--worker-idle-timeout=%u",
+		     worker_idle_timeout);
+	switch (log_destination) {
+	case LOG_DESTINATION_SYSLOG:
+		strvec_push(&cld.args, "--log-destination=syslog");
+		break;
+	case LOG_DESTINATION_NONE:
+		strvec_push(&cld.args, "--log-destination=none");
+		break;
+	default:
+		strvec_push(&cld.args, "--log-destination=stderr");
+		break;
+	}
+	if (verbose)
+		strvec_push(&cld.args, "--verbose");
+	/* our stdin and stdout are the client connection */
+	cld.no_stdin = 1;
+	cld.no_stdout = 1;
+
+	/* the worker outlives us, do not wait for it */
+	if (start_command(&cld))
+		logerror("unable to start worker for '%s'", gitdir);
+	child_process_clear(&cld);
+}
+
+/*
+ * Pass the client connection to the worker of the current repository,
+ * starting one if there is none. Return 0 if the worker took the
+ * connection, and -1 if the request has to be served by this process.
+ */
+static int hand_over_to_worker(const struct strvec *env)
+{
+	struct strbuf gitdir = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	const char *passthru[] = { "REMOTE_ADDR", "REMOTE_PORT" };
+	int fd = -1, ret = -1;
+	char ack;
+
+	if (!requests_protocol_v2(env) || strbuf_getcwd(&gitdir))
+		goto out;
+	worker_socket_path(&path, gitdir.buf);
+
+	fd = unix_stream_connect(path.buf, 0);
+	if (fd < 0) {
+		if (errno == ENOENT || errno == ECONNREFUSED)
+			spawn_worker(gitdir.buf);
+		else
+			logerror("unable to connect to worker '%s': %s",
+				 path.buf, strerror(errno));
+		goto out;
+	}
+
+	if (unix_stream_send_fd(fd, 0) < 0) {
+		logerror("unable to pass connection to worker: %s",
+			 strerror(errno));
+		goto out;
+	}
+	for (size_t i = 0; i < env->nr; i++)
+		packet_write_fmt(fd, "%s", env->v[i]);
+	for (size_t i = 0; i < ARRAY_SIZE(passthru); i++) {
+		const char *value = getenv(passthru[i]);
+		if (value)
+			packet_write_fmt(fd, "%s=%s", passthru[i], value);
+	}
+	packet_flush(fd);
+
+	if (read_in_full(fd, &ack, 1) == 1 && ack == 'y') {
+		loginfo("Passed connection to worker for '%s'", gitdir.buf);
+		close(0);
+		close(1);
+		/*
+		 * The worker's child holds on to its end of our socket
+		 * until it is done. Wait for that, so that the connection
+		 * keeps counting against --max-connections.
+		 */
+		while (xread(fd, &ack, 1) > 0)
+			; /* nothing more is sent */
+		ret = 0;
+	} else {
+		/* the worker retired, start over with a fresh one */
+		spawn_worker(gitdir.buf);
+	}
+
+out:
+	if (fd >= 0)
+		close(fd);
+	strbuf_release(&path);
+	strbuf_release(&gitdir);
+	return ret;
+}
+
+static void NORETURN serve_handed_over(int listen_fd, int client, int conn,
+				       const struct strvec *env)
+{
+	int flags;
+
+	signal(SIGPIPE, SIG_DFL);
+	close(listen_fd);
+	/* keep 'client' open, the serving process waits for us on it */
+	flags = fcntl(client, F_GETFD, 0);
+	if (flags >= 0)
+		fcntl(client, F_SETFD, flags | FD_CLOEXEC);
+	if (dup2(conn, 0) < 0 || dup2(conn, 1) < 0)
+		die_errno("unable to set up connection");
+	if (conn > 1)
+		close(conn);
+
+	for (size_t i = 0; i < env->nr; i++) {
+		const char *eq = strchr(env->v[i], '=');
+		char *name = xmemdupz(env->v[i], eq - env->v[i]);
+
+		xsetenv(name, eq + 1, 1);
+		free(name);
+	}
+
+	protocol_v2_serve_loop(0);
+	exit(0);
+}
+
+/*
+ * Receive a connection from a serving process and fork a child to serve
+ * it. Return 1 if the worker should retire.
+ */
+static int worker_accept(int listen_fd, const char *path,
+			 const struct worker_state *state)
+{
+	struct strvec env = STRVEC_INIT;
+	char buf[LARGE_PACKET_MAX];
+	int client, conn, len, retire = 0;
+	pid_t pid = -1;
+
+	client = accept(listen_fd, NULL, NULL);
+	if (client < 0)
+		return 0;
+	conn = unix_stream_recv_fd(client);
+	if (conn < 0) {
+		close(client);
+		return 0;
+	}
+	while ((len = packet_read(client, buf, sizeof(buf),
+				  PACKET_READ_GENTLE_ON_EOF |
+				  PACKET_READ_GENTLE_ON_READ_ERROR)) > 0)
+		if (is_handed_over_env(buf))
+			strvec_push(&env, buf);
+
+	if (len < 0) {
+		; /* the serving process went away */
+	} else if (worker_state_changed(state)) {
+		/*
+		 * Give up the socket before answering, so that the
+		 * replacement started by the serving process can bind it.
+		 */
+		loginfo("Repository changed, retiring worker");
+		unlink(path);
+		retire = 1;
+	} else {
+		pid = fork();
+		if (!pid)
+			serve_handed_over(listen_fd, client, conn, &env);
+		if (pid < 0)
+			logerror("unable to fork");
+	}
+
+	close(conn);
+	write_in_full(client, pid < 0 ? "n" : "y", 1);
+	close(client);
+	strvec_clear(&env);
+	return retire;
+}
+
+/* Return 1 if 'path' is still the socket bound to 'ino'. */
+static int worker_socket_is_ours(const char *path, ino_t ino)
+{
+	struct stat st;
+
+	return !stat(path, &st) && st.st_ino == ino;
+}
+
+static int serve_worker(const char *dir, pid_t parent)
+{
+	struct unix_stream_listen_opts opts = UNIX_STREAM_LISTEN_OPTS_INIT;
+	struct worker_state state;
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	time_t idle_since;
+	int fd;
+
+	/* inherited from the serving process that started us */
+	signal(SIGTERM, SIG_DFL);
+	/* serving processes may hang up on us at any time */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!enter_repo(dir, 1))
+		die("'%s' does not appear to be a git repository", dir);
+	worker_socket_path(&path, dir);
+
+	/* Leave if another worker got there first */
+	fd = unix_stream_connect(path.buf, 0);
+	if (fd >= 0) {
+		close(fd);
+		strbuf_release(&path);
+		return 0;
+	}
+
+	/* what cmd_upload_pack() sets up before serving */
+	packet_trace_identity("upload-pack");
+	disable_replace_refs();
+	save_commit_buffer = 0;
+	xsetenv(NO_LAZY_FETCH_ENVIRONMENT, "1", 0);
+
+	/* record before warming up, so that racing changes are seen */
+	worker_state_record(&state);
+	warm_up_repository(the_repository);
+
+	fd = unix_stream_listen(path.buf, &opts);
+	if (fd < 0 || stat(path.buf, &st))
+		die_errno("unable to listen on '%s'", path.buf);
+	loginfo("Worker ready for '%s'", dir);
+
+	idle_since = time(NULL);
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			; /* reap finished children */
+
+		if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN)) {
+			if (worker_accept(fd, path.buf, &state))
+				goto out;
+			idle_since = time(NULL);
+			continue;
+		}
+
+		/*
+		 * Another worker may have taken over the socket path, and
+		 * there is no point in outliving the daemon.
+		 */
+		if (!worker_socket_is_ours(path.buf, st.st_ino))
+			goto out;
+		if (parent && kill(parent, 0) && errno == ESRCH)
+			break;
+		if (worker_idle_timeout &&
+		    time(NULL) - idle_since >= worker_idle_timeout)
+			break;
+	}
+	if (worker_socket_is_ours(path.buf, st.st_ino))
+		unlink(path.buf);
+out:
+	loginfo("Worker for '%s' exiting", dir);
+	close(fd);
+	strbuf_release(&path);
+	return 0;
+}
+#endif
+
 static int upload_pack(const struct strvec *env)
 {
 	struct child_process cld = CHILD_PROCESS_INIT;
+
+#ifndef NO_WORKER_POOL
+	if (worker_pool && !hand_over_to_worker(env))
+		return 0;
+#endif
+
 	strvec_pushl(&cld.args, "upload-pack", "--strict", NULL);
 	strvec_pushf(&cld.args, "--timeout=%u", timeout);
 
@@ -1236,6 +1665,10 @@ static int serve(struct string_list *listen_addr, int listen_port,
 		    listen_port);
 
 	drop_privileges(cred);
+#ifndef NO_WORKER_POOL
+	if (worker_pool)
+		setup_worker_pool();
+#endif
 
 	loginfo("Ready to rumble");
 
@@ -1247,6 +1680,8 @@ int cmd_main(int argc, const char **argv)
 	int listen_port = 0;
 	struct string_list listen_addr = STRING_LIST_INIT_DUP;
 	int serve_mode = 0, inetd_mode = 0;
+	const char *worker_dir = NULL;
+	pid_t worker_parent = 0;
 	const char *pid_file = NULL, *user_name = NULL, *group_name = NULL;
 	int detach = 0;
 	struct credentials *cred = NULL;
@@ -1315,6 +1750,23 @@ int cmd_main(int argc, const char **argv)
 			init_timeout = atoi(v);
 			continue;
 		}
+		if (skip_prefix(arg, "--worker-pool=", &v)) {
+			worker_pool = v;
+			continue;
+		}
+		if (skip_prefix(arg, "--worker-idle-timeout=", &v)) {
+			worker_idle_timeout = atoi(v);
+			continue;
+		}
+		/* internal: run as the worker for a repository */
+		if (skip_prefix(arg, "--worker=", &v)) {
+			worker_dir = v;
+			continue;
+		}
+		if (skip_prefix(arg, "--worker-parent=", &v)) {
+			worker_parent = (pid_t)strtoumax(v, NULL, 10);
+			continue;
+		}
 		if (skip_prefix(arg, "--max-connections=", &v)) {
 			max_connections = atoi(v);
 			if (max_connections < 0)
@@ -1435,12 +1887,42 @@ int cmd_main(int argc, const char **argv)
 		die("base-path '%s' does not exist or is not a directory",
 		    base_path);
 
+	if (worker_pool) {
+#ifdef NO_WORKER_POOL
+		die("--worker-pool not supported on this platform");
+#else
+		struct strbuf abs = STRBUF_INIT;
+
+		/*
+		 * Workers and serving processes chdir into repositories.
+		 * The directory itself is only created or checked once
+		 * privileges are dropped, see setup_worker_pool().
+		 */
+		strbuf_add_absolute_path(&abs, worker_pool);
+		worker_pool = strbuf_detach(&abs, NULL);
+		daemon_program = argv[0];
+#endif
+	}
+
 	if (log_destination != LOG_DESTINATION_STDERR) {
 		if (!freopen("/dev/null", "w", stderr))
 			die_errno("failed to redirect stderr to /dev/null");
 	}
 
+#ifndef NO_WORKER_POOL
+	if (worker_dir) {
+		if (!worker_pool)
+			die("--worker requires --worker-pool");
+		setup_worker_pool();
+		return serve_worker(worker_dir, worker_parent);
+	}
+#endif
+
 	if (inetd_mode || serve_mode) {
+#ifndef NO_WORKER_POOL
+		if (worker_pool)
+			setup_worker_pool();
+#endif
 		ret = execute();
 	} else {
 		if (detach) {
@@ -1,5 +1,6 @@
 #include "git-compat-util.h"
 #include "fetch-negotiator.h"
+#include "negotiator/bitmap.h"
 #include "negotiator/default.h"
 #include "negotiator/skipping.h"
 #include "negotiator/noop.h"
@@ -14,6 +15,10 @@ void fetch_negotiator_init(struct repository *r,
 		skipping_negotiator_init(negotiator);
 		return;
 
+	case FETCH_NEGOTIATION_BITMAP:
+		bitmap_negotiator_init(r, negotiator);
+		return;
+
 	case FETCH_NEGOTIATION_NOOP:
 		noop_negotiator_init(negotiator);
 		return;
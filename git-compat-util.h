@@ -418,6 +418,10 @@ char *gitdirname(char *);
 # include <sys/sysinfo.h>
 #endif
 
+#ifdef HAVE_SENDFILE
+# include <sys/sendfile.h>
+#endif
+
 /* On most systems <netdb.h> would have given us this, but
  * not on some systems (e.g. z/OS).
  */
@@ -651,6 +655,13 @@ static inline int git_has_dir_sep(const char *path)
 
 #define MAYBE_UNUSED __attribute__((__unused__))
 
+/* Hint that the memory at "addr" is going to be read soon. */
+#if defined(__GNUC__) /* clang sets this, too */
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void)(addr))
+#endif
+
 #include "compat/bswap.h"
 
 #include "wrapper.h"
@@ -20,6 +20,7 @@
 #include "object-store-ll.h"
 #include "protocol.h"
 #include "date.h"
+#include "trace2.h"
 #include "write-or-die.h"
 
 static const char content_type[] = "Content-Type";
@@ -179,13 +180,115 @@ static void send_strbuf(struct strbuf *hdr,
 	write_or_die(1, buf->buf, buf->len);
 }
 
+/*
+ * Parse the "Range" request header for a file of 'size' bytes. Only a
+ * single range is supported; anything else, including syntax we do not
+ * understand, asks for the whole file, which is what we return 0 for.
+ * Return 1 with the inclusive bounds of the range in 'start' and 'end',
+ * or -1 if the range cannot be satisfied.
+ */
+static int parse_range(const char *value, off_t size, off_t *start, off_t *end)
+{
+	uintmax_t first, last;
+	const char *p;
+	char *ep;
+
+	if (!value || !skip_prefix(value, "bytes=", &p) || strchr(p, ','))
+		return 0;
+
+	if (*p == '-') {
+		/* the last N bytes */
+		if (!isdigit(p[1]))
+			return 0;
+		last = strtoumax(p + 1, &ep, 10);
+		if (*ep)
+			return 0;
+		if (!last || !size)
+			return -1;
+		*start = last < (uintmax_t)size ? size - last : 0;
+		*end = size - 1;
+		return 1;
+	}
+
+	if (!isdigit(*p))
+		return 0;
+	first = strtoumax(p, &ep, 10);
+	if (*ep != '-')
+		return 0;
+	p = ep + 1;
+	if (!*p) {
+		last = UINTMAX_MAX;
+	} else {
+		if (!isdigit(*p))
+			return 0;
+		last = strtoumax(p, &ep, 10);
+		if (*ep || last < first)
+			return 0;
+	}
+	if (first >= (uintmax_t)size)
+		return -1;
+	*start = first;
+	*end = last < (uintmax_t)size ? last : size - 1;
+	return 1;
+}
+
+/*
+ * Copy 'len' bytes at 'offset' of 'fd' to the client, using sendfile()
+ * if we can, so that the data does not pass through userspace.
+ */
+static void send_file_data(int fd, const char *p, off_t offset, off_t len)
+{
+	const char *method = "read";
+	char *buf;
+
+#ifdef HAVE_SENDFILE
+	method = "sendfile";
+	while (len > 0) {
+		size_t chunk = len < MAX_IO_SIZE ? len : MAX_IO_SIZE;
+		ssize_t n = sendfile(1, fd, &offset, chunk);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* stdout may not support it; copy the rest instead */
+			if (errno == EINVAL || errno == ENOSYS) {
+				method = "sendfile+read";
+				break;
+			}
+			die_errno("Cannot send '%s'", p);
+		}
+		if (!n)
+			die("'%s' is shorter than expected", p);
+		len -= n;
+	}
+#endif
+	trace2_data_string("http-backend", the_repository, "send/method", method);
+	if (!len)
+		return;
+
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		die_errno("Cannot seek in '%s'", p);
+	buf = xmalloc(8192);
+	while (len > 0) {
+		ssize_t n = xread(fd, buf, len < 8192 ? len : 8192);
+		if (n < 0)
+			die_errno("Cannot read '%s'", p);
+		if (!n)
+			die("'%s' is shorter than expected", p);
+		write_or_die(1, buf, n);
+		len -= n;
+	}
+	free(buf);
+}
+
 static void send_local_file(struct strbuf *hdr, const char *the_type,
 				const char *name)
 {
 	char *p = git_pathdup("%s", name);
-	size_t buf_alloc = 8192;
-	char *buf = xmalloc(buf_alloc);
-	int fd;
+	const char *if_range = getenv("HTTP_IF_RANGE");
+	char *mtime;
+	off_t start = 0, end;
+	int fd, range;
 	struct stat sb;
 
 	fd = open(p, O_RDONLY);
@@ -193,22 +296,54 @@ static void send_local_file(struct strbuf *hdr, const char *the_type,
 		not_found(hdr, "Cannot open '%s': %s", p, strerror(errno));
 	if (fstat(fd, &sb) < 0)
 		die_errno("Cannot stat '%s'", p);
-
-	hdr_int(hdr, content_length, sb.st_size);
+	end = sb.st_size - 1;
+
+	/*
+	 * A client resuming an interrupted download names the version it
+	 * has part of with If-Range; if that is not what we have, it
+	 * needs all of it.
+	 */
+	mtime = xstrdup(show_date(sb.st_mtime, 0, DATE_MODE(RFC2822)));
+	if (if_range && strcmp(if_range, mtime))
+		range = 0;
+	else
+		range = parse_range(getenv("HTTP_RANGE"), sb.st_size,
+				    &start, &end);
+
+	if (range < 0) {
+		http_status(hdr, 416, "Range Not Satisfiable");
+		strbuf_addf(hdr, "Content-Range: bytes */%"PRIuMAX"\r\n",
+			    (uintmax_t)sb.st_size);
+		hdr_int(hdr, content_length, 0);
+		end_headers(hdr);
+		close(fd);
+		free(mtime);
+		free(p);
+		return;
+	}
+	if (range) {
+		http_status(hdr, 206, "Partial Content");
+		strbuf_addf(hdr, "Content-Range: bytes %"PRIuMAX"-%"PRIuMAX"/%"PRIuMAX"\r\n",
+			    (uintmax_t)start, (uintmax_t)end,
+			    (uintmax_t)sb.st_size);
+	}
+	hdr_str(hdr, "Accept-Ranges", "bytes");
+	hdr_int(hdr, content_length, end - start + 1);
 	hdr_str(hdr, content_type, the_type);
-	hdr_date(hdr, last_modified, sb.st_mtime);
+	hdr_str(hdr, last_modified, mtime);
 	end_headers(hdr);
+	free(mtime);
+
+	trace2_region_enter("http-backend", "send", the_repository);
+	trace2_data_intmax("http-backend", the_repository, "send/bytes",
+			   end - start + 1);
+	if (range)
+		trace2_data_intmax("http-backend", the_repository,
+				   "send/offset", start);
+	send_file_data(fd, p, start, end - start + 1);
+	trace2_region_leave("http-backend", "send", the_repository);
 
-	for (;;) {
-		ssize_t n = xread(fd, buf, buf_alloc);
-		if (n < 0)
-			die_errno("Cannot read '%s'", p);
-		if (!n)
-			break;
-		write_or_die(1, buf, n);
-	}
 	close(fd);
-	free(buf);
 	free(p);
 }
 
@@ -0,0 +1,531 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "chunk-cache.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "environment.h"
+#include "gettext.h"
+#include "hash-lookup.h"
+#include "hashmap.h"
+#include "line-history.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "progress.h"
+#include "repository.h"
+#include "revision.h"
+#include "strvec.h"
+#include "trace2.h"
+
+#define LINE_HISTORY_SIGNATURE 0x4c484953 /* "LHIS" */
+#define LINE_HISTORY_VERSION 1
+
+#define LINE_HISTORY_CHUNKID_BLOBPAIRS 0x424c4f50 /* "BLOP" */
+#define LINE_HISTORY_CHUNKID_HUNKLISTS 0x484c5354 /* "HLST" */
+#define LINE_HISTORY_CHUNKID_HUNKS     0x48554e4b /* "HUNK" */
+
+#define LINE_HISTORY_LIST_WIDTH (4 * sizeof(uint32_t))
+#define LINE_HISTORY_HUNK_WIDTH (4 * sizeof(uint32_t))
+
+/*
+ * Each blob pair carries one hunk list per variant. The variant is
+ * selected by the xdiff flags of the caller.
+ */
+#define LINE_HISTORY_NR_VARIANTS 2
+
+static int xdl_opts_to_variant(int xdl_opts)
+{
+	switch (xdl_opts) {
+	case 0:
+		return 0; /* line-log */
+	case XDF_INDENT_HEURISTIC:
+		return 1; /* blame, with diff.indentHeuristic enabled */
+	default:
+		return -1;
+	}
+}
+
+static int variant_to_xdl_opts(int variant)
+{
+	return variant ? XDF_INDENT_HEURISTIC : 0;
+}
+
+enum {
+	LINE_HISTORY_BLOB_PAIRS,
+	LINE_HISTORY_HUNK_LISTS,
+	LINE_HISTORY_HUNKS,
+};
+
+static int write_line_history_blob_pairs(struct hashfile *f, void *data);
+static int write_line_history_hunk_lists(struct hashfile *f, void *data);
+static int write_line_history_hunks(struct hashfile *f, void *data);
+
+static const struct chunk_cache_format line_history_format = {
+	.filename = "line-history",
+	.desc = "line-history",
+	.signature = LINE_HISTORY_SIGNATURE,
+	.version = LINE_HISTORY_VERSION,
+	.chunks = {
+		[LINE_HISTORY_BLOB_PAIRS] = {
+			.id = LINE_HISTORY_CHUNKID_BLOBPAIRS,
+			.desc = "blob pair",
+			.oids = 2,
+			.per_key = 1,
+			.write = write_line_history_blob_pairs,
+		},
+		[LINE_HISTORY_HUNK_LISTS] = {
+			.id = LINE_HISTORY_CHUNKID_HUNKLISTS,
+			.desc = "hunk list",
+			.bytes = LINE_HISTORY_LIST_WIDTH,
+			.per_key = 1,
+			.write = write_line_history_hunk_lists,
+		},
+		[LINE_HISTORY_HUNKS] = {
+			.id = LINE_HISTORY_CHUNKID_HUNKS,
+			.desc = "hunk",
+			.bytes = LINE_HISTORY_HUNK_WIDTH,
+			.write = write_line_history_hunks,
+		},
+	},
+	.nr_chunks = 3,
+};
+
+static struct chunk_cache *prepare_line_history(struct repository *r)
+{
+	return prepare_chunk_cache(r, &line_history_format,
+				   &r->objects->line_history);
+}
+
+static int line_history_lookup(struct chunk_cache *lh,
+			       const struct object_id *old_oid,
+			       const struct object_id *new_oid,
+			       uint32_t *pos)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	unsigned char key[2 * GIT_MAX_RAWSZ];
+
+	memcpy(key, old_oid->hash, rawsz);
+	memcpy(key + rawsz, new_oid->hash, rawsz);
+	return chunk_cache_find(lh, key, 2 * rawsz, pos);
+}
+
+/*
+ * Return the range of hunk records for the given pair and variant, or -1
+ * if the offsets point outside of the hunk chunk.
+ */
+static int line_history_hunk_list(struct chunk_cache *lh, uint32_t pos,
+				  int variant, uint32_t *start, uint32_t *nr)
+{
+	const unsigned char *list =
+		chunk_cache_record(lh, LINE_HISTORY_HUNK_LISTS, pos) + 8 * variant;
+	uint32_t nr_hunks = lh->chunk_nr[LINE_HISTORY_HUNKS];
+
+	*start = get_be32(list);
+	*nr = get_be32(list + 4);
+	if (*start > nr_hunks || *nr > nr_hunks - *start)
+		return error(_("line-history hunk list out of bounds"));
+	return 0;
+}
+
+static void line_history_hunk(struct chunk_cache *lh, uint32_t i,
+			      long *start_a, long *count_a,
+			      long *start_b, long *count_b)
+{
+	const unsigned char *p = chunk_cache_record(lh, LINE_HISTORY_HUNKS, i);
+
+	*start_a = (int32_t)get_be32(p);
+	*count_a = (int32_t)get_be32(p + 4);
+	*start_b = (int32_t)get_be32(p + 8);
+	*count_b = (int32_t)get_be32(p + 12);
+}
+
+int line_history_replay(struct repository *r,
+			const struct object_id *old_oid,
+			const struct object_id *new_oid,
+			int xdl_opts,
+			xdl_emit_hunk_consume_func_t fn, void *data)
+{
+	struct chunk_cache *lh;
+	int variant = xdl_opts_to_variant(xdl_opts);
+	uint32_t pos, start, nr, i;
+
+	if (variant < 0)
+		return 0;
+	lh = prepare_line_history(r);
+	if (!lh || !line_history_lookup(lh, old_oid, new_oid, &pos))
+		return 0;
+	if (line_history_hunk_list(lh, pos, variant, &start, &nr))
+		return 0;
+
+	trace2_counter_add(TRACE2_COUNTER_ID_LINE_HISTORY_HITS, 1);
+	for (i = start; i < start + nr; i++) {
+		long start_a, count_a, start_b, count_b;
+
+		line_history_hunk(lh, i, &start_a, &count_a, &start_b, &count_b);
+		if (fn(start_a, count_a, start_b, count_b, data))
+			return -1;
+	}
+	return 1;
+}
+
+struct line_history_hunk {
+	int32_t v[4];
+};
+
+struct line_history_entry {
+	struct hashmap_entry ent;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	uint32_t start[LINE_HISTORY_NR_VARIANTS];
+	uint32_t nr[LINE_HISTORY_NR_VARIANTS];
+};
+
+struct write_line_history_context {
+	struct repository *r;
+	struct chunk_cache *existing;
+
+	struct hashmap pairs;
+	struct line_history_entry **sorted;
+	size_t sorted_nr;
+
+	struct line_history_hunk *hunks;
+	size_t hunks_nr, hunks_alloc;
+
+	struct progress *progress;
+	uint64_t reused, computed;
+};
+
+static int line_history_entry_cmp(const void *cmp_data UNUSED,
+				  const struct hashmap_entry *eptr,
+				  const struct hashmap_entry *entry_or_key,
+				  const void *keydata UNUSED)
+{
+	const struct line_history_entry *a, *b;
+
+	a = container_of(eptr, const struct line_history_entry, ent);
+	b = container_of(entry_or_key, const struct line_history_entry, ent);
+	return !oideq(&a->old_oid, &b->old_oid) ||
+	       !oideq(&a->new_oid, &b->new_oid);
+}
+
+static unsigned int line_history_entry_hash(const struct object_id *old_oid,
+					    const struct object_id *new_oid)
+{
+	return oidhash(old_oid) ^ memihash(new_oid->hash, the_hash_algo->rawsz);
+}
+
+static int collect_hunk(long start_a, long count_a,
+			long start_b, long count_b, void *data)
+{
+	struct write_line_history_context *ctx = data;
+	struct line_history_hunk *h;
+
+	if (start_a > INT32_MAX || count_a > INT32_MAX ||
+	    start_b > INT32_MAX || count_b > INT32_MAX)
+		return -1;
+
+	ALLOC_GROW(ctx->hunks, ctx->hunks_nr + 1, ctx->hunks_alloc);
+	h = &ctx->hunks[ctx->hunks_nr++];
+	h->v[0] = start_a;
+	h->v[1] = count_a;
+	h->v[2] = start_b;
+	h->v[3] = count_b;
+	return 0;
+}
+
+static int compute_hunks(struct write_line_history_context *ctx,
+			 mmfile_t *old_file, mmfile_t *new_file,
+			 struct line_history_entry *e, int variant)
+{
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+
+	xpp.flags = variant_to_xdl_opts(variant);
+	xecfg.hunk_func = collect_hunk;
+	ecb.priv = ctx;
+
+	e->start[variant] = ctx->hunks_nr;
+	if (xdi_diff(old_file, new_file, &xpp, &xecfg, &ecb))
+		return -1;
+	e->nr[variant] = ctx->hunks_nr - e->start[variant];
+	return 0;
+}
+
+static int reuse_hunks(struct write_line_history_context *ctx,
+		       struct line_history_entry *e)
+{
+	size_t mark = ctx->hunks_nr;
+	uint32_t pos;
+	int variant;
+
+	if (!ctx->existing ||
+	    !line_history_lookup(ctx->existing, &e->old_oid, &e->new_oid, &pos))
+		return 0;
+
+	for (variant = 0; variant < LINE_HISTORY_NR_VARIANTS; variant++) {
+		uint32_t start, nr, i;
+
+		if (line_history_hunk_list(ctx->existing, pos, variant,
+					   &start, &nr)) {
+			ctx->hunks_nr = mark;
+			return 0;
+		}
+
+		e->start[variant] = ctx->hunks_nr;
+		e->nr[variant] = nr;
+		for (i = start; i < start + nr; i++) {
+			long v[4];
+
+			line_history_hunk(ctx->existing, i, &v[0], &v[1],
+					  &v[2], &v[3]);
+			collect_hunk(v[0], v[1], v[2], v[3], ctx);
+		}
+	}
+	return 1;
+}
+
+static void *read_blob_for_diff(struct repository *r,
+				const struct object_id *oid,
+				mmfile_t *file)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if (oid_object_info(r, oid, &size) != OBJ_BLOB ||
+	    size > big_file_threshold)
+		return NULL;
+	buf = repo_read_object_file(r, oid, &type, &size);
+	if (!buf || type != OBJ_BLOB) {
+		free(buf);
+		return NULL;
+	}
+	file->ptr = buf;
+	file->size = size;
+	return buf;
+}
+
+/*
+ * If the indent heuristic does not move any hunk boundary, both variants
+ * can share the same list of hunks.
+ */
+static void share_identical_variants(struct write_line_history_context *ctx,
+				     struct line_history_entry *e)
+{
+	if (e->nr[0] != e->nr[1] ||
+	    memcmp(ctx->hunks + e->start[0], ctx->hunks + e->start[1],
+		   st_mult(sizeof(*ctx->hunks), e->nr[0])))
+		return;
+	ctx->hunks_nr = e->start[1];
+	e->start[1] = e->start[0];
+}
+
+static void add_blob_pair(struct write_line_history_context *ctx,
+			  const struct object_id *old_oid,
+			  const struct object_id *new_oid)
+{
+	struct line_history_entry *e;
+	mmfile_t old_file, new_file;
+	void *old_buf, *new_buf = NULL;
+	size_t mark = ctx->hunks_nr;
+	unsigned int hash = line_history_entry_hash(old_oid, new_oid);
+	struct line_history_entry key;
+
+	hashmap_entry_init(&key.ent, hash);
+	oidcpy(&key.old_oid, old_oid);
+	oidcpy(&key.new_oid, new_oid);
+	if (hashmap_get(&ctx->pairs, &key.ent, NULL))
+		return;
+
+	CALLOC_ARRAY(e, 1);
+	hashmap_entry_init(&e->ent, hash);
+	oidcpy(&e->old_oid, old_oid);
+	oidcpy(&e->new_oid, new_oid);
+
+	if (reuse_hunks(ctx, e)) {
+		share_identical_variants(ctx, e);
+		ctx->reused++;
+		goto add;
+	}
+
+	old_buf = read_blob_for_diff(ctx->r, old_oid, &old_file);
+	if (old_buf)
+		new_buf = read_blob_for_diff(ctx->r, new_oid, &new_file);
+	if (!old_buf || !new_buf ||
+	    compute_hunks(ctx, &old_file, &new_file, e, 0) ||
+	    compute_hunks(ctx, &old_file, &new_file, e, 1)) {
+		/*
+		 * Remember the pair anyway so that we do not retry it for
+		 * every commit that introduces it, but do not write it out.
+		 */
+		e->start[0] = UINT32_MAX;
+		ctx->hunks_nr = mark;
+	} else {
+		share_identical_variants(ctx, e);
+		ctx->computed++;
+	}
+	free(old_buf);
+	free(new_buf);
+
+add:
+	hashmap_add(&ctx->pairs, &e->ent);
+}
+
+static void add_commit_pairs(struct write_line_history_context *ctx,
+			     struct commit *c)
+{
+	struct diff_options opt;
+	int i;
+
+	repo_diff_setup(ctx->r, &opt);
+	opt.flags.recursive = 1;
+	opt.detect_rename = DIFF_DETECT_RENAME;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+
+	/*
+	 * Both log -L and blame follow renames, so record the pairs that
+	 * rename detection produces as well.
+	 */
+	diff_tree_oid(get_commit_tree_oid(c->parents->item),
+		      get_commit_tree_oid(c), "", &opt);
+	diffcore_std(&opt);
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (!DIFF_FILE_VALID(p->one) || !DIFF_FILE_VALID(p->two) ||
+		    !S_ISREG(p->one->mode) || !S_ISREG(p->two->mode) ||
+		    oideq(&p->one->oid, &p->two->oid))
+			continue;
+		add_blob_pair(ctx, &p->one->oid, &p->two->oid);
+	}
+
+	diff_flush(&opt);
+}
+
+static int line_history_entry_sort_cmp(const void *va, const void *vb)
+{
+	const struct line_history_entry *a = *(const struct line_history_entry **)va;
+	const struct line_history_entry *b = *(const struct line_history_entry **)vb;
+	int cmp = oidcmp(&a->old_oid, &b->old_oid);
+
+	return cmp ? cmp : oidcmp(&a->new_oid, &b->new_oid);
+}
+
+static int write_line_history_blob_pairs(struct hashfile *f, void *data)
+{
+	struct write_line_history_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->sorted_nr; i++) {
+		hashwrite(f, ctx->sorted[i]->old_oid.hash, the_hash_algo->rawsz);
+		hashwrite(f, ctx->sorted[i]->new_oid.hash, the_hash_algo->rawsz);
+	}
+	return 0;
+}
+
+static int write_line_history_hunk_lists(struct hashfile *f, void *data)
+{
+	struct write_line_history_context *ctx = data;
+	size_t i;
+	int variant;
+
+	for (i = 0; i < ctx->sorted_nr; i++) {
+		for (variant = 0; variant < LINE_HISTORY_NR_VARIANTS; variant++) {
+			hashwrite_be32(f, ctx->sorted[i]->start[variant]);
+			hashwrite_be32(f, ctx->sorted[i]->nr[variant]);
+		}
+	}
+	return 0;
+}
+
+static int write_line_history_hunks(struct hashfile *f, void *data)
+{
+	struct write_line_history_context *ctx = data;
+	size_t i;
+	int j;
+
+	for (i = 0; i < ctx->hunks_nr; i++)
+		for (j = 0; j < 4; j++)
+			hashwrite_be32(f, (uint32_t)ctx->hunks[i].v[j]);
+	return 0;
+}
+
+static int write_line_history_file(struct write_line_history_context *ctx)
+{
+	uint32_t counts[256] = { 0 };
+	size_t chunk_nr[] = {
+		[LINE_HISTORY_BLOB_PAIRS] = ctx->sorted_nr,
+		[LINE_HISTORY_HUNK_LISTS] = ctx->sorted_nr,
+		[LINE_HISTORY_HUNKS] = ctx->hunks_nr,
+	};
+	size_t i;
+
+	for (i = 0; i < ctx->sorted_nr; i++)
+		counts[ctx->sorted[i]->old_oid.hash[0]]++;
+	return write_chunk_cache(ctx->r, &line_history_format,
+				 &ctx->r->objects->line_history,
+				 counts, chunk_nr, ctx);
+}
+
+int write_line_history_index(struct repository *r,
+			     enum line_history_write_flags flags)
+{
+	struct write_line_history_context ctx = {
+		.r = r,
+	};
+	struct rev_info revs;
+	struct strvec args = STRVEC_INIT;
+	struct hashmap_iter iter;
+	struct line_history_entry *e;
+	struct commit *c;
+	uint64_t nr_commits = 0;
+	int ret;
+
+	trace2_region_enter("line-history", "write", r);
+
+	ctx.existing = prepare_line_history(r);
+	hashmap_init(&ctx.pairs, line_history_entry_cmp, NULL, 0);
+
+	repo_init_revisions(r, &revs, NULL);
+	strvec_pushl(&args, "line-history", "--all", NULL);
+	setup_revisions(args.nr, args.v, &revs, NULL);
+	if (prepare_revision_walk(&revs)) {
+		ret = error(_("revision walk setup failed"));
+		goto cleanup;
+	}
+
+	if (flags & LINE_HISTORY_WRITE_PROGRESS)
+		ctx.progress = start_delayed_progress(_("Indexing line history"), 0);
+	while ((c = get_revision(&revs))) {
+		display_progress(ctx.progress, ++nr_commits);
+		if (c->parents)
+			add_commit_pairs(&ctx, c);
+	}
+	stop_progress(&ctx.progress);
+
+	ALLOC_ARRAY(ctx.sorted, hashmap_get_size(&ctx.pairs));
+	hashmap_for_each_entry(&ctx.pairs, &iter, e, ent)
+		if (e->start[0] != UINT32_MAX)
+			ctx.sorted[ctx.sorted_nr++] = e;
+	QSORT(ctx.sorted, ctx.sorted_nr, line_history_entry_sort_cmp);
+
+	trace2_data_intmax("line-history", r, "pairs", ctx.sorted_nr);
+	trace2_data_intmax("line-history", r, "reused", ctx.reused);
+	trace2_data_intmax("line-history", r, "computed", ctx.computed);
+
+	ret = write_line_history_file(&ctx);
+
+cleanup:
+	trace2_region_leave("line-history", "write", r);
+	free(ctx.sorted);
+	free(ctx.hunks);
+	hashmap_clear_and_free(&ctx.pairs, struct line_history_entry, ent);
+	release_revisions(&revs);
+	strvec_clear(&args);
+	return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef LINE_HISTORY_H
+#define LINE_HISTORY_H
+
+#include "xdiff-interface.h"
+
+struct object_id;
+struct repository;
+
+/*
+ * The line-history index records, for pairs of blobs that appear as a
+ * modification (or rename) of a path between a commit and its first
+ * parent, the hunks that a zero-context diff between the two blobs
+ * produces. Consumers that only care about which line ranges changed
+ * (`git log -L` and `git blame`) can replay these hunks instead of
+ * reading both blobs and running xdiff.
+ *
+ * The hunks are keyed by blob object IDs rather than by commit and path,
+ * so the index stays valid across renames and history rewrites, and only
+ * goes stale in the sense that new pairs are not covered until it is
+ * rewritten.
+ *
+ * Hunks are recorded for the default xdiff options used by line-log (no
+ * flags) and by blame (the indent heuristic). Any other set of options
+ * falls back to computing the diff.
+ */
+
+/*
+ * Look up the diff from 'old_oid' to 'new_oid' computed with 'xdl_opts'
+ * in the line-history index of 'r' and, if present, feed its hunks to
+ * 'fn' in the same order as xdi_diff() with a zero-context 'hunk_func'
+ * would.
+ *
+ * Returns 1 if the hunks were replayed, 0 if the index cannot answer the
+ * query (the caller should then compute the diff itself), and -1 if 'fn'
+ * returned non-zero.
+ */
+int line_history_replay(struct repository *r,
+			const struct object_id *old_oid,
+			const struct object_id *new_oid,
+			int xdl_opts,
+			xdl_emit_hunk_consume_func_t fn, void *data);
+
+enum line_history_write_flags {
+	LINE_HISTORY_WRITE_PROGRESS = (1 << 0),
+};
+
+/*
+ * Write the line-history index for all commits reachable from refs in
+ * 'r'. Hunks already present in an existing index are reused, so only
+ * blob pairs introduced since the last write are diffed.
+ */
+int write_line_history_index(struct repository *r,
+			     enum line_history_write_flags flags);
+
+#endif
@@ -16,6 +16,7 @@
 #include "setup.h"
 #include "strvec.h"
 #include "bloom.h"
+#include "line-history.h"
 #include "tree-walk.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
@@ -345,6 +346,21 @@ static int collect_diff(mmfile_t *parent, mmfile_t *target, struct diff_ranges *
 	return xdi_diff(parent, target, &xpp, &xecfg, &ecb);
 }
 
+/*
+ * Fill 'out' with the hunks recorded in the line-history index for the
+ * blobs of 'pair', if any.  This avoids reading both blobs for commits
+ * whose changes do not touch the tracked ranges.
+ */
+static int collect_diff_from_index(struct repository *r,
+				   struct diff_filepair *pair,
+				   struct diff_ranges *out)
+{
+	struct collect_diff_cbdata cbdata = { .diff = out };
+
+	return line_history_replay(r, &pair->one->oid, &pair->two->oid, 0,
+				   collect_diff_cb, &cbdata) > 0;
+}
+
 /*
  * These are handy for debugging.  Removing them with #if 0 silences
  * the "unused function" warning.
@@ -1052,6 +1068,11 @@ static int process_diff_filepair(struct rev_info *rev,
 		return 0;
 
 	assert(pair->two->oid_valid);
+	diff_ranges_init(&diff);
+	if (pair->one->oid_valid &&
+	    collect_diff_from_index(rev->diffopt.repo, pair, &diff))
+		goto have_diff;
+
 	diff_populate_filespec(rev->diffopt.repo, pair->two, NULL);
 	file_target.ptr = pair->two->data;
 	file_target.size = pair->two->size;
@@ -1065,10 +1086,11 @@ static int process_diff_filepair(struct rev_info *rev,
 		file_parent.size = 0;
 	}
 
-	diff_ranges_init(&diff);
 	if (collect_diff(&file_parent, &file_target, &diff))
 		die("unable to generate diff for %s", pair->one->path);
 
+have_diff:
+
 	/* NEEDSWORK should apply some heuristics to prevent mismatches */
 	free(rg->path);
 	rg->path = xstrdup(pair->one->path);
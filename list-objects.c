@@ -107,6 +107,13 @@ static void process_tree_contents(struct traversal_context *ctx,
 	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
 
 	while (tree_entry(&desc, &entry)) {
+		/*
+		 * The next entry is already decoded; get its slot of the
+		 * object hash on its way while we deal with this one.
+		 */
+		if (desc.size)
+			prefetch_object(ctx->revs->repo, &desc.entry.oid);
+
 		if (match != all_entries_interesting) {
 			match = tree_entry_interesting(ctx->revs->repo->index,
 						       &entry, base,
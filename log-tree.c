@@ -32,6 +32,11 @@
 #include "wildmatch.h"
 #include "write-or-die.h"
 #include "pager.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "strvec.h"
+#include "tempfile.h"
 
 static struct decoration name_decoration = { "object names" };
 static int decoration_loaded;
@@ -711,6 +716,8 @@ static void show_diff_of_diff(struct rev_info *opt)
 	}
 }
 
+static void diff_worker_show_log(struct rev_info *opt, int separator);
+
 void show_log(struct rev_info *opt)
 {
 	struct strbuf msgbuf = STRBUF_INIT;
@@ -719,6 +726,11 @@ void show_log(struct rev_info *opt)
 	int abbrev_commit = opt->abbrev_commit ? opt->abbrev : the_hash_algo->hexsz;
 	struct pretty_print_context ctx = {0};
 
+	if (opt->diff_worker) {
+		diff_worker_show_log(opt, 0);
+		return;
+	}
+
 	opt->loginfo = NULL;
 	if (!opt->verbose_header) {
 		graph_show_commit(opt->graph);
@@ -896,6 +908,44 @@ void show_log(struct rev_info *opt)
 	free(ctx.after_subject);
 }
 
+static void show_log_separator(struct rev_info *opt)
+{
+	if ((opt->diffopt.output_format & ~DIFF_FORMAT_NO_OUTPUT) &&
+	    opt->verbose_header &&
+	    opt->commit_format != CMIT_FMT_ONELINE &&
+	    !commit_format_is_empty(opt->commit_format)) {
+		/*
+		 * When showing a verbose header (i.e. log message),
+		 * and not in --pretty=oneline format, we would want
+		 * an extra newline between the end of log and the
+		 * diff/diffstat output for readability.
+		 */
+		int pch = DIFF_FORMAT_DIFFSTAT | DIFF_FORMAT_PATCH;
+		if (opt->diffopt.output_prefix) {
+			struct strbuf *msg = NULL;
+			msg = opt->diffopt.output_prefix(&opt->diffopt,
+				opt->diffopt.output_prefix_data);
+			fwrite(msg->buf, msg->len, 1, opt->diffopt.file);
+		}
+
+		/*
+		 * We may have shown three-dashes line early
+		 * between generated commentary (notes, etc.)
+		 * and the log message, in which case we only
+		 * want a blank line after the commentary
+		 * without (an extra) three-dashes line.
+		 * Otherwise, we show the three-dashes line if
+		 * we are showing the patch with diffstat, but
+		 * in that case, there is no extra blank line
+		 * after the three-dashes line.
+		 */
+		if (!opt->shown_dashes &&
+		    (pch & opt->diffopt.output_format) == pch)
+			fprintf(opt->diffopt.file, "---");
+		putc('\n', opt->diffopt.file);
+	}
+}
+
 int log_tree_diff_flush(struct rev_info *opt)
 {
 	opt->shown_dashes = 0;
@@ -910,40 +960,11 @@ int log_tree_diff_flush(struct rev_info *opt)
 	}
 
 	if (opt->loginfo && !opt->no_commit_id) {
-		show_log(opt);
-		if ((opt->diffopt.output_format & ~DIFF_FORMAT_NO_OUTPUT) &&
-		    opt->verbose_header &&
-		    opt->commit_format != CMIT_FMT_ONELINE &&
-		    !commit_format_is_empty(opt->commit_format)) {
-			/*
-			 * When showing a verbose header (i.e. log message),
-			 * and not in --pretty=oneline format, we would want
-			 * an extra newline between the end of log and the
-			 * diff/diffstat output for readability.
-			 */
-			int pch = DIFF_FORMAT_DIFFSTAT | DIFF_FORMAT_PATCH;
-			if (opt->diffopt.output_prefix) {
-				struct strbuf *msg = NULL;
-				msg = opt->diffopt.output_prefix(&opt->diffopt,
-					opt->diffopt.output_prefix_data);
-				fwrite(msg->buf, msg->len, 1, opt->diffopt.file);
-			}
-
-			/*
-			 * We may have shown three-dashes line early
-			 * between generated commentary (notes, etc.)
-			 * and the log message, in which case we only
-			 * want a blank line after the commentary
-			 * without (an extra) three-dashes line.
-			 * Otherwise, we show the three-dashes line if
-			 * we are showing the patch with diffstat, but
-			 * in that case, there is no extra blank line
-			 * after the three-dashes line.
-			 */
-			if (!opt->shown_dashes &&
-			    (pch & opt->diffopt.output_format) == pch)
-				fprintf(opt->diffopt.file, "---");
-			putc('\n', opt->diffopt.file);
+		if (opt->diff_worker) {
+			diff_worker_show_log(opt, 1);
+		} else {
+			show_log(opt);
+			show_log_separator(opt);
 		}
 	}
 	diff_flush(&opt->diffopt);
@@ -1172,3 +1193,299 @@ int log_tree_commit(struct rev_info *opt, struct commit *commit)
 	diff_free(&opt->diffopt);
 	return shown;
 }
+
+/*
+ * In a diff worker, the output of each commit is written to a temporary
+ * file, and sent to this file descriptor in pkt-lines: diff output in
+ * packets starting with '\1', then "log[-sep] [<parent>]" where the
+ * caller has to show the log message, and "done ..." at the end.
+ */
+static int diff_worker_out = -1;
+
+static void diff_worker_send_output(void)
+{
+	static char buf[LARGE_PACKET_DATA_MAX];
+	ssize_t len;
+
+	if (fflush(stdout))
+		die_errno(_("unable to write diff output"));
+	if (!lseek(1, 0, SEEK_CUR))
+		return;
+	if (lseek(1, 0, SEEK_SET) < 0)
+		die_errno(_("unable to read diff output"));
+	buf[0] = '\1';
+	while ((len = xread(1, buf + 1, sizeof(buf) - 1)) > 0)
+		packet_write(diff_worker_out, buf, len + 1);
+	if (len < 0 || ftruncate(1, 0) || lseek(1, 0, SEEK_SET) < 0)
+		die_errno(_("unable to read diff output"));
+}
+
+static void diff_worker_show_log(struct rev_info *opt, int separator)
+{
+	struct commit *parent = opt->loginfo->parent;
+
+	opt->loginfo = NULL;
+	diff_worker_send_output();
+	packet_write_fmt(diff_worker_out, "log%s%s%s",
+			 separator ? "-sep" : "",
+			 parent ? " " : "",
+			 parent ? oid_to_hex(&parent->object.oid) : "");
+}
+
+/* "<commit> [<parent>...]", as sent by log_tree_pipeline_queue() */
+static int diff_worker_commit(struct rev_info *opt, const char *line)
+{
+	struct object_id oid;
+	struct commit *commit;
+	struct commit_list **pptr;
+	const char *p;
+	int shown;
+
+	if (parse_oid_hex(line, &oid, &p))
+		die(_("invalid line from log: '%s'"), line);
+	commit = lookup_commit_or_die(&oid, line);
+	parse_commit_or_die(commit);
+
+	/* use the parents the caller diffs against */
+	free_commit_list(commit->parents);
+	commit->parents = NULL;
+	pptr = &commit->parents;
+	while (*p == ' ') {
+		if (parse_oid_hex(p + 1, &oid, &p))
+			die(_("invalid line from log: '%s'"), line);
+		pptr = &commit_list_insert(lookup_commit_or_die(&oid, line),
+					   pptr)->next;
+	}
+	if (*p)
+		die(_("invalid line from log: '%s'"), line);
+
+	shown = log_tree_commit(opt, commit);
+	free_commit_buffer(the_repository->parsed_objects, commit);
+	return shown;
+}
+
+int log_tree_worker(struct rev_info *opt, log_tree_worker_fn fn)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct tempfile *output;
+
+	output = mks_tempfile_t("git-diff-worker-XXXXXX");
+	if (!output)
+		die_errno(_("unable to create temporary file"));
+	fflush(stdout);
+	diff_worker_out = xdup(1);
+	if (dup2(get_tempfile_fd(output), 1) < 0)
+		die_errno(_("unable to redirect diff output"));
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		struct diff_options *o = &opt->diffopt;
+		int shown;
+
+		shown = fn ? fn(opt, line.buf) : diff_worker_commit(opt, line.buf);
+		diff_worker_send_output();
+		packet_write_fmt(diff_worker_out, "done %d %d %d %d %d",
+				 shown > 0, o->flags.has_changes,
+				 o->flags.check_failed, o->degraded_cc_to_c,
+				 o->needed_rename_limit);
+	}
+
+	close(diff_worker_out);
+	diff_worker_out = -1;
+	delete_tempfile(&output);
+	strbuf_release(&line);
+	return 0;
+}
+
+/*
+ * A worker can only have this many commits queued, so that what we
+ * send it always fits in the pipe, and we never block writing to a
+ * worker that is itself waiting for us to read its output.
+ */
+#define MAX_QUEUED_PER_WORKER 32
+
+static int log_tree_pipeline_supported(struct rev_info *opt)
+{
+	/*
+	 * We show the log messages in walk order and only the diffs come
+	 * from the workers. Anything whose output depends on where the
+	 * walk is when a commit is shown, or on the diffs shown before,
+	 * is done serially. So is a walk whose revisions and pathspecs
+	 * came from stdin, as the workers cannot read them again.
+	 */
+	return (opt->diff || opt->merges_need_diff) &&
+		!opt->read_from_stdin &&
+		!(opt->diffopt.output_format & DIFF_FORMAT_NO_OUTPUT) &&
+		!opt->graph && !opt->line_level_traverse &&
+		!opt->track_linear && !opt->reflog_info &&
+		!opt->children.name && !opt->early_output &&
+		!opt->remerge_diff && !opt->diffopt.flags.follow_renames &&
+		!opt->diffopt.close_file && !opt->idiff_oid1 && !opt->rdiff1 &&
+		!opt->mime_boundary &&
+		(opt->always_show_header || opt->max_count < 0);
+}
+
+int log_tree_pipeline_start(struct log_tree_pipeline *p, struct rev_info *opt,
+			    const char **argv)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	if (opt->diff_jobs < 2 || opt->diff_worker ||
+	    !log_tree_pipeline_supported(opt))
+		return 0;
+
+	p->rev = opt;
+	p->nr = opt->diff_jobs;
+	p->lookahead = opt->diff_lookahead ? opt->diff_lookahead : 4 * p->nr;
+	if (p->lookahead > MAX_QUEUED_PER_WORKER * p->nr)
+		p->lookahead = MAX_QUEUED_PER_WORKER * p->nr;
+	CALLOC_ARRAY(p->queue, p->lookahead);
+	CALLOC_ARRAY(p->pending, p->nr);
+	CALLOC_ARRAY(p->workers, p->nr);
+
+	for (i = 0; i < p->nr; i++) {
+		struct child_process *cp = &p->workers[i];
+
+		child_process_init(cp);
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		strvec_pushl(&cp->args, argv[0], "--diff-worker", NULL);
+		strvec_pushv(&cp->args, argv + 1);
+		/* make "auto" color and the diffstat width come out the same */
+		strvec_pushf(&cp->env, "COLUMNS=%d", term_columns());
+		strvec_pushf(&cp->env, "GIT_PAGER_IN_USE=%s",
+			     isatty(1) || pager_in_use() ? "true" : "false");
+		if (start_command(cp))
+			die(_("unable to start diff worker"));
+	}
+	return 1;
+}
+
+int log_tree_pipeline_full(struct log_tree_pipeline *p)
+{
+	return p->queued >= p->lookahead;
+}
+
+void log_tree_pipeline_queue(struct log_tree_pipeline *p,
+			     struct commit *commit, const char *line)
+{
+	struct log_tree_pipeline_item *item;
+	struct strbuf buf = STRBUF_INIT;
+	int i, worker = 0;
+
+	if (log_tree_pipeline_full(p))
+		BUG("queueing to a full log pipeline");
+
+	for (i = 1; i < p->nr; i++)
+		if (p->pending[i] < p->pending[worker])
+			worker = i;
+
+	if (line) {
+		strbuf_addstr(&buf, line);
+	} else {
+		struct commit_list *parents;
+
+		strbuf_addstr(&buf, oid_to_hex(&commit->object.oid));
+		for (parents = get_saved_parents(p->rev, commit);
+		     parents;
+		     parents = parents->next)
+			strbuf_addf(&buf, " %s",
+				    oid_to_hex(&parents->item->object.oid));
+	}
+	strbuf_addch(&buf, '\n');
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (write_in_full(p->workers[worker].in, buf.buf, buf.len) < 0)
+		die_errno(_("unable to write to diff worker"));
+	sigchain_pop(SIGPIPE);
+	strbuf_release(&buf);
+
+	item = &p->queue[(p->first + p->queued++) % p->lookahead];
+	item->commit = commit;
+	item->worker = worker;
+	p->pending[worker]++;
+}
+
+struct commit *log_tree_pipeline_show(struct log_tree_pipeline *p, int *shown)
+{
+	static char buf[LARGE_PACKET_MAX];
+	struct rev_info *opt = p->rev;
+	struct diff_options *o = &opt->diffopt;
+	struct log_tree_pipeline_item item;
+	struct log_info log;
+	int fd;
+
+	if (!p->queued)
+		BUG("showing from an empty log pipeline");
+	item = p->queue[p->first];
+	p->first = (p->first + 1) % p->lookahead;
+	p->queued--;
+	p->pending[item.worker]--;
+	fd = p->workers[item.worker].out;
+
+	log.commit = item.commit;
+	log.parent = NULL;
+	for (;;) {
+		int len = packet_read(fd, buf, sizeof(buf),
+				      PACKET_READ_GENTLE_ON_EOF);
+		const char *arg;
+		int value[5];
+
+		if (len < 0)
+			die(_("diff worker exited unexpectedly"));
+		if (len && buf[0] == '\1') {
+			fwrite(buf + 1, 1, len - 1, o->file);
+		} else if (skip_prefix(buf, "log", &arg)) {
+			int separator = skip_prefix(arg, "-sep", &arg);
+			struct object_id oid;
+
+			log.parent = NULL;
+			if (*arg) {
+				if (*arg++ != ' ' || get_oid_hex(arg, &oid))
+					die(_("malformed output from diff worker"));
+				log.parent = lookup_commit_or_die(&oid, arg);
+			}
+			opt->loginfo = &log;
+			show_log(opt);
+			if (separator)
+				show_log_separator(opt);
+		} else if (sscanf(buf, "done %d %d %d %d %d", &value[0],
+				  &value[1], &value[2], &value[3],
+				  &value[4]) == 5) {
+			if (shown)
+				*shown = value[0];
+			o->flags.has_changes |= !!value[1];
+			o->flags.check_failed |= !!value[2];
+			o->degraded_cc_to_c |= value[3];
+			if (o->needed_rename_limit < value[4])
+				o->needed_rename_limit = value[4];
+			break;
+		} else {
+			die(_("malformed output from diff worker"));
+		}
+	}
+	opt->loginfo = NULL;
+	maybe_flush_or_die(o->file, "stdout");
+	return item.commit;
+}
+
+void log_tree_pipeline_finish(struct log_tree_pipeline *p)
+{
+	int i;
+
+	if (p->queued)
+		BUG("finishing a log pipeline with commits left to show");
+	for (i = 0; i < p->nr; i++)
+		close(p->workers[i].in);
+	for (i = 0; i < p->nr; i++) {
+		close(p->workers[i].out);
+		if (finish_command(&p->workers[i]))
+			die(_("diff worker failed"));
+	}
+	free(p->workers);
+	free(p->pending);
+	free(p->queue);
+	memset(p, 0, sizeof(*p));
+}
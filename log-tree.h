@@ -38,4 +38,53 @@ void fmt_output_commit(struct strbuf *, struct commit *, struct rev_info *);
 void fmt_output_subject(struct strbuf *, const char *subject, struct rev_info *);
 void fmt_output_email_subject(struct strbuf *, struct rev_info *);
 
+/*
+ * Compute the diffs of the commits to show in "opt->diff_jobs" worker
+ * processes, while the caller keeps walking. The workers run "git
+ * <argv> --diff-worker", which must set up "opt" the same way the
+ * caller did, and then call log_tree_worker().
+ *
+ * Commits are given to log_tree_pipeline_queue() in the order they
+ * should be shown; "line" is what to send to the worker, and defaults
+ * to the commit and the parents to diff against. Once the pipeline is
+ * full, log_tree_pipeline_show() does what log_tree_commit() would have
+ * done for the oldest queued commit and returns it; "queued" says how
+ * many are left. At most "opt->diff_lookahead" commits are queued, which
+ * bounds the output kept in flight.
+ *
+ * log_tree_pipeline_start() returns 0, and starts nothing, if
+ * "opt" does not ask for jobs or if the output cannot be pipelined; the
+ * caller then uses log_tree_commit() as usual.
+ */
+struct log_tree_pipeline_item {
+	struct commit *commit;
+	int worker;
+};
+
+struct log_tree_pipeline {
+	struct rev_info *rev;
+	struct child_process *workers;
+	int *pending;
+	int nr;
+
+	struct log_tree_pipeline_item *queue;
+	int first, queued, lookahead;
+};
+
+int log_tree_pipeline_start(struct log_tree_pipeline *, struct rev_info *opt,
+			    const char **argv);
+int log_tree_pipeline_full(struct log_tree_pipeline *);
+void log_tree_pipeline_queue(struct log_tree_pipeline *,
+			     struct commit *commit, const char *line);
+struct commit *log_tree_pipeline_show(struct log_tree_pipeline *, int *shown);
+void log_tree_pipeline_finish(struct log_tree_pipeline *);
+
+/*
+ * The main loop of a worker: run "fn" on each line read from the
+ * standard input (by default, a line from log_tree_pipeline_queue()
+ * that is shown with log_tree_commit()), and send the output back.
+ */
+typedef int (*log_tree_worker_fn)(struct rev_info *opt, const char *line);
+int log_tree_worker(struct rev_info *opt, log_tree_worker_fn fn);
+
 #endif
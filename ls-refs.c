@@ -12,6 +12,12 @@
 #include "pkt-line.h"
 #include "config.h"
 #include "string-list.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "path.h"
+#include "statinfo.h"
+#include "trace2.h"
+#include "write-or-die.h"
 
 static enum {
 	UNBORN_IGNORE = 0,
@@ -68,12 +74,129 @@ static int ref_match(const struct strvec *prefixes, const char *refname)
 	return 0;
 }
 
+/*
+ * With "lsrefs.cache", complete responses are kept in $GIT_DIR/ls-refs-cache,
+ * one file per set of arguments. Each file starts with a line holding a
+ * hash of the state of the ref store at the time the response was made,
+ * followed by the response exactly as it was sent.
+ *
+ * Ref stores never modify files in place: the "files" backend renames
+ * loose refs and packed-refs into place and unlinks deleted refs, and the
+ * reftable backend renames a new tables.list into place. So the stat
+ * data of HEAD, packed-refs and of every directory below refs/ (or of
+ * tables.list) changes whenever a ref does.
+ */
+#define LS_REFS_CACHE_DIR "ls-refs-cache"
+#define LS_REFS_CACHE_MAX_ENTRIES 256
+
+struct ls_refs_cache {
+	char *path;
+	/* state of the ref store, or NULL if it may change unnoticed */
+	char *state;
+	struct strbuf response;
+};
+
+static int ls_refs_cache_enabled(struct repository *r)
+{
+	int enabled;
+
+	if (repo_config_get_bool(r, "lsrefs.cache", &enabled))
+		return 0;
+	return enabled;
+}
+
+/*
+ * Feed the stat data of 'path' to 'ctx'. If it changed so recently that
+ * another change within the same second could go unnoticed, set 'racy'.
+ */
+static void hash_path_state(git_hash_ctx *ctx, const struct git_hash_algo *algo,
+			    const char *path, time_t now, int *racy)
+{
+	struct stat st;
+	struct stat_data sd;
+
+	algo->update_fn(ctx, path, strlen(path) + 1);
+	if (lstat(path, &st)) {
+		algo->update_fn(ctx, "", 1);
+		return;
+	}
+	fill_stat_data(&sd, &st);
+	algo->update_fn(ctx, &sd, sizeof(sd));
+	if (st.st_mtime >= now)
+		*racy = 1;
+}
+
+static void hash_refs_dir_state(git_hash_ctx *ctx, const struct git_hash_algo *algo,
+				struct strbuf *path, time_t now, int *racy)
+{
+	struct string_list subdirs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	size_t len = path->len;
+	struct dirent *e;
+	DIR *dir;
+
+	hash_path_state(ctx, algo, path->buf, now, racy);
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return;
+	while ((e = readdir_skip_dot_and_dotdot(dir))) {
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", e->d_name);
+		if (get_dtype(e, path, 0) == DT_DIR)
+			string_list_append(&subdirs, e->d_name);
+	}
+	closedir(dir);
+
+	/* readdir() order is not stable, but our hash must be */
+	string_list_sort(&subdirs);
+	for_each_string_list_item(item, &subdirs) {
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", item->string);
+		hash_refs_dir_state(ctx, algo, path, now, racy);
+	}
+	strbuf_setlen(path, len);
+	string_list_clear(&subdirs, 0);
+}
+
+static char *ref_store_state(struct repository *r)
+{
+	const struct git_hash_algo *algo = r->hash_algo;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct strbuf path = STRBUF_INIT;
+	time_t now = time(NULL);
+	git_hash_ctx ctx;
+	int racy = 0;
+
+	algo->init_fn(&ctx);
+	if (r->ref_storage_format == REF_STORAGE_FORMAT_REFTABLE) {
+		strbuf_addf(&path, "%s/reftable/tables.list", r->commondir);
+		hash_path_state(&ctx, algo, path.buf, now, &racy);
+	} else {
+		strbuf_addf(&path, "%s/HEAD", r->gitdir);
+		hash_path_state(&ctx, algo, path.buf, now, &racy);
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/packed-refs", r->commondir);
+		hash_path_state(&ctx, algo, path.buf, now, &racy);
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/refs", r->commondir);
+		hash_refs_dir_state(&ctx, algo, &path, now, &racy);
+	}
+	algo->final_fn(hash, &ctx);
+	strbuf_release(&path);
+
+	if (racy)
+		return NULL;
+	return xstrdup(hash_to_hex_algop(hash, algo));
+}
+
 struct ls_refs_data {
 	unsigned peel;
 	unsigned symrefs;
 	struct strvec prefixes;
 	struct strbuf buf;
 	struct strvec hidden_refs;
+	struct packet_writer writer;
 	unsigned unborn : 1;
 };
 
@@ -117,7 +240,7 @@ static int send_ref(const char *refname, const char *referent UNUSED, const stru
 	}
 
 	strbuf_addch(&data->buf, '\n');
-	packet_fwrite(stdout, data->buf.buf, data->buf.len);
+	packet_writer_write(&data->writer, "%s", data->buf.buf);
 
 	return 0;
 }
@@ -152,14 +275,148 @@ static int ls_refs_config(const char *var, const char *value,
 	return parse_hide_refs_config(var, value, "uploadpack", &data->hidden_refs);
 }
 
+static char *ls_refs_cache_path(struct repository *r,
+				struct ls_refs_data *data)
+{
+	const struct git_hash_algo *algo = r->hash_algo;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct strbuf key = STRBUF_INIT;
+	git_hash_ctx ctx;
+
+	strbuf_addf(&key, "peel=%u symrefs=%u unborn=%u\n",
+		    data->peel, data->symrefs, data->unborn);
+	strbuf_addf(&key, "namespace %s\n", get_git_namespace());
+	for (size_t i = 0; i < data->hidden_refs.nr; i++)
+		strbuf_addf(&key, "hide %s\n", data->hidden_refs.v[i]);
+	for (size_t i = 0; i < data->prefixes.nr; i++)
+		strbuf_addf(&key, "prefix %s\n", data->prefixes.v[i]);
+
+	algo->init_fn(&ctx);
+	algo->update_fn(&ctx, key.buf, key.len);
+	algo->final_fn(hash, &ctx);
+	strbuf_release(&key);
+
+	return repo_git_path(r, "%s/%s", LS_REFS_CACHE_DIR,
+			     hash_to_hex_algop(hash, algo));
+}
+
+/*
+ * Send the cached response if it is still valid, and return 1. Otherwise
+ * return 0, and set up 'data->writer' to keep a copy of the response when
+ * it can be cached.
+ */
+static int ls_refs_cache_lookup(struct repository *r,
+				struct ls_refs_data *data,
+				struct ls_refs_cache *cache)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *response;
+
+	cache->path = ls_refs_cache_path(r, data);
+	cache->state = ref_store_state(r);
+	if (!cache->state) {
+		trace2_data_string("ls-refs", r, "cache", "racy");
+		return 0;
+	}
+
+	if (strbuf_read_file(&buf, cache->path, 0) >= 0 &&
+	    skip_prefix(buf.buf, cache->state, &response) &&
+	    *response++ == '\n') {
+		trace2_data_string("ls-refs", r, "cache", "hit");
+		write_or_die(data->writer.dest_fd, response,
+			     buf.len - (response - buf.buf));
+		strbuf_release(&buf);
+		return 1;
+	}
+	strbuf_release(&buf);
+
+	trace2_data_string("ls-refs", r, "cache", "miss");
+	data->writer.copy = &cache->response;
+	return 0;
+}
+
+/*
+ * Drop all entries if there are too many of them; clients hardly ever
+ * vary their arguments, so most of them are stale anyway.
+ */
+static void ls_refs_cache_trim(struct strbuf *dir_path)
+{
+	size_t len = dir_path->len;
+	struct dirent *e;
+	int nr = 0;
+	DIR *dir;
+
+	dir = opendir(dir_path->buf);
+	if (!dir)
+		return;
+	while (readdir_skip_dot_and_dotdot(dir))
+		nr++;
+	if (nr >= LS_REFS_CACHE_MAX_ENTRIES) {
+		rewinddir(dir);
+		while ((e = readdir_skip_dot_and_dotdot(dir))) {
+			strbuf_setlen(dir_path, len);
+			strbuf_addf(dir_path, "/%s", e->d_name);
+			unlink(dir_path->buf);
+		}
+	}
+	closedir(dir);
+	strbuf_setlen(dir_path, len);
+}
+
+static void ls_refs_cache_store(struct repository *r,
+				struct ls_refs_cache *cache)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf dir = STRBUF_INIT;
+	int fd;
+
+	if (!cache->state)
+		return;
+
+	/*
+	 * The cache is an optimization only, and the repository may well
+	 * not be writable by whoever serves it; fail silently.
+	 */
+	strbuf_repo_git_path(&dir, r, LS_REFS_CACHE_DIR);
+	if (mkdir(dir.buf, 0777) && errno != EEXIST)
+		goto out;
+	if (adjust_shared_perm(dir.buf))
+		goto out;
+	ls_refs_cache_trim(&dir);
+
+	fd = hold_lock_file_for_update(&lock, cache->path, 0);
+	if (fd < 0)
+		goto out;
+	if (write_in_full(fd, cache->state, strlen(cache->state)) < 0 ||
+	    write_in_full(fd, "\n", 1) < 0 ||
+	    write_in_full(fd, cache->response.buf, cache->response.len) < 0 ||
+	    commit_lock_file(&lock) < 0)
+		rollback_lock_file(&lock);
+	else
+		trace2_data_string("ls-refs", r, "cache", "stored");
+
+out:
+	strbuf_release(&dir);
+}
+
+static void ls_refs_cache_release(struct ls_refs_cache *cache)
+{
+	free(cache->path);
+	free(cache->state);
+	strbuf_release(&cache->response);
+}
+
 int ls_refs(struct repository *r, struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct ls_refs_cache cache = { .response = STRBUF_INIT };
+	int use_cache = ls_refs_cache_enabled(r);
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
 	strbuf_init(&data.buf, 0);
 	strvec_init(&data.hidden_refs);
+	packet_writer_init_buffered(&data.writer, 1);
 
 	git_config(ls_refs_config, &data);
 
@@ -192,6 +449,9 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 	if (data.prefixes.nr >= TOO_MANY_PREFIXES)
 		strvec_clear(&data.prefixes);
 
+	if (use_cache && ls_refs_cache_lookup(r, &data, &cache))
+		goto out;
+
 	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
@@ -199,7 +459,13 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 					  get_git_namespace(), data.prefixes.v,
 					  hidden_refs_to_excludes(&data.hidden_refs),
 					  send_ref, &data);
-	packet_fflush(stdout);
+	packet_writer_flush(&data.writer);
+	if (data.writer.copy)
+		ls_refs_cache_store(r, &cache);
+
+out:
+	packet_writer_release(&data.writer);
+	ls_refs_cache_release(&cache);
 	strvec_clear(&data.prefixes);
 	strbuf_release(&data.buf);
 	strvec_clear(&data.hidden_refs);
@@ -409,11 +409,8 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts)
 {
-	struct attr_check *check = load_merge_attributes();
 	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
-	const char *ll_driver_name = NULL;
-	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
-	const struct ll_merge_driver *driver;
+	struct ll_merge_plan plan;
 
 	if (!opts)
 		opts = &default_opts;
@@ -424,6 +421,26 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 		normalize_file(theirs, path, istate);
 	}
 
+	ll_merge_prepare(&plan, path, istate, opts);
+	return ll_merge_execute(&plan, result_buf, path,
+				ancestor, ancestor_label,
+				ours, our_label, theirs, their_label, opts);
+}
+
+void ll_merge_prepare(struct ll_merge_plan *plan,
+		      const char *path,
+		      struct index_state *istate,
+		      const struct ll_merge_options *opts)
+{
+	struct attr_check *check = load_merge_attributes();
+	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
+	const char *ll_driver_name = NULL;
+	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	const struct ll_merge_driver *driver;
+
+	if (!opts)
+		opts = &default_opts;
+
 	git_check_attr(istate, path, check);
 	ll_driver_name = check->items[0].value;
 	if (check->items[1].value) {
@@ -440,9 +457,36 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	if (opts->extra_marker_size) {
 		marker_size += opts->extra_marker_size;
 	}
-	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
-			  ours, our_label, theirs, their_label,
-			  opts, marker_size);
+
+	plan->driver = driver;
+	plan->marker_size = marker_size;
+}
+
+int ll_merge_is_threadsafe(const struct ll_merge_plan *plan)
+{
+	/*
+	 * external drivers need temporary files and a child process, and
+	 * one declared without a command line dies
+	 */
+	return plan->driver->fn != ll_ext_merge;
+}
+
+enum ll_merge_result ll_merge_execute(const struct ll_merge_plan *plan,
+				      mmbuffer_t *result_buf,
+				      const char *path,
+				      mmfile_t *ancestor, const char *ancestor_label,
+				      mmfile_t *ours, const char *our_label,
+				      mmfile_t *theirs, const char *their_label,
+				      const struct ll_merge_options *opts)
+{
+	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
+
+	if (!opts)
+		opts = &default_opts;
+	return plan->driver->fn(plan->driver, result_buf, path,
+				ancestor, ancestor_label,
+				ours, our_label, theirs, their_label,
+				opts, plan->marker_size);
 }
 
 int ll_merge_marker_size(struct index_state *istate, const char *path)
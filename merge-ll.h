@@ -108,6 +108,34 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+/*
+ * ll_merge() in two steps, for callers that want to run many merges on
+ * several threads.  ll_merge_prepare() looks up the merge driver and the
+ * conflict marker size for "path"; it consults the attributes and must
+ * not run concurrently with anything else.  ll_merge_execute() then does
+ * the merge, and may be called from any thread if ll_merge_is_threadsafe()
+ * returns true for the plan.  Unlike ll_merge(), these do not honor
+ * `renormalize` in the options.
+ */
+struct ll_merge_driver;
+struct ll_merge_plan {
+	const struct ll_merge_driver *driver;
+	int marker_size;
+};
+
+void ll_merge_prepare(struct ll_merge_plan *plan,
+		      const char *path,
+		      struct index_state *istate,
+		      const struct ll_merge_options *opts);
+int ll_merge_is_threadsafe(const struct ll_merge_plan *plan);
+enum ll_merge_result ll_merge_execute(const struct ll_merge_plan *plan,
+				      mmbuffer_t *result_buf,
+				      const char *path,
+				      mmfile_t *ancestor, const char *ancestor_label,
+				      mmfile_t *ours, const char *our_label,
+				      mmfile_t *theirs, const char *their_label,
+				      const struct ll_merge_options *opts);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
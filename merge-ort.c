@@ -38,6 +38,7 @@
 #include "object-name.h"
 #include "object-store-ll.h"
 #include "oid-array.h"
+#include "parse.h"
 #include "path.h"
 #include "promisor-remote.h"
 #include "read-cache-ll.h"
@@ -45,6 +46,7 @@
 #include "revision.h"
 #include "sparse-index.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "unpack-trees.h"
@@ -402,6 +404,14 @@ struct merge_options_internal {
 
 	/* field that holds submodule conflict information */
 	struct string_list conflicted_submodules;
+
+	/*
+	 * content_merges: content merges done ahead of time
+	 *
+	 * Set only while process_entries() runs; see
+	 * prepare_content_merges().
+	 */
+	struct content_merges *content_merges;
 };
 
 struct conflicted_submodule_item {
@@ -2045,6 +2055,313 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
+static void init_ll_merge_options(struct merge_options *opt,
+				  const int extra_marker_size,
+				  struct ll_merge_options *ll_opts)
+{
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
+	ll_opts->conflict_style = opt->conflict_style;
+
+	if (opt->priv->call_depth) {
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts->variant = 0;
+			break;
+		}
+	}
+}
+
+static void content_merge_labels(struct merge_options *opt,
+				 const char *pathnames[3],
+				 char **base, char **name1, char **name2)
+{
+	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
+	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
+		*base  = mkpathdup("%s", opt->ancestor);
+		*name1 = mkpathdup("%s", opt->branch1);
+		*name2 = mkpathdup("%s", opt->branch2);
+	} else {
+		*base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
+		*name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
+		*name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
+	}
+}
+
+/*
+ * Most of the time of a merge touching many files can go to the content
+ * merges of regular files, which are independent of each other.  Before
+ * process_entries() handles the entries one by one, we predict which of
+ * them will need such a merge, and run those merges in batches on
+ * several threads as processing reaches them.  merge_3way() then picks
+ * up a result if it is asked for a merge with exactly the same inputs,
+ * so a wrong prediction only costs a wasted merge.  Everything that has
+ * side effects -- reading blobs, looking up attributes, writing the
+ * result, and reporting conflicts -- still happens on the main thread,
+ * in the usual order.
+ */
+#define CONTENT_MERGE_MAX_THREADS 32
+#define CONTENT_MERGE_BATCH_PER_THREAD 32
+
+struct content_merge {
+	struct string_list_item *entry;
+	const char *path;
+	struct object_id o, a, b;
+	const char *pathnames[3];
+	int extra_marker_size;
+
+	char *base, *name1, *name2;
+	mmfile_t orig, src1, src2;
+	struct ll_merge_plan plan;
+	unsigned threadsafe : 1;
+
+	mmbuffer_t result;
+	enum ll_merge_result status;
+};
+
+struct content_merges {
+	struct content_merge *items;
+	size_t nr, alloc;
+
+	/* items[0..computed) have been merged, "taken" of them used */
+	size_t computed, taken;
+	struct strmap by_path;
+	struct ll_merge_options ll_opts;
+	int threads;
+
+	/* handing out items[next..end) to the threads */
+	pthread_mutex_t mutex;
+	size_t next, end;
+};
+
+static int content_merge_threads(size_t nr)
+{
+	unsigned long threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	threads = git_env_ulong("GIT_TEST_MERGE_ORT_THREADS", online_cpus());
+	if (threads > CONTENT_MERGE_MAX_THREADS)
+		threads = CONTENT_MERGE_MAX_THREADS;
+	if (threads > nr)
+		threads = nr;
+	return threads;
+}
+
+/*
+ * Queue the entries of plist, in the order process_entries() will visit
+ * them, that will need a content merge of two regular files.
+ */
+static void prepare_content_merges(struct merge_options *opt,
+				   struct string_list *plist)
+{
+	struct content_merges *cms;
+	struct string_list_item *e;
+	int extra_marker_size = opt->priv->call_depth * 2;
+
+	if (opt->renormalize)
+		return; /* renormalizing needs the attributes */
+
+	CALLOC_ARRAY(cms, 1);
+	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
+		struct conflict_info *ci = e->util;
+		struct content_merge *cm;
+		struct version_info *o, *a, *b;
+
+		if (ci->merged.clean)
+			continue;
+
+		/* Same rules as in process_entry() and handle_content_merge() */
+		o = &ci->stages[0];
+		a = &ci->stages[1];
+		b = &ci->stages[2];
+		if (ci->match_mask || ci->df_conflict || ci->filemask < 6 ||
+		    !S_ISREG(a->mode) || !S_ISREG(b->mode) ||
+		    oideq(&a->oid, &b->oid) ||
+		    oideq(&a->oid, &o->oid) || oideq(&b->oid, &o->oid))
+			continue;
+
+		ALLOC_GROW(cms->items, cms->nr + 1, cms->alloc);
+		cm = &cms->items[cms->nr++];
+		memset(cm, 0, sizeof(*cm));
+		cm->entry = e;
+		cm->path = e->string;
+		if ((S_IFMT & o->mode) == (S_IFMT & a->mode))
+			oidcpy(&cm->o, &o->oid);
+		else
+			oidcpy(&cm->o, null_oid());
+		oidcpy(&cm->a, &a->oid);
+		oidcpy(&cm->b, &b->oid);
+		COPY_ARRAY(cm->pathnames, ci->pathnames, 3);
+		cm->extra_marker_size = extra_marker_size;
+	}
+
+	cms->threads = content_merge_threads(cms->nr);
+	if (cms->threads < 2) {
+		free(cms->items);
+		free(cms);
+		return;
+	}
+
+	/* ll_merge_prepare() reads the attributes through it */
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+
+	strmap_init_with_options(&cms->by_path, NULL, 0);
+	for (size_t i = 0; i < cms->nr; i++)
+		strmap_put(&cms->by_path, cms->items[i].path, &cms->items[i]);
+	cms->ll_opts = (struct ll_merge_options)LL_MERGE_OPTIONS_INIT;
+	init_ll_merge_options(opt, extra_marker_size, &cms->ll_opts);
+	pthread_mutex_init(&cms->mutex, NULL);
+	opt->priv->content_merges = cms;
+}
+
+static void *content_merge_thread(void *data)
+{
+	struct content_merges *cms = data;
+
+	for (;;) {
+		struct content_merge *cm;
+
+		pthread_mutex_lock(&cms->mutex);
+		cm = cms->next < cms->end ? &cms->items[cms->next++] : NULL;
+		pthread_mutex_unlock(&cms->mutex);
+		if (!cm)
+			return NULL;
+		if (!cm->threadsafe)
+			continue;
+
+		cm->status = ll_merge_execute(&cm->plan, &cm->result, cm->path,
+					      &cm->orig, cm->base,
+					      &cm->src1, cm->name1,
+					      &cm->src2, cm->name2,
+					      &cms->ll_opts);
+		FREE_AND_NULL(cm->orig.ptr);
+		FREE_AND_NULL(cm->src1.ptr);
+		FREE_AND_NULL(cm->src2.ptr);
+	}
+}
+
+/*
+ * Merge the next batch of queued content merges, if process_entries()
+ * has reached the first of them.
+ */
+static void run_content_merges(struct merge_options *opt,
+			       struct string_list_item *entry)
+{
+	struct content_merges *cms = opt->priv->content_merges;
+	pthread_t threads[CONTENT_MERGE_MAX_THREADS];
+	size_t i, end;
+	int t, nr_threads = 0;
+
+	if (!cms || cms->computed >= cms->nr ||
+	    cms->items[cms->computed].entry != entry)
+		return;
+
+	end = cms->computed + cms->threads * CONTENT_MERGE_BATCH_PER_THREAD;
+	if (end > cms->nr)
+		end = cms->nr;
+
+	for (i = cms->computed; i < end; i++) {
+		struct content_merge *cm = &cms->items[i];
+
+		content_merge_labels(opt, cm->pathnames,
+				     &cm->base, &cm->name1, &cm->name2);
+		ll_merge_prepare(&cm->plan, cm->path,
+				 &opt->priv->attr_index, &cms->ll_opts);
+		cm->threadsafe = ll_merge_is_threadsafe(&cm->plan);
+		if (!cm->threadsafe)
+			continue;
+		read_mmblob(&cm->orig, &cm->o);
+		read_mmblob(&cm->src1, &cm->a);
+		read_mmblob(&cm->src2, &cm->b);
+	}
+
+	trace2_region_enter("merge", "content merges", opt->repo);
+	cms->next = cms->computed;
+	cms->end = end;
+	for (t = 0; t < cms->threads; t++) {
+		if (pthread_create(&threads[nr_threads], NULL,
+				   content_merge_thread, cms))
+			break;
+		nr_threads++;
+	}
+	/* do whatever is left over if we could not start any thread */
+	content_merge_thread(cms);
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	trace2_region_leave("merge", "content merges", opt->repo);
+
+	cms->computed = end;
+}
+
+/*
+ * Return the content merge done ahead of time for these inputs, if any.
+ * The caller takes over its result and labels.
+ */
+static struct content_merge *take_content_merge(struct merge_options *opt,
+						const char *path,
+						const struct object_id *o,
+						const struct object_id *a,
+						const struct object_id *b,
+						const char *pathnames[3],
+						const int extra_marker_size)
+{
+	struct content_merges *cms = opt->priv->content_merges;
+	struct content_merge *cm;
+
+	if (!cms)
+		return NULL;
+	cm = strmap_get(&cms->by_path, path);
+	if (!cm || cm >= cms->items + cms->computed || !cm->threadsafe ||
+	    !oideq(&cm->o, o) || !oideq(&cm->a, a) || !oideq(&cm->b, b) ||
+	    cm->pathnames[0] != pathnames[0] ||
+	    cm->pathnames[1] != pathnames[1] ||
+	    cm->pathnames[2] != pathnames[2] ||
+	    cm->extra_marker_size != extra_marker_size)
+		return NULL;
+
+	strmap_remove(&cms->by_path, path, 0);
+	cms->taken++;
+	return cm;
+}
+
+static void clear_content_merges(struct merge_options *opt)
+{
+	struct content_merges *cms = opt->priv->content_merges;
+
+	if (!cms)
+		return;
+	trace2_data_intmax("merge", opt->repo, "content_merges/taken",
+			   cms->taken);
+	for (size_t i = 0; i < cms->nr; i++) {
+		struct content_merge *cm = &cms->items[i];
+
+		free(cm->base);
+		free(cm->name1);
+		free(cm->name2);
+		free(cm->orig.ptr);
+		free(cm->src1.ptr);
+		free(cm->src2.ptr);
+		free(cm->result.ptr);
+	}
+	strmap_clear(&cms->by_path, 0);
+	pthread_mutex_destroy(&cms->mutex);
+	free(cms->items);
+	FREE_AND_NULL(opt->priv->content_merges);
+}
+
 static int merge_3way(struct merge_options *opt,
 		      const char *path,
 		      const struct object_id *o,
@@ -2056,44 +2373,28 @@ static int merge_3way(struct merge_options *opt,
 {
 	mmfile_t orig, src1, src2;
 	struct ll_merge_options ll_opts = LL_MERGE_OPTIONS_INIT;
+	struct content_merge *cm;
 	char *base, *name1, *name2;
 	enum ll_merge_result merge_status;
 
 	if (!opt->priv->attr_index.initialized)
 		initialize_attr_index(opt);
 
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
-	ll_opts.conflict_style = opt->conflict_style;
-
-	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
-	} else {
-		switch (opt->recursive_variant) {
-		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
-			break;
-		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
-			break;
-		default:
-			ll_opts.variant = 0;
-			break;
-		}
+	cm = take_content_merge(opt, path, o, a, b,
+				pathnames, extra_marker_size);
+	if (cm) {
+		*result_buf = cm->result;
+		merge_status = cm->status;
+		base = cm->base;
+		name1 = cm->name1;
+		name2 = cm->name2;
+		cm->result.ptr = NULL;
+		cm->base = cm->name1 = cm->name2 = NULL;
+		goto done;
 	}
 
-	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
-	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
-		base  = mkpathdup("%s", opt->ancestor);
-		name1 = mkpathdup("%s", opt->branch1);
-		name2 = mkpathdup("%s", opt->branch2);
-	} else {
-		base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
-		name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
-		name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
-	}
+	init_ll_merge_options(opt, extra_marker_size, &ll_opts);
+	content_merge_labels(opt, pathnames, &base, &name1, &name2);
 
 	read_mmblob(&orig, o);
 	read_mmblob(&src1, a);
@@ -2102,6 +2403,11 @@ static int merge_3way(struct merge_options *opt,
 	merge_status = ll_merge(result_buf, path, &orig, base,
 				&src1, name1, &src2, name2,
 				&opt->priv->attr_index, &ll_opts);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+
+done:
 	if (merge_status == LL_MERGE_BINARY_CONFLICT)
 		path_msg(opt, CONFLICT_BINARY, 0,
 			 path, NULL, NULL, NULL,
@@ -2111,9 +2417,6 @@ static int merge_3way(struct merge_options *opt,
 	free(base);
 	free(name1);
 	free(name2);
-	free(orig.ptr);
-	free(src1.ptr);
-	free(src2.ptr);
 	return merge_status;
 }
 
@@ -4415,6 +4718,7 @@ static int process_entries(struct merge_options *opt,
 	 */
 	trace2_region_enter("merge", "processing", opt->repo);
 	prefetch_for_content_merges(opt, &plist);
+	prepare_content_merges(opt, &plist);
 	for (entry = &plist.items[plist.nr-1]; entry >= plist.items; --entry) {
 		char *path = entry->string;
 		/*
@@ -4433,6 +4737,7 @@ static int process_entries(struct merge_options *opt,
 			record_entry_for_tree(&dir_metadata, path, mi);
 		else {
 			struct conflict_info *ci = (struct conflict_info *)mi;
+			run_content_merges(opt, entry);
 			if (process_entry(opt, path, ci, &dir_metadata) < 0) {
 				ret = -1;
 				goto cleanup;
@@ -4455,6 +4760,7 @@ static int process_entries(struct merge_options *opt,
 		       opt->repo->hash_algo->rawsz) < 0)
 		ret = -1;
 cleanup:
+	clear_content_merges(opt);
 	string_list_clear(&plist, 0);
 	string_list_clear(&dir_metadata.versions, 0);
 	string_list_clear(&dir_metadata.offsets, 0);
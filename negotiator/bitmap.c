@@ -0,0 +1,305 @@
+#include "git-compat-util.h"
+#include "bitmap.h"
+#include "skipping.h"
+#include "../commit.h"
+#include "../commit-graph.h"
+#include "../fetch-negotiator.h"
+#include "../hex.h"
+#include "../oidset.h"
+#include "../pack-bitmap.h"
+#include "../refs.h"
+#include "../repository.h"
+
+/* Remember to update object flag allocation in object.h */
+/*
+ * The server has this commit, so it has all of its ancestors, too.
+ */
+#define COMMON		(1U << 2)
+/*
+ * This commit is reachable from one of the negotiation tips.
+ */
+#define REACHABLE	(1U << 3)
+/*
+ * This commit is in the list of "have" candidates.
+ */
+#define CANDIDATE	(1U << 4)
+/*
+ * This commit has been sent as a "have".
+ */
+#define SENT		(1U << 5)
+
+#define ALL_FLAGS (COMMON | REACHABLE | CANDIDATE | SENT)
+
+struct data {
+	struct repository *repo;
+	struct bitmap_index *bitmap;
+
+	/* Commits pointed to by remote-tracking refs. */
+	struct oidset remote_tips;
+
+	struct commit **tips;
+	size_t tips_nr, tips_alloc;
+
+	struct commit **known;
+	size_t known_nr, known_alloc;
+
+	/*
+	 * The commits we may send as "have", in the order we send them,
+	 * and the position of the next one to consider.
+	 */
+	struct commit **candidates;
+	size_t candidates_nr, candidates_alloc;
+	size_t next_candidate;
+
+	/* Every commit we have set a flag on, to clear them in release(). */
+	struct commit **marked;
+	size_t marked_nr, marked_alloc;
+
+	/* Objects reachable from commits the server is known to have. */
+	struct bitmap *common;
+
+	/* No candidate has a generation number below this one. */
+	timestamp_t min_generation;
+
+	unsigned prepared : 1;
+};
+
+static void mark(struct data *data, struct commit *c, unsigned flag)
+{
+	if (!(c->object.flags & ALL_FLAGS)) {
+		ALLOC_GROW(data->marked, data->marked_nr + 1, data->marked_alloc);
+		data->marked[data->marked_nr++] = c;
+	}
+	c->object.flags |= flag;
+}
+
+/*
+ * Mark "commit" and its ancestors with "flag". The walk stops at commits
+ * that have a bitmap, whose reachable objects are added to "result"
+ * instead, and at commits too old to be an ancestor of any candidate.
+ */
+static void mark_reachable(struct data *data, struct commit *commit,
+			   unsigned flag, struct bitmap *result)
+{
+	struct commit **stack = NULL;
+	size_t nr = 0, alloc = 0;
+
+	if (commit->object.flags & flag)
+		return;
+	mark(data, commit, flag);
+	ALLOC_GROW(stack, nr + 1, alloc);
+	stack[nr++] = commit;
+
+	while (nr) {
+		struct commit *c = stack[--nr];
+		struct ewah_bitmap *ewah = bitmap_for_commit(data->bitmap, c);
+		struct commit_list *p;
+
+		if (ewah) {
+			bitmap_or_ewah(result, ewah);
+			continue;
+		}
+		if (repo_parse_commit(data->repo, c) ||
+		    commit_graph_generation(c) < data->min_generation)
+			continue;
+
+		for (p = c->parents; p; p = p->next) {
+			if (p->item->object.flags & flag)
+				continue;
+			mark(data, p->item, flag);
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr++] = p->item;
+		}
+	}
+
+	free(stack);
+}
+
+static int is_common(struct data *data, struct commit *c)
+{
+	return (c->object.flags & COMMON) ||
+		bitmap_walk_contains(data->bitmap, data->common, &c->object.oid);
+}
+
+static void add_candidate(struct data *data, struct commit *c)
+{
+	if (c->object.flags & CANDIDATE)
+		return;
+	mark(data, c, CANDIDATE);
+	ALLOC_GROW(data->candidates, data->candidates_nr + 1,
+		   data->candidates_alloc);
+	data->candidates[data->candidates_nr++] = c;
+}
+
+static int add_bitmapped_commit(const struct object_id *oid, void *cb_data)
+{
+	struct data *data = cb_data;
+	struct commit *c = lookup_commit(data->repo, oid);
+
+	if (c && !repo_parse_commit(data->repo, c))
+		add_candidate(data, c);
+	return 0;
+}
+
+static int compare_candidates(const void *a_, const void *b_, void *cb_data)
+{
+	struct data *data = cb_data;
+	struct commit *a = *(struct commit **)a_;
+	struct commit *b = *(struct commit **)b_;
+	int a_remote = oidset_contains(&data->remote_tips, &a->object.oid);
+	int b_remote = oidset_contains(&data->remote_tips, &b->object.oid);
+
+	/* what we last heard from the server comes first */
+	if (a_remote != b_remote)
+		return b_remote - a_remote;
+	return compare_commits_by_gen_then_commit_date(a, b, NULL);
+}
+
+/*
+ * The candidates are the commits pointed to by remote-tracking refs
+ * among our tips, and the commits with a bitmap that are reachable from
+ * our tips. The bitmapped commits are spread over the whole history, so
+ * once the server acknowledges one of them we can skip everything it
+ * covers.
+ */
+static void prepare(struct data *data)
+{
+	struct bitmap *reachable = bitmap_new();
+	size_t i, nr;
+
+	for (i = 0; i < data->tips_nr; i++)
+		if (oidset_contains(&data->remote_tips,
+				    &data->tips[i]->object.oid))
+			add_candidate(data, data->tips[i]);
+	nr = data->candidates_nr;
+	if (for_each_bitmapped_commit(data->bitmap, add_bitmapped_commit, data) < 0)
+		data->candidates_nr = nr;
+
+	if (generation_numbers_enabled(data->repo)) {
+		data->min_generation = GENERATION_NUMBER_INFINITY;
+		for (i = 0; i < data->candidates_nr; i++) {
+			timestamp_t gen = commit_graph_generation(data->candidates[i]);
+			if (gen < data->min_generation)
+				data->min_generation = gen;
+		}
+	}
+
+	for (i = 0; i < data->tips_nr; i++)
+		mark_reachable(data, data->tips[i], REACHABLE, reachable);
+	for (i = nr = 0; i < data->candidates_nr; i++) {
+		struct commit *c = data->candidates[i];
+
+		if ((c->object.flags & REACHABLE) ||
+		    bitmap_walk_contains(data->bitmap, reachable, &c->object.oid))
+			data->candidates[nr++] = c;
+	}
+	data->candidates_nr = nr;
+	QSORT_S(data->candidates, data->candidates_nr, compare_candidates, data);
+
+	for (i = 0; i < data->known_nr; i++)
+		mark_reachable(data, data->known[i], COMMON, data->common);
+
+	bitmap_free(reachable);
+	data->prepared = 1;
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+
+	ALLOC_GROW(data->known, data->known_nr + 1, data->known_alloc);
+	data->known[data->known_nr++] = c;
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+
+	n->known_common = NULL;
+	ALLOC_GROW(data->tips, data->tips_nr + 1, data->tips_alloc);
+	data->tips[data->tips_nr++] = c;
+}
+
+static const struct object_id *next(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+
+	n->known_common = NULL;
+	n->add_tip = NULL;
+	if (!data->prepared)
+		prepare(data);
+
+	while (data->next_candidate < data->candidates_nr) {
+		struct commit *c = data->candidates[data->next_candidate++];
+
+		if (is_common(data, c))
+			continue;
+		mark(data, c, SENT);
+		return &c->object.oid;
+	}
+	return NULL;
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+	int known_to_be_common;
+
+	if (!(c->object.flags & SENT))
+		die("received ack for commit %s not sent as 'have'",
+		    oid_to_hex(&c->object.oid));
+	known_to_be_common = is_common(data, c);
+	mark_reachable(data, c, COMMON, data->common);
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+	size_t i;
+
+	for (i = 0; i < data->marked_nr; i++)
+		data->marked[i]->object.flags &= ~ALL_FLAGS;
+	free(data->marked);
+	free(data->candidates);
+	free(data->known);
+	free(data->tips);
+	bitmap_free(data->common);
+	oidset_clear(&data->remote_tips);
+	free_bitmap_index(data->bitmap);
+	FREE_AND_NULL(n->data);
+}
+
+static int add_remote_tip(const char *refname UNUSED,
+			  const char *referent UNUSED,
+			  const struct object_id *oid,
+			  int flag UNUSED, void *cb_data)
+{
+	oidset_insert(cb_data, oid);
+	return 0;
+}
+
+void bitmap_negotiator_init(struct repository *r,
+			    struct fetch_negotiator *negotiator)
+{
+	struct bitmap_index *bitmap = prepare_bitmap_git(r);
+	struct data *data;
+
+	if (!bitmap) {
+		skipping_negotiator_init(negotiator);
+		return;
+	}
+
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->release = release;
+	negotiator->data = CALLOC_ARRAY(data, 1);
+	data->repo = r;
+	data->bitmap = bitmap;
+	data->common = bitmap_new();
+	oidset_init(&data->remote_tips, 0);
+	refs_for_each_remote_ref(get_main_ref_store(r), add_remote_tip,
+				 &data->remote_tips);
+}
@@ -0,0 +1,10 @@
+#ifndef NEGOTIATOR_BITMAP_H
+#define NEGOTIATOR_BITMAP_H
+
+struct fetch_negotiator;
+struct repository;
+
+void bitmap_negotiator_init(struct repository *r,
+			    struct fetch_negotiator *negotiator);
+
+#endif
@@ -1586,6 +1586,9 @@ static int do_oid_object_info_extended(struct repository *r,
 		return 0;
 	}
 
+	if (r == the_repository && !bulk_checkin_object_info(real, oi))
+		return 0;
+
 	while (1) {
 		if (find_pack_entry(r, real, &e))
 			break;
@@ -2350,6 +2353,8 @@ int write_object_file_flags(const void *buf, unsigned long len,
 	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
 	if (freshen_packed_object(oid) || freshen_loose_object(oid))
 		return 0;
+	if (!compat && !write_object_bulk_checkin(buf, len, type, oid))
+		return 0;
 	if (write_loose_object(oid, hdr, hdrlen, buf, len, 0, flags))
 		return -1;
 	if (compat)
@@ -1,6 +1,7 @@
 #ifndef OBJECT_STORE_LL_H
 #define OBJECT_STORE_LL_H
 
+#include "chunk-cache.h"
 #include "hashmap.h"
 #include "object.h"
 #include "list.h"
@@ -185,6 +186,9 @@ struct raw_object_store {
 	struct commit_graph *commit_graph;
 	unsigned commit_graph_attempted : 1; /* if loading has been attempted */
 
+	struct chunk_cache_slot line_history;
+	struct chunk_cache_slot patch_id_cache;
+
 	/*
 	 * private data
 	 *
@@ -70,20 +70,34 @@ static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
 }
 
 /*
- * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
+ * Every slot of obj_hash has a 16-bit tag in obj_hash_tags, made of bits
+ * of the object name that hash_obj() does not use. A lookup compares the
+ * tags first and only dereferences an object whose tag matches, so that
+ * probing past other objects does not touch them at all. The top bit of
+ * a tag is always set, which leaves zero to mark an empty slot.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static inline uint16_t obj_hash_tag(const struct object_id *oid)
+{
+	return get_be16(oid->hash + sizeof(unsigned int)) | 0x8000;
+}
+
+/*
+ * Insert obj into the hash table hash, with its tag in tags, both of
+ * which have length size (which must be a power of 2).  On collisions,
+ * simply overflow to the next empty bucket.
+ */
+static void insert_obj_hash(struct object *obj, struct object **hash,
+			    uint16_t *tags, unsigned int size)
 {
 	unsigned int j = hash_obj(&obj->oid, size);
 
-	while (hash[j]) {
+	while (tags[j]) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
 	hash[j] = obj;
+	tags[j] = obj_hash_tag(&obj->oid);
 }
 
 /*
@@ -92,30 +106,47 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid)
 {
+	struct parsed_object_pool *o = r->parsed_objects;
 	unsigned int i, first;
-	struct object *obj;
+	uint16_t tag, t;
 
-	if (!r->parsed_objects->obj_hash)
+	if (!o->obj_hash)
 		return NULL;
 
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
-	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
-		if (oideq(oid, &obj->oid))
+	tag = obj_hash_tag(oid);
+	first = i = hash_obj(oid, o->obj_hash_size);
+	while ((t = o->obj_hash_tags[i])) {
+		if (t == tag && oideq(oid, &o->obj_hash[i]->oid))
 			break;
 		i++;
-		if (i == r->parsed_objects->obj_hash_size)
+		if (i == o->obj_hash_size)
 			i = 0;
 	}
-	if (obj && i != first) {
+	if (!t)
+		return NULL;
+	if (i != first) {
 		/*
 		 * Move object to where we started to look for it so
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		SWAP(r->parsed_objects->obj_hash[i],
-		     r->parsed_objects->obj_hash[first]);
+		SWAP(o->obj_hash[i], o->obj_hash[first]);
+		SWAP(o->obj_hash_tags[i], o->obj_hash_tags[first]);
 	}
-	return obj;
+	return o->obj_hash[first];
+}
+
+void prefetch_object(struct repository *r, const struct object_id *oid)
+{
+	struct parsed_object_pool *o = r->parsed_objects;
+	unsigned int i;
+
+	if (!o->obj_hash)
+		return;
+
+	i = hash_obj(oid, o->obj_hash_size);
+	PREFETCH(&o->obj_hash_tags[i]);
+	PREFETCH(&o->obj_hash[i]);
 }
 
 /*
@@ -132,17 +163,21 @@ static void grow_object_hash(struct repository *r)
 	 */
 	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
 	struct object **new_hash;
+	uint16_t *new_tags;
 
 	CALLOC_ARRAY(new_hash, new_hash_size);
+	CALLOC_ARRAY(new_tags, new_hash_size);
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
 		struct object *obj = r->parsed_objects->obj_hash[i];
 
 		if (!obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(obj, new_hash, new_tags, new_hash_size);
 	}
 	free(r->parsed_objects->obj_hash);
+	free(r->parsed_objects->obj_hash_tags);
 	r->parsed_objects->obj_hash = new_hash;
+	r->parsed_objects->obj_hash_tags = new_tags;
 	r->parsed_objects->obj_hash_size = new_hash_size;
 }
 
@@ -158,6 +193,7 @@ void *create_object(struct repository *r, const struct object_id *oid, void *o)
 		grow_object_hash(r);
 
 	insert_obj_hash(obj, r->parsed_objects->obj_hash,
+			r->parsed_objects->obj_hash_tags,
 			r->parsed_objects->obj_hash_size);
 	r->parsed_objects->nr_objs++;
 	return obj;
@@ -654,6 +690,7 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	}
 
 	FREE_AND_NULL(o->obj_hash);
+	FREE_AND_NULL(o->obj_hash_tags);
 	o->obj_hash_size = 0;
 
 	free_commit_buffer_slab(o->buffer_slab);
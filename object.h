@@ -8,6 +8,8 @@ struct repository;
 
 struct parsed_object_pool {
 	struct object **obj_hash;
+	/* bits of each object name in obj_hash, or 0 for empty slots */
+	uint16_t *obj_hash_tags;
 	int nr_objs, obj_hash_size;
 
 	/* TODO: migrate alloc_states to mem-pool? */
@@ -65,6 +67,7 @@ void object_array_init(struct object_array *array);
  * revision.h:               0---------10         15               23------27
  * fetch-pack.c:             01    67
  * negotiator/default.c:       2--5
+ * negotiator/bitmap.c:        2--5
  * walker.c:                 0-2
  * upload-pack.c:                4       11-----14  16-----19
  * builtin/blame.c:                        12-13
@@ -188,6 +191,14 @@ struct object *get_indexed_object(unsigned int);
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid);
 
+/*
+ * Hint that lookup_object() is about to be called for "oid", so that the
+ * part of the object hash it will probe can be fetched into the cache in
+ * the meantime. Callers that look up a batch of objects can call this a
+ * few objects ahead of the one they are looking up.
+ */
+void prefetch_object(struct repository *r, const struct object_id *oid);
+
 void *create_object(struct repository *r, const struct object_id *oid, void *obj);
 
 void *object_as_type(struct object *obj, enum object_type type, int quiet);
@@ -917,6 +917,39 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
 }
 
+int for_each_bitmapped_commit(struct bitmap_index *bitmap_git,
+			      each_bitmapped_commit_fn fn, void *data)
+{
+	struct object_id oid;
+	MAYBE_UNUSED void *value;
+	int ret;
+
+	if (bitmap_git->table_lookup) {
+		uint32_t i;
+
+		for (i = 0; i < bitmap_git->entry_count; i++) {
+			struct bitmap_lookup_table_triplet triplet;
+
+			if (bitmap_lookup_table_get_triplet(bitmap_git, i, &triplet) < 0)
+				return -1;
+			if (nth_bitmap_object_oid(bitmap_git, &oid, triplet.commit_pos) < 0)
+				return error(_("corrupt bitmap lookup table: commit index %u out of range"),
+					     triplet.commit_pos);
+			ret = fn(&oid, data);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	kh_foreach(bitmap_git->bitmaps, oid, value, {
+		ret = fn(&oid, data);
+		if (ret)
+			return ret;
+	});
+	return 0;
+}
+
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 					   const struct object_id *oid)
 {
@@ -2047,6 +2080,69 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
+struct bitmap_index *prepare_bitmap_haves(struct rev_info *revs)
+{
+	unsigned int i;
+	struct object_list *haves = NULL;
+	struct bitmap_index *bitmap_git;
+
+	CALLOC_ARRAY(bitmap_git, 1);
+	if (open_bitmap(revs->repo, bitmap_git) < 0)
+		goto cleanup;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *object = revs->pending.objects[i].item;
+
+		if (!(object->flags & UNINTERESTING))
+			BUG("prepare_bitmap_haves() given a positive tip");
+
+		if (object->type == OBJ_NONE)
+			object = parse_object(revs->repo, &object->oid);
+
+		while (object && object->type == OBJ_TAG) {
+			object_list_insert(object, &haves);
+			object = parse_object(revs->repo,
+					      get_tagged_oid((struct tag *)object));
+			if (object)
+				object->flags |= UNINTERESTING;
+		}
+
+		if (object)
+			object_list_insert(object, &haves);
+	}
+
+	/*
+	 * Unlike prepare_bitmap_walk(), do not bother if the bitmap covers
+	 * none of the haves, as the walk would then have to visit all of
+	 * their trees by hand.
+	 */
+	if (!haves || !in_bitmapped_pack(bitmap_git, haves))
+		goto cleanup;
+
+	if (load_bitmap(revs->repo, bitmap_git) < 0)
+		goto cleanup;
+
+	object_array_clear(&revs->pending);
+
+	trace2_region_enter("pack-bitmap", "haves/classic", the_repository);
+	revs->ignore_missing_links = 1;
+	bitmap_git->haves = find_objects(bitmap_git, revs, haves, NULL);
+	reset_revision_walk();
+	revs->ignore_missing_links = 0;
+	trace2_region_leave("pack-bitmap", "haves/classic", the_repository);
+
+	if (!bitmap_git->haves)
+		BUG("failed to perform bitmap walk");
+
+	object_list_free(&haves);
+	return bitmap_git;
+
+cleanup:
+	free_bitmap_index(bitmap_git);
+	object_list_free(&haves);
+	return NULL;
+}
+
 /*
  * -1 means "stop trying further objects"; 0 means we may or may not have
  * reused, but you can keep feeding bits.
@@ -82,6 +82,16 @@ int test_bitmap_pseudo_merge_objects(struct repository *r, uint32_t n);
 
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 int filter_provided_objects);
+
+/*
+ * Compute the set of objects reachable from the pending objects in
+ * "revs", which must all be UNINTERESTING, and return a bitmap index
+ * that can be queried with bitmap_has_oid_in_uninteresting(). Missing
+ * objects are silently skipped. Returns NULL if there is no bitmap, or
+ * if it does not cover any of the pending objects.
+ */
+struct bitmap_index *prepare_bitmap_haves(struct rev_info *revs);
+
 void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 					struct bitmapped_pack **packs_out,
 					size_t *packs_nr_out,
@@ -93,6 +103,17 @@ void free_bitmap_index(struct bitmap_index *);
 int bitmap_walk_contains(struct bitmap_index *,
 			 struct bitmap *bitmap, const struct object_id *oid);
 
+/*
+ * Call "fn" with the object id of each commit that has a stored bitmap,
+ * in no particular order. Iteration stops early if "fn" returns a
+ * non-zero value, which is then returned; otherwise returns 0, or -1 if
+ * the bitmap is corrupt.
+ */
+typedef int (*each_bitmapped_commit_fn)(const struct object_id *oid,
+					void *data);
+int for_each_bitmapped_commit(struct bitmap_index *bitmap_git,
+			      each_bitmapped_commit_fn fn, void *data);
+
 /*
  * After a traversal has been performed by prepare_bitmap_walk(), this can be
  * queried to see if a particular object was reachable from any of the
@@ -376,6 +376,8 @@ void close_object_store(struct raw_object_store *o)
 	}
 
 	close_commit_graph(o);
+	close_chunk_cache(&o->line_history);
+	close_chunk_cache(&o->patch_id_cache);
 }
 
 void unlink_pack_path(const char *pack_name, int force_delete)
@@ -0,0 +1,272 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "chunk-cache.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hex.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "patch-id-cache.h"
+#include "patch-ids.h"
+#include "progress.h"
+#include "repository.h"
+#include "revision.h"
+#include "strvec.h"
+#include "trace2.h"
+
+#define PATCH_ID_CACHE_SIGNATURE 0x50494443 /* "PIDC" */
+#define PATCH_ID_CACHE_VERSION 1
+
+#define PATCH_ID_CACHE_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define PATCH_ID_CACHE_CHUNKID_PARENTS   0x50524e54 /* "PRNT" */
+#define PATCH_ID_CACHE_CHUNKID_PATCHIDS  0x50494453 /* "PIDS" */
+
+enum {
+	PATCH_ID_CACHE_OID_LOOKUP,
+	PATCH_ID_CACHE_PARENTS,
+	/* the full patch ID, then the header-only one, for each commit */
+	PATCH_ID_CACHE_PATCH_IDS,
+};
+
+static int write_patch_id_cache_oid_lookup(struct hashfile *f, void *data);
+static int write_patch_id_cache_parents(struct hashfile *f, void *data);
+static int write_patch_id_cache_patch_ids(struct hashfile *f, void *data);
+
+static const struct chunk_cache_format patch_id_cache_format = {
+	.filename = "patch-ids",
+	.desc = "patch-id cache",
+	.signature = PATCH_ID_CACHE_SIGNATURE,
+	.version = PATCH_ID_CACHE_VERSION,
+	.chunks = {
+		[PATCH_ID_CACHE_OID_LOOKUP] = {
+			.id = PATCH_ID_CACHE_CHUNKID_OIDLOOKUP,
+			.desc = "oid lookup",
+			.oids = 1,
+			.per_key = 1,
+			.write = write_patch_id_cache_oid_lookup,
+		},
+		[PATCH_ID_CACHE_PARENTS] = {
+			.id = PATCH_ID_CACHE_CHUNKID_PARENTS,
+			.desc = "parent",
+			.oids = 1,
+			.per_key = 1,
+			.write = write_patch_id_cache_parents,
+		},
+		[PATCH_ID_CACHE_PATCH_IDS] = {
+			.id = PATCH_ID_CACHE_CHUNKID_PATCHIDS,
+			.desc = "patch ID",
+			.oids = 2,
+			.per_key = 1,
+			.write = write_patch_id_cache_patch_ids,
+		},
+	},
+	.nr_chunks = 3,
+};
+
+static struct chunk_cache *prepare_patch_id_cache(struct repository *r)
+{
+	return prepare_chunk_cache(r, &patch_id_cache_format,
+				   &r->objects->patch_id_cache);
+}
+
+static int patch_id_cache_find(struct chunk_cache *pc,
+			       const struct object_id *commit_oid,
+			       const struct object_id *parent_oid,
+			       uint32_t *pos)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+
+	if (!chunk_cache_find(pc, commit_oid->hash, rawsz, pos))
+		return 0;
+	return !memcmp(chunk_cache_record(pc, PATCH_ID_CACHE_PARENTS, *pos),
+		       parent_oid->hash, rawsz);
+}
+
+static void patch_id_cache_get(struct chunk_cache *pc, uint32_t pos,
+			       int diff_header_only, struct object_id *patch_id)
+{
+	oidread(patch_id, chunk_cache_record(pc, PATCH_ID_CACHE_PATCH_IDS, pos) +
+		(diff_header_only ? the_hash_algo->rawsz : 0),
+		the_repository->hash_algo);
+}
+
+static const struct object_id *parent_oid(struct commit *commit)
+{
+	return commit->parents ? &commit->parents->item->object.oid :
+		null_oid();
+}
+
+int patch_id_cache_lookup(struct repository *r, struct commit *commit,
+			  int diff_header_only, struct object_id *patch_id)
+{
+	struct chunk_cache *pc;
+	uint32_t pos;
+
+	if (commit->parents && commit->parents->next)
+		return 0;
+	pc = prepare_patch_id_cache(r);
+	if (!pc || !patch_id_cache_find(pc, &commit->object.oid,
+					parent_oid(commit), &pos))
+		return 0;
+
+	trace2_counter_add(TRACE2_COUNTER_ID_PATCH_ID_CACHE_HITS, 1);
+	patch_id_cache_get(pc, pos, diff_header_only, patch_id);
+	return 1;
+}
+
+struct patch_id_cache_entry {
+	struct object_id commit;
+	struct object_id parent;
+	struct object_id patch_id;
+	struct object_id header_patch_id;
+};
+
+struct write_patch_id_cache_context {
+	struct repository *r;
+	struct chunk_cache *existing;
+	struct patch_ids ids;
+
+	struct patch_id_cache_entry *entries;
+	size_t entries_nr, entries_alloc;
+
+	struct progress *progress;
+	uint64_t reused, computed;
+};
+
+static void add_commit(struct write_patch_id_cache_context *ctx,
+		       struct commit *c)
+{
+	struct patch_id_cache_entry *e;
+	uint32_t pos;
+
+	ALLOC_GROW(ctx->entries, ctx->entries_nr + 1, ctx->entries_alloc);
+	e = &ctx->entries[ctx->entries_nr];
+	oidcpy(&e->commit, &c->object.oid);
+	oidcpy(&e->parent, parent_oid(c));
+
+	if (ctx->existing &&
+	    patch_id_cache_find(ctx->existing, &e->commit, &e->parent, &pos)) {
+		patch_id_cache_get(ctx->existing, pos, 0, &e->patch_id);
+		patch_id_cache_get(ctx->existing, pos, 1, &e->header_patch_id);
+		ctx->reused++;
+	} else if (!commit_patch_id(c, &ctx->ids.diffopts, &e->patch_id, 0) &&
+		   !commit_patch_id(c, &ctx->ids.diffopts,
+				    &e->header_patch_id, 1)) {
+		ctx->computed++;
+	} else {
+		/* leave it to the callers of patch-ids.c to report */
+		return;
+	}
+	ctx->entries_nr++;
+}
+
+static int patch_id_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct patch_id_cache_entry *a = va;
+	const struct patch_id_cache_entry *b = vb;
+
+	return oidcmp(&a->commit, &b->commit);
+}
+
+static int write_patch_id_cache_oid_lookup(struct hashfile *f, void *data)
+{
+	struct write_patch_id_cache_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->entries_nr; i++)
+		hashwrite(f, ctx->entries[i].commit.hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static int write_patch_id_cache_parents(struct hashfile *f, void *data)
+{
+	struct write_patch_id_cache_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->entries_nr; i++)
+		hashwrite(f, ctx->entries[i].parent.hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static int write_patch_id_cache_patch_ids(struct hashfile *f, void *data)
+{
+	struct write_patch_id_cache_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->entries_nr; i++) {
+		hashwrite(f, ctx->entries[i].patch_id.hash,
+			  the_hash_algo->rawsz);
+		hashwrite(f, ctx->entries[i].header_patch_id.hash,
+			  the_hash_algo->rawsz);
+	}
+	return 0;
+}
+
+static int write_patch_id_cache_file(struct write_patch_id_cache_context *ctx)
+{
+	uint32_t counts[256] = { 0 };
+	size_t chunk_nr[] = {
+		[PATCH_ID_CACHE_OID_LOOKUP] = ctx->entries_nr,
+		[PATCH_ID_CACHE_PARENTS] = ctx->entries_nr,
+		[PATCH_ID_CACHE_PATCH_IDS] = ctx->entries_nr,
+	};
+	size_t i;
+
+	for (i = 0; i < ctx->entries_nr; i++)
+		counts[ctx->entries[i].commit.hash[0]]++;
+	return write_chunk_cache(ctx->r, &patch_id_cache_format,
+				 &ctx->r->objects->patch_id_cache,
+				 counts, chunk_nr, ctx);
+}
+
+int write_patch_id_cache(struct repository *r,
+			 enum patch_id_cache_write_flags flags)
+{
+	struct write_patch_id_cache_context ctx = {
+		.r = r,
+	};
+	struct rev_info revs;
+	struct strvec args = STRVEC_INIT;
+	struct commit *c;
+	uint64_t nr_commits = 0;
+	int ret;
+
+	trace2_region_enter("patch-id-cache", "write", r);
+
+	ctx.existing = prepare_patch_id_cache(r);
+	init_patch_ids(r, &ctx.ids);
+
+	repo_init_revisions(r, &revs, NULL);
+	strvec_pushl(&args, "patch-id-cache", "--all", "--no-merges", NULL);
+	setup_revisions(args.nr, args.v, &revs, NULL);
+	if (prepare_revision_walk(&revs)) {
+		ret = error(_("revision walk setup failed"));
+		goto cleanup;
+	}
+
+	if (flags & PATCH_ID_CACHE_WRITE_PROGRESS)
+		ctx.progress = start_delayed_progress(_("Computing patch IDs"), 0);
+	while ((c = get_revision(&revs))) {
+		display_progress(ctx.progress, ++nr_commits);
+		add_commit(&ctx, c);
+	}
+	stop_progress(&ctx.progress);
+
+	QSORT(ctx.entries, ctx.entries_nr, patch_id_cache_entry_cmp);
+
+	trace2_data_intmax("patch-id-cache", r, "commits", ctx.entries_nr);
+	trace2_data_intmax("patch-id-cache", r, "reused", ctx.reused);
+	trace2_data_intmax("patch-id-cache", r, "computed", ctx.computed);
+
+	ret = write_patch_id_cache_file(&ctx);
+
+cleanup:
+	trace2_region_leave("patch-id-cache", "write", r);
+	free(ctx.entries);
+	free_patch_ids(&ctx.ids);
+	release_revisions(&revs);
+	strvec_clear(&args);
+	return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef PATCH_ID_CACHE_H
+#define PATCH_ID_CACHE_H
+
+struct commit;
+struct object_id;
+struct repository;
+
+/*
+ * The patch-id cache records, for commits with at most one parent, the
+ * patch IDs that patch-ids.c computes for them: the full one, and the
+ * one that only covers the file headers of the diff, which patch-ids.c
+ * uses to hash commits. Together with each commit, it records the
+ * parent the diff was taken against, so that a commit whose parents
+ * were rewritten (e.g. by grafts) is not answered from the cache.
+ *
+ * The cache only applies to the diff options set up by init_patch_ids();
+ * callers that limit the diff with a pathspec compute the IDs themselves.
+ */
+
+/*
+ * Look up the patch ID of 'commit' in the patch-id cache of 'r'. The
+ * header-only patch ID is returned if 'diff_header_only' is set.
+ *
+ * Returns 1 and fills 'patch_id' if the cache has the answer, and 0 if
+ * the caller has to compute it.
+ */
+int patch_id_cache_lookup(struct repository *r, struct commit *commit,
+			  int diff_header_only, struct object_id *patch_id);
+
+enum patch_id_cache_write_flags {
+	PATCH_ID_CACHE_WRITE_PROGRESS = (1 << 0),
+};
+
+/*
+ * Write the patch-id cache for all commits reachable from refs in 'r'.
+ * Patch IDs already present in an existing cache are reused, so only
+ * commits introduced since the last write are diffed.
+ */
+int write_patch_id_cache(struct repository *r,
+			 enum patch_id_cache_write_flags flags);
+
+#endif
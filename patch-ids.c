@@ -3,6 +3,7 @@
 #include "commit.h"
 #include "hash.h"
 #include "hex.h"
+#include "patch-id-cache.h"
 #include "patch-ids.h"
 
 static int patch_id_defined(struct commit *commit)
@@ -26,6 +27,20 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only);
 }
 
+/*
+ * Like commit_patch_id(), but read the patch ID from the patch-id cache
+ * when it applies to the options in use.
+ */
+static int get_patch_id(struct commit *commit, struct patch_ids *ids,
+			struct object_id *oid, int diff_header_only)
+{
+	if (!ids->diffopts.pathspec.nr &&
+	    patch_id_cache_lookup(ids->diffopts.repo, commit,
+				  diff_header_only, oid))
+		return 0;
+	return commit_patch_id(commit, &ids->diffopts, oid, diff_header_only);
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -42,18 +57,18 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *keydata UNUSED)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a, *b;
 
 	a = container_of(eptr, struct patch_id, ent);
 	b = container_of(entry_or_key, struct patch_id, ent);
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0))
+	    get_patch_id(a->commit, ids, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0))
+	    get_patch_id(b->commit, ids, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
@@ -66,7 +81,7 @@ int init_patch_ids(struct repository *r, struct patch_ids *ids)
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
 	return 0;
 }
 
@@ -83,7 +98,7 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1))
+	if (get_patch_id(commit, ids, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(&patch->ent, oidhash(&header_only_patch_id));
@@ -673,10 +673,59 @@ enum packet_read_status packet_reader_peek(struct packet_reader *reader)
 	return reader->status;
 }
 
+/*
+ * How much a buffered packet_writer gathers before writing it out. This
+ * is large enough to make the cost of write(2) negligible for a stream
+ * of short packets like a ref advertisement.
+ */
+#define PACKET_WRITER_BUFFER_SIZE (64 * 1024)
+
 void packet_writer_init(struct packet_writer *writer, int dest_fd)
 {
 	writer->dest_fd = dest_fd;
 	writer->use_sideband = 0;
+	writer->buffered = 0;
+	strbuf_init(&writer->buf, 0);
+	writer->copy = NULL;
+}
+
+void packet_writer_init_buffered(struct packet_writer *writer, int dest_fd)
+{
+	packet_writer_init(writer, dest_fd);
+	writer->buffered = 1;
+	strbuf_grow(&writer->buf, PACKET_WRITER_BUFFER_SIZE);
+}
+
+void packet_writer_send(struct packet_writer *writer)
+{
+	if (!writer->buf.len)
+		return;
+	if (write_in_full(writer->dest_fd, writer->buf.buf, writer->buf.len) < 0) {
+		check_pipe(errno);
+		die_errno(_("packet write failed"));
+	}
+	if (writer->copy)
+		strbuf_addbuf(writer->copy, &writer->buf);
+	strbuf_reset(&writer->buf);
+}
+
+void packet_writer_release(struct packet_writer *writer)
+{
+	packet_writer_send(writer);
+	strbuf_release(&writer->buf);
+	writer->buffered = 0;
+}
+
+static void packet_writer_fmt(struct packet_writer *writer, const char *prefix,
+			      const char *fmt, va_list args)
+{
+	if (!writer->buffered) {
+		packet_write_fmt_1(writer->dest_fd, 0, prefix, fmt, args);
+		return;
+	}
+	format_packet(&writer->buf, prefix, fmt, args);
+	if (writer->buf.len >= PACKET_WRITER_BUFFER_SIZE)
+		packet_writer_send(writer);
 }
 
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
@@ -684,8 +733,7 @@ void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\001" : "", fmt, args);
+	packet_writer_fmt(writer, writer->use_sideband ? "\001" : "", fmt, args);
 	va_end(args);
 }
 
@@ -694,17 +742,29 @@ void packet_writer_error(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\003" : "ERR ", fmt, args);
+	packet_writer_fmt(writer, writer->use_sideband ? "\003" : "ERR ", fmt, args);
 	va_end(args);
+	/* the other side needs to see an error right away */
+	if (writer->buffered)
+		packet_writer_send(writer);
 }
 
 void packet_writer_delim(struct packet_writer *writer)
 {
-	packet_delim(writer->dest_fd);
+	if (!writer->buffered) {
+		packet_delim(writer->dest_fd);
+		return;
+	}
+	packet_buf_delim(&writer->buf);
+	packet_writer_send(writer);
 }
 
 void packet_writer_flush(struct packet_writer *writer)
 {
-	packet_flush(writer->dest_fd);
+	if (!writer->buffered) {
+		packet_flush(writer->dest_fd);
+		return;
+	}
+	packet_buf_flush(&writer->buf);
+	packet_writer_send(writer);
 }
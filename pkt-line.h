@@ -237,10 +237,29 @@ extern char packet_buffer[LARGE_PACKET_MAX];
 struct packet_writer {
 	int dest_fd;
 	unsigned use_sideband : 1;
+	unsigned buffered : 1;
+	/* packets that have not been written yet */
+	struct strbuf buf;
+	/* if set, a buffered writer also appends what it writes here */
+	struct strbuf *copy;
 };
 
 void packet_writer_init(struct packet_writer *writer, int dest_fd);
 
+/*
+ * Like packet_writer_init(), but gather packets in memory and write them
+ * with as few write(2) calls as possible. Pending packets go out when a
+ * flush or delim packet is written, when enough of them have piled up,
+ * and on packet_writer_send(). Callers that write to 'dest_fd' by other
+ * means must call packet_writer_send() before doing so.
+ *
+ * packet_writer_release() sends pending packets, frees the buffer, and
+ * makes the writer write each packet as it comes again.
+ */
+void packet_writer_init_buffered(struct packet_writer *writer, int dest_fd);
+void packet_writer_send(struct packet_writer *writer);
+void packet_writer_release(struct packet_writer *writer);
+
 /* These functions die upon failure. */
 __attribute__((format (printf, 2, 3)))
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...);
@@ -1428,6 +1428,86 @@ static void free_decoration_options(const struct decoration_options *opts)
 	free(opts->tag);
 }
 
+/*
+ * The placeholders that are used the most, which a compiled format
+ * calls directly instead of going through format_commit_one().
+ */
+static size_t format_commit_atom(struct strbuf *sb, /* in UTF-8 */
+				 const char *placeholder,
+				 struct format_commit_context *c)
+{
+	const struct commit *commit = c->commit;
+	struct commit_list *p;
+
+	if (!commit->object.parsed)
+		parse_object(the_repository, &commit->object.oid);
+
+	switch (placeholder[0]) {
+	case 'H':		/* commit hash */
+		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_COMMIT));
+		strbuf_addstr(sb, oid_to_hex(&commit->object.oid));
+		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_RESET));
+		return 1;
+	case 'h':		/* abbreviated commit hash */
+		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_COMMIT));
+		strbuf_add_unique_abbrev(sb, &commit->object.oid,
+					 c->pretty_ctx->abbrev);
+		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_RESET));
+		return 1;
+	case 'T':		/* tree hash */
+		strbuf_addstr(sb, oid_to_hex(get_commit_tree_oid(commit)));
+		return 1;
+	case 't':		/* abbreviated tree hash */
+		strbuf_add_unique_abbrev(sb,
+					 get_commit_tree_oid(commit),
+					 c->pretty_ctx->abbrev);
+		return 1;
+	case 'P':		/* parent hashes */
+		for (p = commit->parents; p; p = p->next) {
+			if (p != commit->parents)
+				strbuf_addch(sb, ' ');
+			strbuf_addstr(sb, oid_to_hex(&p->item->object.oid));
+		}
+		return 1;
+	case 'p':		/* abbreviated parent hashes */
+		for (p = commit->parents; p; p = p->next) {
+			if (p != commit->parents)
+				strbuf_addch(sb, ' ');
+			strbuf_add_unique_abbrev(sb, &p->item->object.oid,
+						 c->pretty_ctx->abbrev);
+		}
+		return 1;
+	}
+
+	if (!c->commit_header_parsed) {
+		c->message = repo_logmsg_reencode(c->repository, commit,
+						  &c->commit_encoding, "UTF-8");
+		parse_commit_header(c);
+	}
+
+	switch (placeholder[0]) {
+	case 'a':	/* author ... */
+		return format_person_part(sb, placeholder[1],
+				   c->message + c->author.off, c->author.len,
+				   c->pretty_ctx->date_mode);
+	case 'c':	/* committer ... */
+		return format_person_part(sb, placeholder[1],
+				   c->message + c->committer.off, c->committer.len,
+				   c->pretty_ctx->date_mode);
+	}
+
+	if (!c->commit_message_parsed)
+		parse_commit_message(c);
+
+	switch (placeholder[0]) {
+	case 's':	/* subject */
+		format_subject(sb, c->message + c->subject_off, " ");
+		return 1;
+	}
+
+	return 0;
+}
+
 static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 				const char *placeholder,
 				void *context)
@@ -1435,7 +1515,6 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 	struct format_commit_context *c = context;
 	const struct commit *commit = c->commit;
 	const char *msg = c->message;
-	struct commit_list *p;
 	const char *arg, *eol;
 	size_t res;
 	char **slot;
@@ -1543,40 +1622,13 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 		parse_object(the_repository, &commit->object.oid);
 
 	switch (placeholder[0]) {
-	case 'H':		/* commit hash */
-		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_COMMIT));
-		strbuf_addstr(sb, oid_to_hex(&commit->object.oid));
-		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_RESET));
-		return 1;
-	case 'h':		/* abbreviated commit hash */
-		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_COMMIT));
-		strbuf_add_unique_abbrev(sb, &commit->object.oid,
-					 c->pretty_ctx->abbrev);
-		strbuf_addstr(sb, diff_get_color(c->auto_color, DIFF_RESET));
-		return 1;
-	case 'T':		/* tree hash */
-		strbuf_addstr(sb, oid_to_hex(get_commit_tree_oid(commit)));
-		return 1;
-	case 't':		/* abbreviated tree hash */
-		strbuf_add_unique_abbrev(sb,
-					 get_commit_tree_oid(commit),
-					 c->pretty_ctx->abbrev);
-		return 1;
-	case 'P':		/* parent hashes */
-		for (p = commit->parents; p; p = p->next) {
-			if (p != commit->parents)
-				strbuf_addch(sb, ' ');
-			strbuf_addstr(sb, oid_to_hex(&p->item->object.oid));
-		}
-		return 1;
-	case 'p':		/* abbreviated parent hashes */
-		for (p = commit->parents; p; p = p->next) {
-			if (p != commit->parents)
-				strbuf_addch(sb, ' ');
-			strbuf_add_unique_abbrev(sb, &p->item->object.oid,
-						 c->pretty_ctx->abbrev);
-		}
-		return 1;
+	case 'H':
+	case 'h':
+	case 'T':
+	case 't':
+	case 'P':
+	case 'p':
+		return format_commit_atom(sb, placeholder, c);
 	case 'm':		/* left/right/bottom */
 		strbuf_addstr(sb, get_revision_mark(NULL, commit));
 		return 1;
@@ -1715,14 +1767,9 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 	}
 
 	switch (placeholder[0]) {
-	case 'a':	/* author ... */
-		return format_person_part(sb, placeholder[1],
-				   msg + c->author.off, c->author.len,
-				   c->pretty_ctx->date_mode);
-	case 'c':	/* committer ... */
-		return format_person_part(sb, placeholder[1],
-				   msg + c->committer.off, c->committer.len,
-				   c->pretty_ctx->date_mode);
+	case 'a':
+	case 'c':
+		return format_commit_atom(sb, placeholder, c);
 	case 'e':	/* encoding */
 		if (c->commit_encoding)
 			strbuf_addstr(sb, c->commit_encoding);
@@ -1738,9 +1785,8 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 		parse_commit_message(c);
 
 	switch (placeholder[0]) {
-	case 's':	/* subject */
-		format_subject(sb, msg + c->subject_off, " ");
-		return 1;
+	case 's':
+		return format_commit_atom(sb, placeholder, c);
 	case 'f':	/* sanitized subject */
 		eol = strchrnul(msg + c->subject_off, '\n');
 		format_sanitized_subject(sb, msg + c->subject_off, eol - (msg + c->subject_off));
@@ -1881,31 +1927,48 @@ static size_t format_and_pad_commit(struct strbuf *sb, /* in UTF-8 */
 	return total_consumed;
 }
 
-static size_t format_commit_item(struct strbuf *sb, /* in UTF-8 */
-				 const char *placeholder,
-				 struct format_commit_context *context)
-{
-	size_t consumed, orig_len;
-	enum {
-		NO_MAGIC,
-		ADD_LF_BEFORE_NON_EMPTY,
-		DEL_LF_BEFORE_EMPTY,
-		ADD_SP_BEFORE_NON_EMPTY
-	} magic = NO_MAGIC;
+enum format_magic {
+	NO_MAGIC,
+	ADD_LF_BEFORE_NON_EMPTY,
+	DEL_LF_BEFORE_EMPTY,
+	ADD_SP_BEFORE_NON_EMPTY
+};
 
+static enum format_magic parse_format_magic(const char *placeholder)
+{
 	switch (placeholder[0]) {
 	case '-':
-		magic = DEL_LF_BEFORE_EMPTY;
-		break;
+		return DEL_LF_BEFORE_EMPTY;
 	case '+':
-		magic = ADD_LF_BEFORE_NON_EMPTY;
-		break;
+		return ADD_LF_BEFORE_NON_EMPTY;
 	case ' ':
-		magic = ADD_SP_BEFORE_NON_EMPTY;
-		break;
+		return ADD_SP_BEFORE_NON_EMPTY;
 	default:
-		break;
+		return NO_MAGIC;
+	}
+}
+
+static void apply_format_magic(struct strbuf *sb, size_t orig_len,
+			       enum format_magic magic)
+{
+	if ((orig_len == sb->len) && magic == DEL_LF_BEFORE_EMPTY) {
+		while (sb->len && sb->buf[sb->len - 1] == '\n')
+			strbuf_setlen(sb, sb->len - 1);
+	} else if (orig_len != sb->len) {
+		if (magic == ADD_LF_BEFORE_NON_EMPTY)
+			strbuf_insertstr(sb, orig_len, "\n");
+		else if (magic == ADD_SP_BEFORE_NON_EMPTY)
+			strbuf_insertstr(sb, orig_len, " ");
 	}
+}
+
+static size_t format_commit_item(struct strbuf *sb, /* in UTF-8 */
+				 const char *placeholder,
+				 struct format_commit_context *context)
+{
+	size_t consumed, orig_len;
+	enum format_magic magic = parse_format_magic(placeholder);
+
 	if (magic != NO_MAGIC) {
 		placeholder++;
 
@@ -1929,47 +1992,193 @@ static size_t format_commit_item(struct strbuf *sb, /* in UTF-8 */
 	if (magic == NO_MAGIC)
 		return consumed;
 
-	if ((orig_len == sb->len) && magic == DEL_LF_BEFORE_EMPTY) {
-		while (sb->len && sb->buf[sb->len - 1] == '\n')
-			strbuf_setlen(sb, sb->len - 1);
-	} else if (orig_len != sb->len) {
-		if (magic == ADD_LF_BEFORE_NON_EMPTY)
-			strbuf_insertstr(sb, orig_len, "\n");
-		else if (magic == ADD_SP_BEFORE_NON_EMPTY)
-			strbuf_insertstr(sb, orig_len, " ");
-	}
+	apply_format_magic(sb, orig_len, magic);
 	return consumed + 1;
 }
 
-void userformat_find_requirements(const char *fmt, struct userformat_want *w)
+/*
+ * A format string split at its placeholders, so that the work of
+ * scanning it is done once instead of for every commit.
+ */
+struct format_op {
+	size_t start;		/* offset of the '%' */
+	size_t end;		/* where the placeholder should end, or 0 */
+	enum format_magic magic;
+	char atom;		/* '%' for "%%", or for format_commit_atom() */
+};
+
+struct compiled_format {
+	char *fmt;
+	size_t len;
+	struct format_op *op;
+	size_t nr, alloc;
+	struct userformat_want want;
+};
+
+static struct compiled_format compiled_format;
+
+static const struct compiled_format *compile_format(const char *fmt)
 {
-	if (!fmt) {
-		if (!user_format)
-			return;
-		fmt = user_format;
-	}
-	while ((fmt = strchr(fmt, '%'))) {
-		fmt++;
-		if (skip_prefix(fmt, "%", &fmt))
+	struct compiled_format *cf = &compiled_format;
+	const char *p;
+
+	if (cf->fmt && !strcmp(cf->fmt, fmt))
+		return cf;
+
+	free(cf->fmt);
+	free(cf->op);
+	memset(cf, 0, sizeof(*cf));
+	cf->fmt = xstrdup(fmt);
+	cf->len = strlen(fmt);
+
+	for (p = cf->fmt; (p = strchr(p, '%')); p++) {
+		const char *placeholder = p + 1;
+		struct format_op *op;
+
+		ALLOC_GROW(cf->op, cf->nr + 1, cf->alloc);
+		op = &cf->op[cf->nr++];
+		memset(op, 0, sizeof(*op));
+		op->start = p - cf->fmt;
+
+		if (*placeholder == '%') {
+			op->atom = '%';
+			op->end = op->start + 2;
+			p++;
 			continue;
+		}
 
-		if (*fmt == '+' || *fmt == '-' || *fmt == ' ')
-			fmt++;
+		op->magic = parse_format_magic(placeholder);
+		if (op->magic != NO_MAGIC)
+			placeholder++;
 
-		switch (*fmt) {
+		switch (*placeholder) {
 		case 'N':
-			w->notes = 1;
+			cf->want.notes = 1;
 			break;
 		case 'S':
-			w->source = 1;
+			cf->want.source = 1;
 			break;
 		case 'd':
 		case 'D':
-			w->decorate = 1;
+			cf->want.decorate = 1;
 			break;
 		case '(':
-			if (starts_with(fmt + 1, "decorate"))
-				w->decorate = 1;
+			if (starts_with(placeholder + 1, "decorate"))
+				cf->want.decorate = 1;
+			break;
+		case 'H':
+		case 'h':
+		case 'T':
+		case 't':
+		case 'P':
+		case 'p':
+		case 's':
+			op->atom = *placeholder;
+			op->end = placeholder + 1 - cf->fmt;
+			break;
+		case 'a':
+		case 'c':
+			if (!placeholder[1])
+				break;
+			op->atom = *placeholder;
+			op->end = placeholder + 2 - cf->fmt;
+			break;
+		}
+	}
+	return cf;
+}
+
+void userformat_find_requirements(const char *fmt, struct userformat_want *w)
+{
+	const struct compiled_format *cf;
+
+	if (!fmt) {
+		if (!user_format)
+			return;
+		fmt = user_format;
+	}
+	cf = compile_format(fmt);
+	w->notes |= cf->want.notes;
+	w->source |= cf->want.source;
+	w->decorate |= cf->want.decorate;
+}
+
+static void expand_commit_format(struct strbuf *sb, const char *format,
+				 struct format_commit_context *context)
+{
+	while (strbuf_expand_step(sb, &format)) {
+		size_t len;
+
+		if (skip_prefix(format, "%", &format))
+			strbuf_addch(sb, '%');
+		else if ((len = format_commit_item(sb, format, context)))
+			format += len;
+		else
+			strbuf_addch(sb, '%');
+	}
+}
+
+static size_t run_format_op(struct strbuf *sb, const char *placeholder,
+			    const struct format_op *op,
+			    struct format_commit_context *context)
+{
+	size_t consumed, orig_len = sb->len;
+
+	if (!op->atom || context->flush_type != no_flush)
+		return format_commit_item(sb, placeholder, context);
+	if (op->magic == NO_MAGIC)
+		return format_commit_atom(sb, placeholder, context);
+
+	consumed = format_commit_atom(sb, placeholder + 1, context);
+	apply_format_magic(sb, orig_len, op->magic);
+	return consumed + 1;
+}
+
+/*
+ * Produce the same output as expand_commit_format() would for the
+ * compiled string. A placeholder may end somewhere else than where we
+ * expected it to (e.g. "%aX" is not a placeholder, and "%<(10)" eats
+ * the "%C..." that follows it), in which case we skip the operations
+ * it swallowed, or interpret the rest of the string if we ended up in
+ * the middle of a "%%".
+ */
+static void run_compiled_format(struct strbuf *sb,
+				const struct compiled_format *cf,
+				struct format_commit_context *context)
+{
+	const char *fmt = cf->fmt;
+	size_t pos = 0, i = 0;
+
+	for (;;) {
+		size_t next = i < cf->nr ? cf->op[i].start : cf->len;
+		const struct format_op *op;
+		size_t consumed;
+
+		strbuf_add(sb, fmt + pos, next - pos);
+		if (i == cf->nr)
+			break;
+
+		op = &cf->op[i++];
+		pos = op->start + 1;
+		if (op->atom == '%') {
+			strbuf_addch(sb, '%');
+			pos++;
+			continue;
+		}
+
+		consumed = run_format_op(sb, fmt + pos, op, context);
+		if (consumed)
+			pos += consumed;
+		else
+			strbuf_addch(sb, '%');
+		if (pos == op->end && (i == cf->nr || cf->op[i].start >= pos))
+			continue;
+
+		while (i < cf->nr && cf->op[i].start < pos)
+			i++;
+		next = i < cf->nr ? cf->op[i].start : cf->len;
+		if (memchr(fmt + pos, '%', next - pos)) {
+			expand_commit_format(sb, fmt + pos, context);
 			break;
 		}
 	}
@@ -1989,16 +2198,7 @@ void repo_format_commit_message(struct repository *r,
 	const char *output_enc = pretty_ctx->output_encoding;
 	const char *utf8 = "UTF-8";
 
-	while (strbuf_expand_step(sb, &format)) {
-		size_t len;
-
-		if (skip_prefix(format, "%", &format))
-			strbuf_addch(sb, '%');
-		else if ((len = format_commit_item(sb, format, &context)))
-			format += len;
-		else
-			strbuf_addch(sb, '%');
-	}
+	run_compiled_format(sb, compile_format(format), &context);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	/*
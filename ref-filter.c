@@ -14,6 +14,7 @@
 #include "object-store-ll.h"
 #include "oid-array.h"
 #include "repository.h"
+#include "replace-object.h"
 #include "commit.h"
 #include "mailmap.h"
 #include "ident.h"
@@ -31,6 +32,9 @@
 #include "commit-reach.h"
 #include "worktree.h"
 #include "hashmap.h"
+#include "prio-queue.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -90,6 +94,9 @@ static struct expand_data {
 	void *content;
 
 	struct object_info info;
+
+	/* The object was already read into the fields above. */
+	unsigned prefetched : 1;
 } oi, oi_deref;
 
 struct ref_to_worktree_entry {
@@ -2281,7 +2288,8 @@ static int get_object(struct ref_array_item *ref, int deref, struct object **obj
 		oi->info.sizep = &oi->size;
 		oi->info.typep = &oi->type;
 	}
-	if (oid_object_info_extended(the_repository, &oi->oid, &oi->info,
+	if (!oi->prefetched &&
+	    oid_object_info_extended(the_repository, &oi->oid, &oi->info,
 				     OBJECT_INFO_LOOKUP_REPLACE))
 		return strbuf_addf_ret(err, -1, _("missing object %s for %s"),
 				       oid_to_hex(&oi->oid), ref->refname);
@@ -2293,6 +2301,7 @@ static int get_object(struct ref_array_item *ref, int deref, struct object **obj
 		if (!*obj) {
 			if (!eaten)
 				free(oi->content);
+			oi->content = NULL;
 			return strbuf_addf_ret(err, -1, _("parse_object_buffer failed on %s for %s"),
 					       oid_to_hex(&oi->oid), ref->refname);
 		}
@@ -2302,6 +2311,7 @@ static int get_object(struct ref_array_item *ref, int deref, struct object **obj
 	grab_common_values(ref->value, deref, oi);
 	if (!eaten)
 		free(oi->content);
+	oi->content = NULL;
 	return 0;
 }
 
@@ -2351,9 +2361,12 @@ static char *get_worktree_path(const struct ref_array_item *ref)
 }
 
 /*
- * Parse the object referred by ref, and grab needed value.
+ * Parse the object referred by ref, and grab needed value. If
+ * "prefetched" is given, the object has already been read into it.
  */
-static int populate_value(struct ref_array_item *ref, struct strbuf *err)
+static int populate_value(struct ref_array_item *ref,
+			  struct expand_data *prefetched,
+			  struct strbuf *err)
 {
 	struct object *obj;
 	int i;
@@ -2542,9 +2555,14 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 		return 0;
 
 
-	oi.oid = ref->objectname;
-	if (get_object(ref, 0, &obj, &oi, err))
-		return -1;
+	if (prefetched) {
+		if (get_object(ref, 0, &obj, prefetched, err))
+			return -1;
+	} else {
+		oi.oid = ref->objectname;
+		if (get_object(ref, 0, &obj, &oi, err))
+			return -1;
+	}
 
 	/*
 	 * If there is no atom that wants to know about tagged
@@ -2571,7 +2589,7 @@ static int get_ref_atom_value(struct ref_array_item *ref, int atom,
 			      struct atom_value **v, struct strbuf *err)
 {
 	if (!ref->value) {
-		if (populate_value(ref, err))
+		if (populate_value(ref, NULL, err))
 			return -1;
 		fill_missing_values(ref->value);
 	}
@@ -2579,6 +2597,164 @@ static int get_ref_atom_value(struct ref_array_item *ref, int atom,
 	return 0;
 }
 
+/*
+ * Below this many refs per thread, starting the threads costs more than
+ * reading the objects on them saves.
+ */
+#define REF_FILTER_THREAD_COST 64
+#define REF_FILTER_MAX_THREADS 32
+/* How many objects may be held in memory before they are parsed. */
+#define REF_FILTER_PREFETCH_BATCH 1024
+
+struct ref_prefetch_thread {
+	pthread_t thread;
+	struct expand_data *data;
+	size_t nr, first, step;
+};
+
+/*
+ * Read the objects of a share of the batch. The object store is
+ * protected by obj_read_lock(), which is released while inflating, and
+ * nothing else is touched, so several of these can run at once.
+ * Objects that cannot be read here (e.g. because they would have to be
+ * fetched from a promisor remote) are left for populate_value() to read
+ * and report on.
+ */
+static void *prefetch_objects(void *arg)
+{
+	struct ref_prefetch_thread *t = arg;
+
+	for (size_t i = t->first; i < t->nr; i += t->step) {
+		struct expand_data *data = &t->data[i];
+
+		if (!oid_object_info_extended(the_repository, &data->oid,
+					      &data->info,
+					      OBJECT_INFO_LOOKUP_REPLACE |
+					      OBJECT_INFO_SKIP_FETCH_OBJECT))
+			data->prefetched = 1;
+	}
+	return NULL;
+}
+
+static int ref_filter_threads(int nr)
+{
+	int threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	threads = nr / REF_FILTER_THREAD_COST;
+	if (threads > online_cpus())
+		threads = online_cpus();
+	if (nr > 1 && threads < 2 &&
+	    git_env_bool("GIT_TEST_REF_FILTER_THREADS", 0))
+		threads = 2;
+	if (threads > REF_FILTER_MAX_THREADS)
+		threads = REF_FILTER_MAX_THREADS;
+	return threads;
+}
+
+static void populate_prefetched(struct ref_array_item *ref,
+				struct expand_data *data)
+{
+	struct strbuf err = STRBUF_INIT;
+
+	if (populate_value(ref, data->prefetched ? data : NULL, &err)) {
+		/* let get_ref_atom_value() try again and report the error */
+		for (int i = 0; i < used_atom_cnt; i++)
+			free((char *)ref->value[i].s);
+		FREE_AND_NULL(ref->value);
+	} else {
+		fill_missing_values(ref->value);
+	}
+	/* in case populate_value() failed before it got to the object */
+	free(data->content);
+	strbuf_release(&err);
+}
+
+/*
+ * Populate the values of the given refs ahead of sorting or formatting
+ * them, reading the objects of a batch of refs on several threads before
+ * parsing them in order on this one. This only matters when the format
+ * or the sort keys need the contents of the objects; otherwise the
+ * values are left to be populated on demand.
+ */
+static void populate_values(struct ref_array_item **items, int nr)
+{
+	struct object_info empty = OBJECT_INFO_INIT;
+	struct ref_prefetch_thread *threads;
+	struct expand_data *data;
+	int nr_threads, todo = 0;
+	int batch = nr < REF_FILTER_PREFETCH_BATCH ? nr : REF_FILTER_PREFETCH_BATCH;
+
+	for (int i = 0; i < nr; i++)
+		if (!items[i]->value)
+			todo++;
+	nr_threads = ref_filter_threads(todo);
+
+	if (need_tagged)
+		oi.info.contentp = &oi.content;
+	if (nr_threads < 2 || !memcmp(&oi.info, &empty, sizeof(empty)))
+		return;
+
+	/* make sure that the threads do not race to set these up */
+	if (replace_refs_enabled(the_repository))
+		prepare_replace_object(the_repository);
+
+	trace2_region_enter("ref-filter", "populate_values/parallel",
+			    the_repository);
+	CALLOC_ARRAY(threads, nr_threads);
+	CALLOC_ARRAY(data, batch);
+	enable_obj_read_lock();
+
+	for (int start = 0; start < nr; start += batch) {
+		int n = nr - start < batch ? nr - start : batch;
+
+		for (int i = 0; i < n; i++) {
+			struct expand_data *d = &data[i];
+
+			memset(d, 0, sizeof(*d));
+			if (items[start + i]->value)
+				continue;
+			oidcpy(&d->oid, &items[start + i]->objectname);
+			if (oi.info.typep || oi.info.contentp)
+				d->info.typep = &d->type;
+			if (oi.info.sizep || oi.info.contentp)
+				d->info.sizep = &d->size;
+			if (oi.info.disk_sizep)
+				d->info.disk_sizep = &d->disk_size;
+			if (oi.info.delta_base_oid)
+				d->info.delta_base_oid = &d->delta_base_oid;
+			if (oi.info.contentp)
+				d->info.contentp = &d->content;
+		}
+
+		for (int t = 0; t < nr_threads; t++) {
+			threads[t].data = data;
+			threads[t].nr = n;
+			threads[t].first = t;
+			threads[t].step = nr_threads;
+			if (pthread_create(&threads[t].thread, NULL,
+					   prefetch_objects, &threads[t]))
+				die(_("unable to create thread for ref-filter"));
+		}
+		for (int t = 0; t < nr_threads; t++)
+			pthread_join(threads[t].thread, NULL);
+
+		for (int i = 0; i < n; i++)
+			if (!items[start + i]->value)
+				populate_prefetched(items[start + i], &data[i]);
+	}
+
+	disable_obj_read_lock();
+	free(data);
+	free(threads);
+	trace2_data_intmax("ref-filter", the_repository,
+			   "populate_values/threads", nr_threads);
+	trace2_region_leave("ref-filter", "populate_values/parallel",
+			    the_repository);
+}
+
 /*
  * Return 1 if the refname matches one of the patterns, otherwise 0.
  * A pattern can be a literal prefix (e.g. a refname "refs/heads/master"
@@ -3251,7 +3427,8 @@ void filter_and_format_refs(struct ref_filter *filter, unsigned int type,
 		filter_refs(&array, filter, type);
 		filter_ahead_behind(the_repository, format, &array);
 		filter_is_base(the_repository, format, &array);
-		ref_array_sort(sorting, &array);
+		ref_array_sort_top(sorting, &array,
+				   format->array_opts.max_count);
 		print_formatted_ref_array(&array, format);
 		ref_array_clear(&array);
 	}
@@ -3288,19 +3465,54 @@ struct ref_sorting {
 	enum ref_sorting_order sort_flags;
 };
 
-static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, struct ref_array_item *b)
+/*
+ * A ref to be sorted, with the values it is sorted by, one for each
+ * element of the ref_sorting list, looked up once before sorting.
+ */
+struct ref_sort_entry {
+	struct ref_array_item *item;
+	struct atom_value **key;
+};
+
+static struct ref_sort_entry *get_sort_entries(struct ref_sorting *sorting,
+					       struct ref_array *array,
+					       struct atom_value ***keys_p)
+{
+	struct ref_sort_entry *entries;
+	struct atom_value **keys;
+	struct ref_sorting *s;
+	struct strbuf err = STRBUF_INIT;
+	size_t levels = 0;
+
+	for (s = sorting; s; s = s->next)
+		levels++;
+	ALLOC_ARRAY(entries, array->nr);
+	ALLOC_ARRAY(keys, st_mult(array->nr, levels));
+
+	for (int i = 0; i < array->nr; i++) {
+		struct ref_sort_entry *e = &entries[i];
+		size_t level = 0;
+
+		e->item = array->items[i];
+		e->key = keys + st_mult(i, levels);
+		for (s = sorting; s; s = s->next)
+			if (get_ref_atom_value(e->item, s->atom,
+					       &e->key[level++], &err))
+				die("%s", err.buf);
+	}
+	strbuf_release(&err);
+	*keys_p = keys;
+	return entries;
+}
+
+static int cmp_ref_sorting(struct ref_sorting *s,
+			   struct ref_array_item *a, struct atom_value *va,
+			   struct ref_array_item *b, struct atom_value *vb)
 {
-	struct atom_value *va, *vb;
 	int cmp;
 	int cmp_detached_head = 0;
 	cmp_type cmp_type = used_atom[s->atom].type;
-	struct strbuf err = STRBUF_INIT;
 
-	if (get_ref_atom_value(a, s->atom, &va, &err))
-		die("%s", err.buf);
-	if (get_ref_atom_value(b, s->atom, &vb, &err))
-		die("%s", err.buf);
-	strbuf_release(&err);
 	if (s->sort_flags & REF_SORTING_DETACHED_HEAD_FIRST &&
 	    ((a->kind | b->kind) & FILTER_REFS_DETACHED_HEAD)) {
 		cmp = compare_detached_head(a, b);
@@ -3346,12 +3558,14 @@ static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, stru
 
 static int compare_refs(const void *a_, const void *b_, void *ref_sorting)
 {
-	struct ref_array_item *a = *((struct ref_array_item **)a_);
-	struct ref_array_item *b = *((struct ref_array_item **)b_);
+	const struct ref_sort_entry *ea = a_, *eb = b_;
+	struct ref_array_item *a = ea->item, *b = eb->item;
 	struct ref_sorting *s;
+	size_t level = 0;
 
-	for (s = ref_sorting; s; s = s->next) {
-		int cmp = cmp_ref_sorting(s, a, b);
+	for (s = ref_sorting; s; s = s->next, level++) {
+		int cmp = cmp_ref_sorting(s, a, ea->key[level],
+					  b, eb->key[level]);
 		if (cmp)
 			return cmp;
 	}
@@ -3361,6 +3575,13 @@ static int compare_refs(const void *a_, const void *b_, void *ref_sorting)
 		strcmp(a->refname, b->refname);
 }
 
+/* The first ref in sort order comes out of the queue last. */
+static int compare_refs_reverse(const void *a, const void *b,
+				void *ref_sorting)
+{
+	return compare_refs(b, a, ref_sorting);
+}
+
 void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting,
 				    unsigned int mask, int on)
 {
@@ -3374,8 +3595,68 @@ void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting,
 
 void ref_array_sort(struct ref_sorting *sorting, struct ref_array *array)
 {
-	if (sorting)
-		QSORT_S(array->items, array->nr, compare_refs, sorting);
+	struct ref_sort_entry *entries;
+	struct atom_value **keys;
+
+	if (!sorting)
+		return;
+	populate_values(array->items, array->nr);
+	if (array->nr < 2)
+		return;
+
+	entries = get_sort_entries(sorting, array, &keys);
+	QSORT_S(entries, array->nr, compare_refs, sorting);
+	for (int i = 0; i < array->nr; i++)
+		array->items[i] = entries[i].item;
+	free(entries);
+	free(keys);
+}
+
+void ref_array_sort_top(struct ref_sorting *sorting, struct ref_array *array,
+			int count)
+{
+	struct prio_queue queue = {
+		.compare = compare_refs_reverse,
+		.cb_data = sorting,
+	};
+	struct ref_sort_entry *entries;
+	struct atom_value **keys;
+
+	if (!sorting || count <= 0 || count >= array->nr) {
+		ref_array_sort(sorting, array);
+		return;
+	}
+	populate_values(array->items, array->nr);
+
+	/*
+	 * Keep the "count" first refs seen so far in a queue whose head
+	 * is the last of them, which any better ref replaces.
+	 */
+	entries = get_sort_entries(sorting, array, &keys);
+	for (int i = 0; i < array->nr; i++) {
+		if (queue.nr < count) {
+			prio_queue_put(&queue, &entries[i]);
+		} else if (compare_refs(&entries[i], prio_queue_peek(&queue),
+					sorting) < 0) {
+			prio_queue_get(&queue);
+			prio_queue_put(&queue, &entries[i]);
+		}
+	}
+
+	for (int i = count; i--; ) {
+		struct ref_sort_entry *e = prio_queue_get(&queue);
+
+		array->items[i] = e->item;
+		e->item = NULL;
+	}
+	for (int i = 0; i < array->nr; i++)
+		if (entries[i].item)
+			free_array_item(entries[i].item);
+	array->nr = count;
+
+	clear_prio_queue(&queue);
+	free(entries);
+	free(keys);
 }
 
 static void append_literal(const char *cp, const char *ep, struct ref_formatting_state *state)
@@ -3454,6 +3735,7 @@ void print_formatted_ref_array(struct ref_array *array, struct ref_format *forma
 	total = format->array_opts.max_count;
 	if (!total || array->nr < total)
 		total = array->nr;
+	populate_values(array->items, total);
 	for (int i = 0; i < total; i++) {
 		strbuf_reset(&err);
 		strbuf_reset(&output);
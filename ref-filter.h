@@ -158,6 +158,12 @@ void ref_array_clear(struct ref_array *array);
 int verify_ref_format(struct ref_format *format);
 /*  Sort the given ref_array as per the ref_sorting provided */
 void ref_array_sort(struct ref_sorting *sort, struct ref_array *array);
+/*
+ * Keep only the first "count" refs of the given ref_array in the order of
+ * the ref_sorting provided, sorted, and free the others
+ */
+void ref_array_sort_top(struct ref_sorting *sort, struct ref_array *array,
+			int count);
 /*  Set REF_SORTING_* sort_flags for all elements of a sorting list */
 void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting, unsigned int mask, int on);
 /*  Based on the given format and quote_style, fill the strbuf */
@@ -48,6 +48,33 @@ static enum mmap_strategy mmap_strategy = MMAP_OK;
 
 struct packed_ref_store;
 
+/*
+ * Version 2 of the `packed-refs` format is a binary format that is
+ * used when `extensions.packedRefsVersion` is set to 2. Readers detect
+ * the format by its signature, so a version 2 file is read regardless
+ * of the extension. All integers are stored in network byte order.
+ *
+ *   - A 12 byte header consisting of the signature "PREF", the format
+ *     version (2) and the format ID of the hash algorithm.
+ *
+ *   - The records, sorted by refname. Every record consists of a flags
+ *     byte, the raw object ID, the raw peeled object ID if the flags
+ *     have `PACKED_REFS_V2_PEELED` set, and the NUL-terminated refname.
+ *     The file is always fully peeled: a reference without a peeled
+ *     value cannot be peeled.
+ *
+ *   - The offset table, which contains one 8 byte offset from the start
+ *     of the file per record. It allows binary searching the records
+ *     without having to scan for the start of a record.
+ *
+ *   - A 16 byte trailer consisting of the number of records and the
+ *     offset of the offset table.
+ */
+#define PACKED_REFS_SIGNATURE 0x50524546 /* "PREF" */
+#define PACKED_REFS_V2_HEADER_SIZE 12
+#define PACKED_REFS_V2_TRAILER_SIZE 16
+#define PACKED_REFS_V2_PEELED 0x1
+
 /*
  * A `snapshot` represents one snapshot of a `packed-refs` file.
  *
@@ -95,6 +122,18 @@ struct snapshot {
 	 */
 	char *buf, *start, *eof;
 
+	/* The size of the memory pointed to by `buf`. */
+	size_t size;
+
+	/*
+	 * The format version of the `packed-refs` file. For version 2,
+	 * `start` and `eof` delimit the records, `offsets` points at the
+	 * offset table and `nr` is the number of records.
+	 */
+	int version;
+	const unsigned char *offsets;
+	size_t nr;
+
 	/*
 	 * What is the peeled state of the `packed-refs` file that
 	 * this snapshot represents? (This is usually determined from
@@ -177,7 +216,7 @@ static void acquire_snapshot(struct snapshot *snapshot)
 static void clear_snapshot_buffer(struct snapshot *snapshot)
 {
 	if (snapshot->mmapped) {
-		if (munmap(snapshot->buf, snapshot->eof - snapshot->buf))
+		if (munmap(snapshot->buf, snapshot->size))
 			die_errno("error ummapping packed-refs file %s",
 				  snapshot->refs->path);
 		snapshot->mmapped = 0;
@@ -185,6 +224,8 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 		free(snapshot->buf);
 	}
 	snapshot->buf = snapshot->start = snapshot->eof = NULL;
+	snapshot->offsets = NULL;
+	snapshot->size = snapshot->nr = 0;
 }
 
 /*
@@ -292,6 +333,66 @@ static NORETURN void die_invalid_line(const char *path,
 
 }
 
+static NORETURN void die_corrupt_v2(const char *path)
+{
+	die("corrupt packed-refs file %s", path);
+}
+
+/*
+ * Return a pointer to the `i`th record of a version 2 snapshot.
+ */
+static const char *v2_record_at(const struct snapshot *snapshot, size_t i)
+{
+	uint64_t offset = get_be64(snapshot->offsets + st_mult(i, 8));
+
+	if (offset < snapshot->start - snapshot->buf ||
+	    offset >= snapshot->eof - snapshot->buf)
+		die_corrupt_v2(snapshot->refs->path);
+
+	return snapshot->buf + offset;
+}
+
+/*
+ * Parse the version 2 record at `rec`. Store its object ID in `oid`
+ * and its peeled value (or the null OID if there is none) in `peeled`,
+ * if they are non-NULL, and a pointer to its refname in `refname`.
+ * Return a pointer to the start of the next record.
+ */
+static const char *parse_v2_record(const struct snapshot *snapshot,
+				   const char *rec, struct object_id *oid,
+				   struct object_id *peeled,
+				   const char **refname)
+{
+	const struct git_hash_algo *algop = snapshot->refs->base.repo->hash_algo;
+	const char *eof = snapshot->eof;
+	const char *p = rec + 1;
+	const char *end;
+
+	if (rec >= eof || eof - p < algop->rawsz + 1)
+		die_corrupt_v2(snapshot->refs->path);
+	if (oid)
+		oidread(oid, (const unsigned char *)p, algop);
+	p += algop->rawsz;
+
+	if (*rec & PACKED_REFS_V2_PEELED) {
+		if (eof - p < algop->rawsz + 1)
+			die_corrupt_v2(snapshot->refs->path);
+		if (peeled)
+			oidread(peeled, (const unsigned char *)p, algop);
+		p += algop->rawsz;
+	} else if (peeled) {
+		oidclr(peeled, algop);
+	}
+
+	end = memchr(p, '\0', eof - p);
+	if (!end)
+		die_corrupt_v2(snapshot->refs->path);
+	if (refname)
+		*refname = p;
+
+	return end + 1;
+}
+
 struct snapshot_record {
 	const char *start;
 	size_t len;
@@ -326,11 +427,20 @@ static int cmp_packed_ref_records(const void *v1, const void *v2,
 static int cmp_record_to_refname(const char *rec, const char *refname,
 				 int start, const struct snapshot *snapshot)
 {
-	const char *r1 = rec + snapshot_hexsz(snapshot) + 1;
+	const char *r1;
 	const char *r2 = refname;
+	char terminator;
+
+	if (snapshot->version == 2) {
+		parse_v2_record(snapshot, rec, NULL, NULL, &r1);
+		terminator = '\0';
+	} else {
+		r1 = rec + snapshot_hexsz(snapshot) + 1;
+		terminator = '\n';
+	}
 
 	while (1) {
-		if (*r1 == '\n')
+		if (*r1 == terminator)
 			return *r2 ? -1 : 0;
 		if (!*r2)
 			return start ? 1 : -1;
@@ -429,6 +539,7 @@ static void sort_snapshot(struct snapshot *snapshot)
 	clear_snapshot_buffer(snapshot);
 	snapshot->buf = snapshot->start = new_buffer;
 	snapshot->eof = new_buffer + len;
+	snapshot->size = len;
 
 cleanup:
 	free(records);
@@ -545,10 +656,92 @@ static int load_contents(struct snapshot *snapshot)
 
 	snapshot->start = snapshot->buf;
 	snapshot->eof = snapshot->buf + size;
+	snapshot->size = size;
 
 	return 1;
 }
 
+/*
+ * Check whether the contents of `snapshot` are in the version 2
+ * format. If so, validate the header and trailer and set up the
+ * record pointers and the offset table. Return 1 if the snapshot is a
+ * version 2 snapshot, 0 otherwise. Die if the file is corrupt.
+ */
+static int parse_v2_snapshot(struct snapshot *snapshot)
+{
+	const unsigned char *buf = (const unsigned char *)snapshot->buf;
+	const struct git_hash_algo *algop = snapshot->refs->base.repo->hash_algo;
+	size_t size = snapshot->size;
+	uint64_t nr, table_offset;
+
+	if (size < 4 || get_be32(buf) != PACKED_REFS_SIGNATURE)
+		return 0;
+
+	if (size < PACKED_REFS_V2_HEADER_SIZE + PACKED_REFS_V2_TRAILER_SIZE)
+		die_corrupt_v2(snapshot->refs->path);
+	if (get_be32(buf + 4) != 2)
+		die("packed-refs file %s has unsupported version %"PRIu32,
+		    snapshot->refs->path, get_be32(buf + 4));
+	if (get_be32(buf + 8) != algop->format_id)
+		die("packed-refs file %s uses a different hash algorithm",
+		    snapshot->refs->path);
+
+	nr = get_be64(buf + size - PACKED_REFS_V2_TRAILER_SIZE);
+	table_offset = get_be64(buf + size - 8);
+	if (table_offset < PACKED_REFS_V2_HEADER_SIZE ||
+	    table_offset > size - PACKED_REFS_V2_TRAILER_SIZE ||
+	    (size - PACKED_REFS_V2_TRAILER_SIZE - table_offset) / 8 != nr ||
+	    (size - PACKED_REFS_V2_TRAILER_SIZE - table_offset) % 8)
+		die_corrupt_v2(snapshot->refs->path);
+
+	/*
+	 * The last record must be NUL-terminated so that we never read
+	 * past the records when comparing refnames.
+	 */
+	if (nr ? buf[table_offset - 1] != '\0' :
+		 table_offset != PACKED_REFS_V2_HEADER_SIZE)
+		die_corrupt_v2(snapshot->refs->path);
+
+	snapshot->version = 2;
+	snapshot->start = snapshot->buf + PACKED_REFS_V2_HEADER_SIZE;
+	snapshot->eof = snapshot->buf + table_offset;
+	snapshot->offsets = buf + table_offset;
+	snapshot->nr = nr;
+	snapshot->peeled = PEELED_FULLY;
+
+	return 1;
+}
+
+/*
+ * Binary search the offset table of a version 2 snapshot. The
+ * semantics match those of `find_reference_location_1()`.
+ */
+static const char *find_reference_location_v2(struct snapshot *snapshot,
+					      const char *refname,
+					      int mustexist, int start)
+{
+	size_t lo = 0, hi = snapshot->nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const char *rec = v2_record_at(snapshot, mid);
+		int cmp = cmp_record_to_refname(rec, refname, start, snapshot);
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else if (cmp > 0)
+			hi = mid;
+		else
+			return rec;
+	}
+
+	if (mustexist)
+		return NULL;
+	if (lo == snapshot->nr)
+		return snapshot->eof;
+	return v2_record_at(snapshot, lo);
+}
+
 static const char *find_reference_location_1(struct snapshot *snapshot,
 					     const char *refname, int mustexist,
 					     int start)
@@ -575,6 +768,10 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->version == 2)
+		return find_reference_location_v2(snapshot, refname,
+						  mustexist, start);
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -664,6 +861,9 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
  *   `sorted`:
  *
  *      The references in this file are known to be sorted by refname.
+ *
+ * Files in the version 2 format have no header line; they are always
+ * sorted and fully peeled.
  */
 static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 {
@@ -673,10 +873,30 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	snapshot->refs = refs;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
+	snapshot->version = 1;
 
 	if (!load_contents(snapshot))
 		return snapshot;
 
+	if (parse_v2_snapshot(snapshot)) {
+		if (mmap_strategy != MMAP_OK && snapshot->mmapped) {
+			size_t start = snapshot->start - snapshot->buf;
+			size_t eof = snapshot->eof - snapshot->buf;
+			size_t size = snapshot->size;
+			size_t nr = snapshot->nr;
+			char *buf_copy = xmemdupz(snapshot->buf, size);
+
+			clear_snapshot_buffer(snapshot);
+			snapshot->buf = buf_copy;
+			snapshot->start = buf_copy + start;
+			snapshot->eof = buf_copy + eof;
+			snapshot->offsets = (unsigned char *)buf_copy + eof;
+			snapshot->size = size;
+			snapshot->nr = nr;
+		}
+		return snapshot;
+	}
+
 	/* If the file has a header line, process it: */
 	if (snapshot->buf < snapshot->eof && *snapshot->buf == '#') {
 		char *tmp, *p, *eol;
@@ -739,6 +959,7 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		clear_snapshot_buffer(snapshot);
 		snapshot->buf = snapshot->start = buf_copy;
 		snapshot->eof = buf_copy + size;
+		snapshot->size = size;
 	}
 
 	return snapshot;
@@ -794,7 +1015,9 @@ static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 		return -1;
 	}
 
-	if (get_oid_hex_algop(rec, oid, ref_store->repo->hash_algo))
+	if (snapshot->version == 2)
+		parse_v2_record(snapshot, rec, oid, NULL, NULL);
+	else if (get_oid_hex_algop(rec, oid, ref_store->repo->hash_algo))
 		die_invalid_line(refs->path, rec, snapshot->eof - rec);
 
 	*type = REF_ISPACKED;
@@ -876,6 +1099,29 @@ static int next_record(struct packed_ref_iterator *iter)
 		return ITER_DONE;
 
 	iter->base.flags = REF_ISPACKED;
+
+	if (iter->snapshot->version == 2) {
+		const char *next = parse_v2_record(iter->snapshot, iter->pos,
+						   &iter->oid, &iter->peeled, &p);
+
+		strbuf_add(&iter->refname_buf, p, next - p - 1);
+		iter->base.refname = iter->refname_buf.buf;
+		iter->pos = next;
+
+		if (check_refname_format(iter->base.refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(iter->base.refname))
+				die("packed refname is dangerous: %s",
+				    iter->base.refname);
+			oidclr(&iter->oid, iter->repo->hash_algo);
+			oidclr(&iter->peeled, iter->repo->hash_algo);
+			iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
+		} else {
+			iter->base.flags |= REF_KNOWS_PEELED;
+		}
+
+		return ITER_OK;
+	}
+
 	p = iter->pos;
 
 	if (iter->eof - p < snapshot_hexsz(iter->snapshot) + 2 ||
@@ -1152,18 +1398,53 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	return ref_iterator;
 }
 
+/*
+ * State for writing a `packed-refs` file in either format version.
+ */
+struct packed_refs_writer {
+	FILE *out;
+	int version;
+	const struct git_hash_algo *algop;
+
+	/* For version 2: the current offset and the offsets of records. */
+	uint64_t pos;
+	uint64_t *offsets;
+	size_t offsets_nr, offsets_alloc;
+};
+
 /*
  * Write an entry to the packed-refs file for the specified refname.
  * If peeled is non-NULL, write it as the entry's peeled value. On
  * error, return a nonzero value and leave errno set at the value left
- * by the failing call to `fprintf()`.
+ * by the failing call to `fprintf()` or `fwrite()`.
  */
-static int write_packed_entry(FILE *fh, const char *refname,
+static int write_packed_entry(struct packed_refs_writer *w,
+			      const char *refname,
 			      const struct object_id *oid,
 			      const struct object_id *peeled)
 {
-	if (fprintf(fh, "%s %s\n", oid_to_hex(oid), refname) < 0 ||
-	    (peeled && fprintf(fh, "^%s\n", oid_to_hex(peeled)) < 0))
+	if (w->version == 2) {
+		unsigned char flags = peeled ? PACKED_REFS_V2_PEELED : 0;
+		size_t len = strlen(refname) + 1;
+
+		ALLOC_GROW(w->offsets, w->offsets_nr + 1, w->offsets_alloc);
+		w->offsets[w->offsets_nr++] = w->pos;
+
+		if (fwrite(&flags, 1, 1, w->out) != 1 ||
+		    fwrite(oid->hash, w->algop->rawsz, 1, w->out) != 1 ||
+		    (peeled &&
+		     fwrite(peeled->hash, w->algop->rawsz, 1, w->out) != 1) ||
+		    fwrite(refname, len, 1, w->out) != 1)
+			return -1;
+
+		w->pos += 1 + w->algop->rawsz + len;
+		if (peeled)
+			w->pos += w->algop->rawsz;
+		return 0;
+	}
+
+	if (fprintf(w->out, "%s %s\n", oid_to_hex(oid), refname) < 0 ||
+	    (peeled && fprintf(w->out, "^%s\n", oid_to_hex(peeled)) < 0))
 		return -1;
 
 	return 0;
@@ -1261,6 +1542,48 @@ int packed_refs_is_locked(struct ref_store *ref_store)
 static const char PACKED_REFS_HEADER[] =
 	"# pack-refs with: peeled fully-peeled sorted \n";
 
+static int write_packed_refs_header(struct packed_refs_writer *w)
+{
+	unsigned char header[PACKED_REFS_V2_HEADER_SIZE];
+
+	if (w->version != 2)
+		return fprintf(w->out, "%s", PACKED_REFS_HEADER) < 0 ? -1 : 0;
+
+	put_be32(header, PACKED_REFS_SIGNATURE);
+	put_be32(header + 4, 2);
+	put_be32(header + 8, w->algop->format_id);
+	if (fwrite(header, sizeof(header), 1, w->out) != 1)
+		return -1;
+	w->pos = sizeof(header);
+
+	return 0;
+}
+
+/*
+ * Write the offset table and the trailer of a version 2 file. This is
+ * a no-op for version 1.
+ */
+static int write_packed_refs_trailer(struct packed_refs_writer *w)
+{
+	unsigned char buf[PACKED_REFS_V2_TRAILER_SIZE];
+
+	if (w->version != 2)
+		return 0;
+
+	for (size_t i = 0; i < w->offsets_nr; i++) {
+		put_be64(buf, w->offsets[i]);
+		if (fwrite(buf, 8, 1, w->out) != 1)
+			return -1;
+	}
+
+	put_be64(buf, w->offsets_nr);
+	put_be64(buf + 8, w->pos);
+	if (fwrite(buf, sizeof(buf), 1, w->out) != 1)
+		return -1;
+
+	return 0;
+}
+
 static int packed_ref_store_create_on_disk(struct ref_store *ref_store UNUSED,
 					   int flags UNUSED,
 					   struct strbuf *err UNUSED)
@@ -1297,9 +1620,12 @@ static int write_with_updates(struct packed_ref_store *refs,
 			      struct strbuf *err)
 {
 	struct ref_iterator *iter = NULL;
+	struct packed_refs_writer w = {
+		.algop = refs->base.repo->hash_algo,
+		.version = refs->base.repo->repository_format_packed_refs_version,
+	};
 	size_t i;
 	int ok;
-	FILE *out;
 	struct strbuf sb = STRBUF_INIT;
 	char *packed_refs_path;
 
@@ -1323,14 +1649,14 @@ static int write_with_updates(struct packed_ref_store *refs,
 	}
 	strbuf_release(&sb);
 
-	out = fdopen_tempfile(refs->tempfile, "w");
-	if (!out) {
+	w.out = fdopen_tempfile(refs->tempfile, "w");
+	if (!w.out) {
 		strbuf_addf(err, "unable to fdopen packed-refs tempfile: %s",
 			    strerror(errno));
 		goto error;
 	}
 
-	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
+	if (write_packed_refs_header(&w))
 		goto write_error;
 
 	/*
@@ -1424,7 +1750,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 			struct object_id peeled;
 			int peel_error = ref_iterator_peel(iter, &peeled);
 
-			if (write_packed_entry(out, iter->refname,
+			if (write_packed_entry(&w, iter->refname,
 					       iter->oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1446,7 +1772,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 						     &update->new_oid,
 						     &peeled);
 
-			if (write_packed_entry(out, update->refname,
+			if (write_packed_entry(&w, update->refname,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1461,17 +1787,22 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
-	if (fflush(out) ||
+	if (write_packed_refs_trailer(&w))
+		goto write_error;
+
+	if (fflush(w.out) ||
 	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_tempfile_fd(refs->tempfile)) ||
 	    close_tempfile_gently(refs->tempfile)) {
 		strbuf_addf(err, "error closing file %s: %s",
 			    get_tempfile_path(refs->tempfile),
 			    strerror(errno));
 		strbuf_release(&sb);
+		free(w.offsets);
 		delete_tempfile(&refs->tempfile);
 		return -1;
 	}
 
+	free(w.offsets);
 	return 0;
 
 write_error:
@@ -1482,6 +1813,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (iter)
 		ref_iterator_abort(iter);
 
+	free(w.offsets);
 	delete_tempfile(&refs->tempfile);
 	return -1;
 }
@@ -15,12 +15,14 @@
 #include "../object.h"
 #include "../path.h"
 #include "../refs.h"
+#include "../run-command.h"
 #include "../reftable/reftable-stack.h"
 #include "../reftable/reftable-record.h"
 #include "../reftable/reftable-error.h"
 #include "../reftable/reftable-iterator.h"
 #include "../setup.h"
 #include "../strmap.h"
+#include "../trace2.h"
 #include "parse.h"
 #include "refs-internal.h"
 
@@ -50,6 +52,12 @@ struct reftable_ref_store {
 	struct strmap worktree_stacks;
 	struct reftable_write_options write_options;
 
+	/*
+	 * Whether auto-compaction is deferred to a detached maintenance
+	 * process instead of being performed inline by the writer.
+	 */
+	int background_compaction;
+
 	unsigned int store_flags;
 	int err;
 };
@@ -284,6 +292,12 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 
 	git_config(reftable_be_config, &refs->write_options);
 
+	if (!refs->write_options.disable_auto_compact &&
+	    !repo_config_get_bool(repo, "reftable.backgroundcompaction",
+				  &refs->background_compaction) &&
+	    refs->background_compaction)
+		refs->write_options.disable_auto_compact = 1;
+
 	/*
 	 * It is somewhat unfortunate that we have to mirror the default block
 	 * size of the reftable library here. But given that the write options
@@ -1317,6 +1331,56 @@ static int write_transaction_table(struct reftable_writer *writer, void *cb_data
 	return ret;
 }
 
+/*
+ * Compact the stack after tables have been added to it in case background
+ * compaction is enabled. Compaction of the stack that git-pack-refs(1) would
+ * operate on is deferred to a detached maintenance process, which only needs
+ * to hold "tables.list.lock" while swapping in the compacted table. Other
+ * stacks are compacted inline, as they would be without background
+ * compaction.
+ */
+static int maybe_compact_in_background(struct reftable_ref_store *refs,
+				       struct reftable_stack *stack)
+{
+	struct reftable_stack *packed_stack;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	int detach;
+	int ret;
+
+	if (!refs->background_compaction ||
+	    !reftable_stack_auto_compact_needed(stack))
+		return 0;
+
+	packed_stack = refs->worktree_stack ? refs->worktree_stack : refs->main_stack;
+	if (stack != packed_stack) {
+		ret = reftable_stack_auto_compact(stack);
+		if (ret == REFTABLE_LOCK_ERROR)
+			ret = 0;
+		return ret;
+	}
+
+	if (repo_config_get_bool(refs->base.repo, "maintenance.autodetach", &detach) &&
+	    repo_config_get_bool(refs->base.repo, "gc.autodetach", &detach))
+		detach = 1;
+
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	strvec_pushl(&cmd.args, "maintenance", "run", "--auto", "--quiet",
+		     "--task=pack-refs", NULL);
+	strvec_push(&cmd.args, detach ? "--detach" : "--no-detach");
+
+	trace2_region_enter("refs", "background-compaction", refs->base.repo);
+	/*
+	 * Failing to spawn the maintenance process is not fatal: the stack
+	 * is still consistent, and the next writer will retry.
+	 */
+	if (run_command(&cmd))
+		warning(_("unable to spawn background reftable compaction"));
+	trace2_region_leave("refs", "background-compaction", refs->base.repo);
+
+	return 0;
+}
+
 static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
 					  struct ref_transaction *transaction,
 					  struct strbuf *err)
@@ -1333,6 +1397,11 @@ static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
 		ret = reftable_addition_commit(tx_data->args[i].addition);
 		if (ret < 0)
 			goto done;
+
+		ret = maybe_compact_in_background(tx_data->args[i].refs,
+						  tx_data->args[i].stack);
+		if (ret < 0)
+			goto done;
 	}
 
 done:
@@ -1370,10 +1439,26 @@ static int reftable_be_pack_refs(struct ref_store *ref_store,
 	if (!stack)
 		stack = refs->main_stack;
 
+	trace2_region_enter("refs", "compact", refs->base.repo);
 	if (opts->flags & PACK_REFS_AUTO)
 		ret = reftable_stack_auto_compact(stack);
 	else
 		ret = reftable_stack_compact_all(stack, NULL);
+	trace2_region_leave("refs", "compact", refs->base.repo);
+
+	if (trace2_is_enabled()) {
+		struct reftable_compaction_stats *stats =
+			reftable_stack_compaction_stats(stack);
+		trace2_data_intmax("refs", refs->base.repo, "compaction/attempts",
+				   stats->attempts);
+		trace2_data_intmax("refs", refs->base.repo, "compaction/failures",
+				   stats->failures);
+		trace2_data_intmax("refs", refs->base.repo, "compaction/bytes",
+				   stats->bytes);
+		trace2_data_intmax("refs", refs->base.repo, "compaction/entries",
+				   stats->entries_written);
+	}
+
 	if (ret < 0) {
 		ret = error(_("unable to compact stack: %s"),
 			    reftable_error_str(ret));
@@ -1639,6 +1724,10 @@ static int reftable_be_rename_ref(struct ref_store *ref_store,
 	if (ret)
 		goto done;
 	ret = reftable_stack_add(stack, &write_copy_table, &arg);
+	if (ret < 0)
+		goto done;
+
+	ret = maybe_compact_in_background(refs, stack);
 
 done:
 	assert(ret != REFTABLE_API_ERROR);
@@ -1670,6 +1759,10 @@ static int reftable_be_copy_ref(struct ref_store *ref_store,
 	if (ret)
 		goto done;
 	ret = reftable_stack_add(stack, &write_copy_table, &arg);
+	if (ret < 0)
+		goto done;
+
+	ret = maybe_compact_in_background(refs, stack);
 
 done:
 	assert(ret != REFTABLE_API_ERROR);
@@ -114,6 +114,13 @@ int reftable_stack_compact_all(struct reftable_stack *st,
 /* heuristically compact unbalanced table stack. */
 int reftable_stack_auto_compact(struct reftable_stack *st);
 
+/*
+ * Returns 1 if reftable_stack_auto_compact() would compact any tables of the
+ * stack, 0 otherwise. This does not take any locks and can be used by callers
+ * that wish to defer compaction, e.g. to a separate process.
+ */
+int reftable_stack_auto_compact_needed(struct reftable_stack *st);
+
 /* delete stale .ref tables. */
 int reftable_stack_clean(struct reftable_stack *st);
 
@@ -1444,13 +1444,25 @@ static uint64_t *stack_table_sizes_for_compaction(struct reftable_stack *st)
 	return sizes;
 }
 
-int reftable_stack_auto_compact(struct reftable_stack *st)
+static struct segment stack_suggest_compaction_segment(struct reftable_stack *st)
 {
 	uint64_t *sizes = stack_table_sizes_for_compaction(st);
 	struct segment seg =
 		suggest_compaction_segment(sizes, st->merged->readers_len,
 					   st->opts.auto_compaction_factor);
 	reftable_free(sizes);
+	return seg;
+}
+
+int reftable_stack_auto_compact_needed(struct reftable_stack *st)
+{
+	struct segment seg = stack_suggest_compaction_segment(st);
+	return segment_size(&seg) > 0;
+}
+
+int reftable_stack_auto_compact(struct reftable_stack *st)
+{
+	struct segment seg = stack_suggest_compaction_segment(st);
 	if (segment_size(&seg) > 0)
 		return stack_compact_range_stats(st, seg.start, seg.end - 1,
 						 NULL, STACK_COMPACT_RANGE_BEST_EFFORT);
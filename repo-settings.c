@@ -106,6 +106,8 @@ void prepare_repo_settings(struct repository *r)
 		int fetch_default = r->settings.fetch_negotiation_algorithm;
 		if (!strcasecmp(strval, "skipping"))
 			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_SKIPPING;
+		else if (!strcasecmp(strval, "bitmap"))
+			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_BITMAP;
 		else if (!strcasecmp(strval, "noop"))
 			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_NOOP;
 		else if (!strcasecmp(strval, "consecutive"))
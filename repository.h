@@ -24,6 +24,7 @@ enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_CONSECUTIVE,
 	FETCH_NEGOTIATION_SKIPPING,
 	FETCH_NEGOTIATION_NOOP,
+	FETCH_NEGOTIATION_BITMAP,
 };
 
 enum ref_storage_format {
@@ -197,6 +198,7 @@ struct repository {
 
 	/* Configurations */
 	int repository_format_worktree_config;
+	int repository_format_packed_refs_version;
 
 	/* Indicate if a repository has a different 'commondir' from 'gitdir' */
 	unsigned different_commondir:1;
@@ -47,6 +47,7 @@
 #include "list-objects-filter-options.h"
 #include "resolve-undo.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 #include "wildmatch.h"
 
 volatile show_early_output_fn_t show_early_output;
@@ -86,6 +87,8 @@ static void mark_tree_contents_uninteresting(struct repository *r,
 
 	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
 	while (tree_entry(&desc, &entry)) {
+		if (desc.size)
+			prefetch_object(r, &desc.entry.oid);
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
 			mark_tree_uninteresting(r, lookup_tree(r, &entry.oid));
@@ -193,6 +196,8 @@ static void add_children_by_path(struct repository *r,
 
 	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
 	while (tree_entry(&desc, &entry)) {
+		if (desc.size)
+			prefetch_object(r, &desc.entry.oid);
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
 			paths_and_oids_insert(map, entry.path, &entry.oid);
@@ -766,11 +771,25 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	free(path_alloc);
 }
 
+static int bloom_filter_contains_pathspec(struct rev_info *revs,
+					  struct bloom_filter *filter)
+{
+	int result = 1, j;
+
+	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
+		result = bloom_filter_contains(filter,
+					       &revs->bloom_keys[j],
+					       revs->bloom_filter_settings);
+	}
+
+	return result;
+}
+
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -785,11 +804,7 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
-	}
+	result = bloom_filter_contains_pathspec(revs, filter);
 
 	if (result)
 		count_bloom_filter_maybe++;
@@ -799,6 +814,279 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	return result;
 }
 
+/*
+ * When walking with changed-path Bloom filters, commits whose filter
+ * reports a possible change still require a tree diff against their
+ * first parent. These diffs are independent of each other, so we read
+ * ahead along the first-parent chain of a commit that needs such a diff,
+ * query the Bloom filters of the upcoming commits as a batch and compute
+ * the remaining tree diffs on worker threads. The results are cached
+ * per commit and consumed by rev_compare_tree() in the order of the
+ * walk, so the output is unaffected.
+ */
+#define TREE_DIFF_PREFETCH_DEPTH 512
+
+struct prefetched_tree_diff {
+	/*
+	 * The first parent the difference was computed against, or NULL
+	 * if there is no prefetched result.
+	 */
+	struct commit *parent;
+	int tree_difference;
+};
+
+define_commit_slab(prefetched_tree_diff_slab, struct prefetched_tree_diff);
+
+struct tree_diff_prefetch {
+	int nr_threads;
+	struct prefetched_tree_diff_slab results;
+};
+
+struct tree_diff_prefetch_job {
+	struct commit *commit;
+	struct commit *parent;
+	const struct object_id *parent_tree;
+	const struct object_id *tree;
+	int tree_difference;
+};
+
+struct tree_diff_prefetch_batch {
+	struct rev_info *revs;
+	struct tree_diff_prefetch_job *jobs;
+	size_t jobs_nr, next;
+	pthread_mutex_t mutex;
+};
+
+struct tree_diff_prefetch_worker {
+	int remove_empty_trees;
+	int tree_difference;
+};
+
+/* Mirrors file_add_remove(), but records into the worker state. */
+static void prefetch_file_add_remove(struct diff_options *options,
+				     int addremove,
+				     unsigned mode UNUSED,
+				     const struct object_id *oid UNUSED,
+				     int oid_valid UNUSED,
+				     const char *fullpath UNUSED,
+				     unsigned dirty_submodule UNUSED)
+{
+	struct tree_diff_prefetch_worker *worker = options->change_fn_data;
+
+	worker->tree_difference |= addremove == '+' ? REV_TREE_NEW : REV_TREE_OLD;
+	if (!worker->remove_empty_trees || worker->tree_difference != REV_TREE_NEW)
+		options->flags.has_changes = 1;
+}
+
+/* Mirrors file_change(), but records into the worker state. */
+static void prefetch_file_change(struct diff_options *options,
+				 unsigned old_mode UNUSED,
+				 unsigned new_mode UNUSED,
+				 const struct object_id *old_oid UNUSED,
+				 const struct object_id *new_oid UNUSED,
+				 int old_oid_valid UNUSED,
+				 int new_oid_valid UNUSED,
+				 const char *fullpath UNUSED,
+				 unsigned old_dirty_submodule UNUSED,
+				 unsigned new_dirty_submodule UNUSED)
+{
+	struct tree_diff_prefetch_worker *worker = options->change_fn_data;
+
+	worker->tree_difference = REV_TREE_DIFFERENT;
+	options->flags.has_changes = 1;
+}
+
+static void *run_tree_diff_prefetch(void *data)
+{
+	struct tree_diff_prefetch_batch *batch = data;
+	struct tree_diff_prefetch_worker worker = {
+		.remove_empty_trees = batch->revs->remove_empty_trees,
+	};
+	struct diff_options opt;
+
+	/*
+	 * Every worker uses its own shallow copy of the pruning options.
+	 * The pathspec is only read, and diff_tree_oid() only modifies
+	 * fields that are embedded in the copy.
+	 */
+	memcpy(&opt, &batch->revs->pruning, sizeof(opt));
+	opt.add_remove = prefetch_file_add_remove;
+	opt.change = prefetch_file_change;
+	opt.change_fn_data = &worker;
+
+	while (1) {
+		struct tree_diff_prefetch_job *job;
+
+		pthread_mutex_lock(&batch->mutex);
+		job = batch->next < batch->jobs_nr ? &batch->jobs[batch->next++] : NULL;
+		pthread_mutex_unlock(&batch->mutex);
+		if (!job)
+			break;
+
+		worker.tree_difference = REV_TREE_SAME;
+		opt.flags.has_changes = 0;
+		diff_tree_oid(job->parent_tree, job->tree, "", &opt);
+		job->tree_difference = worker.tree_difference;
+	}
+
+	return NULL;
+}
+
+static void prefetch_tree_diffs(struct rev_info *revs, struct commit *commit)
+{
+	struct tree_diff_prefetch *prefetch = revs->tree_diff_prefetch;
+	struct tree_diff_prefetch_batch batch = {
+		.revs = revs,
+	};
+	size_t jobs_alloc = 0;
+	pthread_t *threads;
+	int nr_threads;
+
+	for (size_t i = 0; commit && i < TREE_DIFF_PREFETCH_DEPTH; i++) {
+		struct prefetched_tree_diff *result;
+		struct bloom_filter *filter;
+		struct commit *parent;
+		struct tree *tree, *parent_tree;
+
+		if (commit->object.flags & UNINTERESTING ||
+		    repo_parse_commit(revs->repo, commit) ||
+		    !commit->parents)
+			break;
+		parent = commit->parents->item;
+		if (repo_parse_commit(revs->repo, parent))
+			break;
+
+		/*
+		 * Only commits whose Bloom filter reports a possible change
+		 * need a tree diff. Unlike check_maybe_different_in_bloom_filter(),
+		 * this does not count towards the Bloom filter statistics, as
+		 * the walk will query the filter again when it gets here.
+		 */
+		result = prefetched_tree_diff_slab_at(&prefetch->results, commit);
+		if (result->parent ||
+		    commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY ||
+		    !(filter = get_bloom_filter(revs->repo, commit)) ||
+		    bloom_filter_contains_pathspec(revs, filter) != 1)
+			goto next;
+
+		tree = repo_get_commit_tree(revs->repo, commit);
+		parent_tree = repo_get_commit_tree(revs->repo, parent);
+		if (!tree || !parent_tree)
+			goto next;
+
+		ALLOC_GROW(batch.jobs, batch.jobs_nr + 1, jobs_alloc);
+		batch.jobs[batch.jobs_nr].commit = commit;
+		batch.jobs[batch.jobs_nr].parent = parent;
+		batch.jobs[batch.jobs_nr].parent_tree = &parent_tree->object.oid;
+		batch.jobs[batch.jobs_nr].tree = &tree->object.oid;
+		batch.jobs_nr++;
+
+next:
+		commit = parent;
+	}
+
+	if (!batch.jobs_nr)
+		return;
+
+	trace2_region_enter("revision", "prefetch-tree-diffs", revs->repo);
+	trace2_data_intmax("revision", revs->repo, "prefetch-tree-diffs/jobs",
+			   batch.jobs_nr);
+
+	nr_threads = prefetch->nr_threads;
+	if (nr_threads > batch.jobs_nr)
+		nr_threads = batch.jobs_nr;
+	CALLOC_ARRAY(threads, nr_threads);
+
+	pthread_mutex_init(&batch.mutex, NULL);
+	enable_obj_read_lock();
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, run_tree_diff_prefetch, &batch))
+			die(_("unable to create tree diff thread"));
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&batch.mutex);
+
+	for (size_t i = 0; i < batch.jobs_nr; i++) {
+		struct prefetched_tree_diff *result =
+			prefetched_tree_diff_slab_at(&prefetch->results,
+						     batch.jobs[i].commit);
+		result->parent = batch.jobs[i].parent;
+		result->tree_difference = batch.jobs[i].tree_difference;
+	}
+
+	trace2_region_leave("revision", "prefetch-tree-diffs", revs->repo);
+
+	free(threads);
+	free(batch.jobs);
+}
+
+/*
+ * Look up the prefetched tree difference between `commit` and its first
+ * parent `parent`, computing it along with those of upcoming commits if
+ * necessary. Returns 0 and stores the difference in `tree_difference` on
+ * success, -1 if no prefetched result is available.
+ */
+static int get_prefetched_tree_diff(struct rev_info *revs,
+				    struct commit *parent,
+				    struct commit *commit,
+				    int *tree_difference)
+{
+	struct prefetched_tree_diff *result;
+
+	if (!revs->tree_diff_prefetch)
+		return -1;
+
+	result = prefetched_tree_diff_slab_peek(&revs->tree_diff_prefetch->results,
+						commit);
+	if (!result || !result->parent) {
+		prefetch_tree_diffs(revs, commit);
+		result = prefetched_tree_diff_slab_peek(&revs->tree_diff_prefetch->results,
+							commit);
+	}
+
+	/*
+	 * Parents may have been rewritten since we prefetched the
+	 * difference, in which case we have to compute it anew.
+	 */
+	if (!result || result->parent != parent)
+		return -1;
+
+	*tree_difference = result->tree_difference;
+	return 0;
+}
+
+static void prepare_tree_diff_prefetch(struct rev_info *revs)
+{
+	int nr_threads;
+
+	if (revs->tree_diff_prefetch ||
+	    repo_config_get_int(revs->repo, "commitgraph.changedpathsthreads",
+				&nr_threads))
+		return;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > 1 && !HAVE_THREADS) {
+		warning(_("no threads support, ignoring %s"),
+			"commitGraph.changedPathsThreads");
+		return;
+	}
+	if (nr_threads <= 1 || revs->pruning.flags.follow_renames)
+		return;
+
+	CALLOC_ARRAY(revs->tree_diff_prefetch, 1);
+	revs->tree_diff_prefetch->nr_threads = nr_threads;
+	init_prefetched_tree_diff_slab(&revs->tree_diff_prefetch->results);
+}
+
+static void release_tree_diff_prefetch(struct tree_diff_prefetch *prefetch)
+{
+	if (!prefetch)
+		return;
+	clear_prefetched_tree_diff_slab(&prefetch->results);
+	free(prefetch);
+}
+
 static int rev_compare_tree(struct rev_info *revs,
 			    struct commit *parent, struct commit *commit, int nth_parent)
 {
@@ -834,6 +1122,13 @@ static int rev_compare_tree(struct rev_info *revs,
 
 		if (bloom_ret == 0)
 			return REV_TREE_SAME;
+
+		if (bloom_ret == 1 &&
+		    !get_prefetched_tree_diff(revs, parent, commit, &tree_difference)) {
+			if (tree_difference == REV_TREE_SAME)
+				count_bloom_filter_false_positive++;
+			return tree_difference;
+		}
 	}
 
 	tree_difference = REV_TREE_SAME;
@@ -2620,6 +2915,18 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 		revs->no_commit_id = 1;
 	} else if (!strcmp(arg, "--always")) {
 		revs->always_show_header = 1;
+	} else if (skip_prefix(arg, "--diff-jobs=", &optarg)) {
+		if (strtol_i(optarg, 10, &revs->diff_jobs) < 0 ||
+		    revs->diff_jobs < 0)
+			die("'%s': not a non-negative integer", optarg);
+		if (!revs->diff_jobs)
+			revs->diff_jobs = online_cpus();
+	} else if (skip_prefix(arg, "--diff-lookahead=", &optarg)) {
+		if (strtol_i(optarg, 10, &revs->diff_lookahead) < 0 ||
+		    revs->diff_lookahead <= 0)
+			die("'%s': not a positive integer", optarg);
+	} else if (!strcmp(arg, "--diff-worker")) {
+		revs->diff_worker = 1;
 	} else if (!strcmp(arg, "--no-abbrev")) {
 		revs->abbrev = 0;
 	} else if (!strcmp(arg, "--abbrev")) {
@@ -3217,6 +3524,7 @@ void release_revisions(struct rev_info *revs)
 	diff_free(&revs->pruning);
 	reflog_walk_info_release(revs->reflog_info);
 	release_revisions_topo_walk_info(revs->topo_walk_info);
+	release_tree_diff_prefetch(revs->tree_diff_prefetch);
 	clear_decoration(&revs->children, free_void_commit_list);
 	clear_decoration(&revs->merge_simplification, free);
 	clear_decoration(&revs->treesame, free);
@@ -3915,6 +4223,8 @@ int prepare_revision_walk(struct rev_info *revs)
 
 	if (!revs->reflog_info)
 		prepare_to_use_bloom_filter(revs);
+	if (revs->bloom_keys_nr)
+		prepare_tree_diff_prefetch(revs);
 	if (!revs->unsorted_input)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
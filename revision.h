@@ -117,6 +117,7 @@ struct ref_exclusions {
 
 struct oidset;
 struct topo_walk_info;
+struct tree_diff_prefetch;
 
 struct rev_info {
 	/* Starting list */
@@ -250,6 +251,14 @@ struct rev_info {
 			first_parent_merges:1,
 			remerge_diff:1;
 
+	/*
+	 * --diff-jobs and --diff-lookahead; see log_tree_pipeline_start().
+	 * diff_worker is set in the worker processes it runs.
+	 */
+	int		diff_jobs;
+	int		diff_lookahead;
+	unsigned int	diff_worker:1;
+
 	/* Format info */
 	int		show_notes;
 	unsigned int	shown_one:1,
@@ -370,6 +379,9 @@ struct rev_info {
 	 */
 	struct bloom_filter_settings *bloom_filter_settings;
 
+	/* Tree diffs computed ahead of the walk, if enabled. */
+	struct tree_diff_prefetch *tree_diff_prefetch;
+
 	/* misc. flags related to '--no-kept-objects' */
 	unsigned keep_pack_cache_flags;
 
@@ -15,6 +15,7 @@
 #include "object-store-ll.h"
 #include "object.h"
 #include "pager.h"
+#include "parse.h"
 #include "commit.h"
 #include "sequencer.h"
 #include "run-command.h"
@@ -22,6 +23,7 @@
 #include "utf8.h"
 #include "cache-tree.h"
 #include "diff.h"
+#include "diffcore.h"
 #include "path.h"
 #include "revision.h"
 #include "rerere.h"
@@ -30,6 +32,7 @@
 #include "merge-ort-wrappers.h"
 #include "refs.h"
 #include "sparse-index.h"
+#include "tree-walk.h"
 #include "strvec.h"
 #include "quote.h"
 #include "trailer.h"
@@ -173,6 +176,14 @@ static GIT_PATH_FUNC(rebase_path_squash_onto, "rebase-merge/squash-onto")
  */
 static GIT_PATH_FUNC(rebase_path_refs_to_delete, "rebase-merge/refs-to-delete")
 
+/*
+ * While picks are only made in memory (rebase.deferWorktreeUpdates), this
+ * file holds the tree that the index and the working tree still match,
+ * followed by the tree of the last pick. If we are interrupted, "git
+ * rebase --continue" uses it to bring them up to date.
+ */
+static GIT_PATH_FUNC(rebase_path_deferred_worktree, "rebase-merge/deferred-worktree")
+
 /*
  * The update-refs file stores a list of refs that will be updated at the end
  * of the rebase sequence. The 'update-ref <ref>' commands in the todo file
@@ -237,6 +248,16 @@ struct replay_ctx {
 	 * Whether message contains a commit message.
 	 */
 	unsigned have_message :1;
+	/*
+	 * When picks are only made in memory, the tree that the index and
+	 * the working tree still match, or NULL if they are up to date.
+	 */
+	struct tree *worktree_tree;
+	/*
+	 * The result of the last pick made in memory. It is kept around
+	 * so that the next merge can reuse its renames.
+	 */
+	struct merge_result merge_result;
 };
 
 struct replay_ctx* replay_ctx_new(void)
@@ -325,12 +346,19 @@ static int git_sequencer_config(const char *k, const char *v,
 	if (opts->action == REPLAY_REVERT && !strcmp(k, "revert.reference"))
 		opts->commit_use_reference = git_config_bool(k, v);
 
+	if (!strcmp(k, "rebase.deferworktreeupdates")) {
+		opts->defer_worktree_updates = git_config_bool(k, v);
+		return 0;
+	}
+
 	return git_diff_basic_config(k, v, ctx, NULL);
 }
 
 void sequencer_init_config(struct replay_opts *opts)
 {
 	opts->default_msg_cleanup = COMMIT_MSG_CLEANUP_NONE;
+	opts->defer_worktree_updates =
+		git_env_bool("GIT_TEST_REBASE_DEFER_WORKTREE_UPDATES", 0);
 	git_config(git_sequencer_config, opts);
 }
 
@@ -410,6 +438,12 @@ static void replay_ctx_release(struct replay_ctx *ctx)
 {
 	strbuf_release(&ctx->current_fixups);
 	strbuf_release(&ctx->message);
+	if (ctx->merge_result.priv) {
+		struct merge_options o;
+
+		init_basic_merge_options(&o, the_repository);
+		merge_finalize(&o, &ctx->merge_result);
+	}
 }
 
 void replay_opts_release(struct replay_opts *opts)
@@ -645,6 +679,117 @@ static void update_abort_safety_file(void)
 		write_file(git_path_abort_safety_file(), "%s", "");
 }
 
+/*
+ * Whether a pick may be made in memory only, leaving the index and the
+ * working tree alone until the sequencer stops or needs them. Hooks
+ * that run while committing see both as they always did.
+ */
+static int can_defer_worktree_update(struct repository *r,
+				     struct replay_opts *opts)
+{
+	return is_rebase_i(opts) && opts->defer_worktree_updates &&
+		(!opts->strategy || !strcmp(opts->strategy, "ort")) &&
+		!hook_exists(r, "prepare-commit-msg") &&
+		!hook_exists(r, "post-commit") &&
+		!hook_exists(r, "post-rewrite");
+}
+
+/*
+ * Whether something in the working tree, which still matches
+ * "worktree_tree", is in the way of a path that "to" adds to "from".
+ * Checking out "to" would then fail, so it has to be done right away
+ * rather than after the commit has been made.
+ */
+static int deferred_pick_blocked(struct repository *r,
+				 struct tree *worktree_tree,
+				 struct tree *from, struct tree *to)
+{
+	struct diff_options diffopt;
+	int i, blocked = 0;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+	diff_tree_oid(&from->object.oid, &to->object.oid, "", &diffopt);
+
+	for (i = 0; i < diff_queued_diff.nr && !blocked; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		struct object_id oid;
+		unsigned short mode;
+		struct stat st;
+
+		if (DIFF_FILE_VALID(p->one) ||
+		    !get_tree_entry(r, &worktree_tree->object.oid,
+				    p->two->path, &oid, &mode))
+			continue;
+		if (lstat(p->two->path, &st) && errno == ENOENT)
+			continue;
+		blocked = 1;
+	}
+	diff_flush(&diffopt);
+	return blocked;
+}
+
+/*
+ * Bring the index and the working tree up to date with the picks that
+ * were only made in memory so far.
+ */
+static int update_deferred_worktree(struct repository *r,
+				    struct replay_opts *opts)
+{
+	struct replay_ctx *ctx = opts->ctx;
+	struct tree *from = ctx->worktree_tree;
+	struct tree *to = ctx->merge_result.tree;
+	struct merge_options o;
+
+	if (!from)
+		return 0;
+	ctx->worktree_tree = NULL;
+	init_basic_merge_options(&o, r);
+	merge_finalize(&o, &ctx->merge_result);
+	memset(&ctx->merge_result, 0, sizeof(ctx->merge_result));
+
+	discard_index(r->index);
+	if (repo_read_index(r) < 0)
+		return error(_("could not read index"));
+	if (checkout_fast_forward(r, &from->object.oid, &to->object.oid, 1))
+		return -1; /* the callee should have complained already */
+	unlink(rebase_path_deferred_worktree());
+	return 0;
+}
+
+int sequencer_update_deferred_worktree(struct repository *r, int discard)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id from, to;
+	const char *p;
+	int ret = 0;
+
+	if (!read_oneliner(&buf, rebase_path_deferred_worktree(), 0))
+		return 0;
+	if (!discard) {
+		if (parse_oid_hex(buf.buf, &from, &p) || *p++ != ' ' ||
+		    parse_oid_hex(p, &to, &p) || *p) {
+			ret = error(_("could not parse '%s'"),
+				    rebase_path_deferred_worktree());
+			goto out;
+		}
+		if (repo_read_index(r) < 0) {
+			ret = error(_("could not read index"));
+			goto out;
+		}
+		if (checkout_fast_forward(r, &from, &to, 1)) {
+			ret = -1;
+			goto out;
+		}
+	}
+	unlink(rebase_path_deferred_worktree());
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
 static int fast_forward_to(struct repository *r,
 			   const struct object_id *to,
 			   const struct object_id *from,
@@ -751,17 +896,22 @@ static int do_recursive_merge(struct repository *r,
 			      struct object_id *head, struct strbuf *msgbuf,
 			      struct replay_opts *opts)
 {
+	struct replay_ctx *ctx = opts->ctx;
 	struct merge_options o;
 	struct merge_result result;
 	struct tree *next_tree, *base_tree, *head_tree;
 	int clean, show_output;
 	int i;
 	struct lock_file index_lock = LOCK_INIT;
+	int defer = can_defer_worktree_update(r, opts);
 
-	if (repo_hold_locked_index(r, &index_lock, LOCK_REPORT_ON_ERROR) < 0)
-		return -1;
+	if (!defer) {
+		if (repo_hold_locked_index(r, &index_lock,
+					   LOCK_REPORT_ON_ERROR) < 0)
+			return -1;
 
-	repo_read_index(r);
+		repo_read_index(r);
+	}
 
 	init_ui_merge_options(&o, r);
 	o.ancestor = base ? base_label : "(empty tree)";
@@ -780,19 +930,53 @@ static int do_recursive_merge(struct repository *r,
 	for (i = 0; i < opts->xopts.nr; i++)
 		parse_merge_opt(&o, opts->xopts.v[i]);
 
-	if (!opts->strategy || !strcmp(opts->strategy, "ort")) {
+	if (defer) {
+		/*
+		 * Chain the merges, and leave the index and working tree
+		 * alone unless there are conflicts to show. They are updated
+		 * from the tree they still match once we stop, or need them.
+		 */
+		struct tree *worktree_tree;
+
+		if (!ctx->worktree_tree)
+			ctx->worktree_tree = head_tree;
+		merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree,
+					  &ctx->merge_result);
+		if (ctx->merge_result.clean > 0 &&
+		    !deferred_pick_blocked(r, ctx->worktree_tree, head_tree,
+					   ctx->merge_result.tree)) {
+			struct strbuf buf = STRBUF_INIT;
+			int ret;
+
+			strbuf_addf(&buf, "%s %s",
+				    oid_to_hex(&ctx->worktree_tree->object.oid),
+				    oid_to_hex(&ctx->merge_result.tree->object.oid));
+			ret = write_message(buf.buf, buf.len,
+					    rebase_path_deferred_worktree(), 1);
+			strbuf_release(&buf);
+			return ret;
+		}
+
+		worktree_tree = ctx->worktree_tree;
+		ctx->worktree_tree = NULL;
+		result = ctx->merge_result;
+		memset(&ctx->merge_result, 0, sizeof(ctx->merge_result));
+		if (repo_hold_locked_index(r, &index_lock,
+					   LOCK_REPORT_ON_ERROR) < 0) {
+			merge_finalize(&o, &result);
+			return -1;
+		}
+		repo_read_index(r);
+		show_output = !result.clean;
+		merge_switch_to_result(&o, worktree_tree, &result, 1,
+				       show_output);
+		unlink(rebase_path_deferred_worktree());
+		clean = result.clean;
+	} else if (!opts->strategy || !strcmp(opts->strategy, "ort")) {
 		memset(&result, 0, sizeof(result));
 		merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree,
 					    &result);
 		show_output = !is_rebase_i(opts) || !result.clean;
-		/*
-		 * TODO: merge_switch_to_result will update index/working tree;
-		 * we only really want to do that if !result.clean || this is
-		 * the final patch to be picked.  But determining this is the
-		 * final patch would take some work, and "head_tree" would need
-		 * to be replace with the tree the index matched before we
-		 * started doing any picks.
-		 */
 		merge_switch_to_result(&o, head_tree, &result, 1, show_output);
 		clean = result.clean;
 	} else {
@@ -834,7 +1018,7 @@ static struct object_id *get_cache_tree_oid(struct index_state *istate)
 	return &istate->cache_tree->oid;
 }
 
-static int is_index_unchanged(struct repository *r)
+static int is_index_unchanged(struct repository *r, struct replay_ctx *ctx)
 {
 	struct object_id head_oid, *cache_tree_oid;
 	const struct object_id *head_tree_oid;
@@ -870,7 +1054,9 @@ static int is_index_unchanged(struct repository *r)
 		head_tree_oid = get_commit_tree_oid(head_commit);
 	}
 
-	if (!(cache_tree_oid = get_cache_tree_oid(istate)))
+	if (ctx->worktree_tree)
+		cache_tree_oid = &ctx->merge_result.tree->object.oid;
+	else if (!(cache_tree_oid = get_cache_tree_oid(istate)))
 		return -1;
 
 	return oideq(cache_tree_oid, head_tree_oid);
@@ -1141,6 +1327,10 @@ static int run_git_commit(const char *defmsg,
 	if ((flags & CLEANUP_MSG) && (flags & VERBATIM_MSG))
 		BUG("CLEANUP_MSG and VERBATIM_MSG are mutually exclusive");
 
+	/* "git commit" works from the index */
+	if (update_deferred_worktree(the_repository, opts))
+		return -1;
+
 	cmd.git_cmd = 1;
 
 	if (is_rebase_i(opts) &&
@@ -1587,7 +1777,9 @@ static int try_to_commit(struct repository *r,
 		commit_list_insert(current_head, &parents);
 	}
 
-	if (write_index_as_tree(&tree, r->index, r->index_file, 0, NULL)) {
+	if (ctx->worktree_tree) {
+		oidcpy(&tree, &ctx->merge_result.tree->object.oid);
+	} else if (write_index_as_tree(&tree, r->index, r->index_file, 0, NULL)) {
 		res = error(_("git write-tree failed to write a tree"));
 		goto out;
 	}
@@ -1792,7 +1984,7 @@ static int is_original_commit_empty(struct commit *commit)
 
 /*
  * Should empty commits be allowed?  Return status:
- *    <0: Error in is_index_unchanged(r) or is_original_commit_empty(commit)
+ *    <0: Error in is_index_unchanged() or is_original_commit_empty(commit)
  *     0: Halt on empty commit
  *     1: Allow empty commit
  *     2: Drop empty commit
@@ -1811,7 +2003,7 @@ static int allow_empty(struct repository *r,
 	 * drop_redundant_commits determine whether the commit should be kept or
 	 * dropped. If neither is specified, halt.
 	 */
-	index_unchanged = is_index_unchanged(r);
+	index_unchanged = is_index_unchanged(r, opts->ctx);
 	if (index_unchanged < 0)
 		return index_unchanged;
 	if (!index_unchanged)
@@ -2267,7 +2459,9 @@ static int do_pick_commit(struct repository *r,
 			unborn = 1;
 		} else if (unborn)
 			oidcpy(&head, the_hash_algo->empty_tree);
-		if (index_differs_from(r, unborn ? empty_tree_oid_hex(the_repository->hash_algo) : "HEAD",
+		/* with picks made in memory, the index is behind HEAD */
+		if (!ctx->worktree_tree &&
+		    index_differs_from(r, unborn ? empty_tree_oid_hex(the_repository->hash_algo) : "HEAD",
 				       NULL, 0))
 			return error_dirty_index(r, opts);
 	}
@@ -2311,8 +2505,10 @@ static int do_pick_commit(struct repository *r,
 	     (!parent && unborn))) {
 		if (is_rebase_i(opts))
 			write_author_script(msg.message);
-		res = fast_forward_to(r, &commit->object.oid, &head, unborn,
-			opts);
+		res = update_deferred_worktree(r, opts);
+		if (!res)
+			res = fast_forward_to(r, &commit->object.oid, &head,
+					      unborn, opts);
 		if (res || command != TODO_REWORD)
 			goto leave;
 		reword = 1;
@@ -4944,9 +5140,9 @@ static int pick_one_commit(struct repository *r,
 	return res;
 }
 
-static int pick_commits(struct repository *r,
-			struct todo_list *todo_list,
-			struct replay_opts *opts)
+static int pick_commits_1(struct repository *r,
+			  struct todo_list *todo_list,
+			  struct replay_opts *opts)
 {
 	struct replay_ctx *ctx = opts->ctx;
 	int res = 0, reschedule = 0;
@@ -4972,6 +5168,12 @@ static int pick_commits(struct repository *r,
 
 		if (save_todo(todo_list, opts, reschedule))
 			return -1;
+		if (item->command > TODO_SQUASH &&
+		    item->command != TODO_LABEL &&
+		    item->command != TODO_UPDATE_REF &&
+		    !is_noop(item->command) &&
+		    update_deferred_worktree(r, opts))
+			return -1;
 		if (is_rebase_i(opts)) {
 			if (item->command != TODO_COMMENT) {
 				FILE *f = fopen(rebase_path_msgnum(), "w");
@@ -5070,6 +5272,9 @@ static int pick_commits(struct repository *r,
 		todo_list->current++;
 	}
 
+	if (update_deferred_worktree(r, opts))
+		return -1;
+
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
 		struct stat st;
@@ -5177,6 +5382,18 @@ static int pick_commits(struct repository *r,
 	return sequencer_remove_state(opts);
 }
 
+static int pick_commits(struct repository *r,
+			struct todo_list *todo_list,
+			struct replay_opts *opts)
+{
+	int res = pick_commits_1(r, todo_list, opts);
+
+	/* however we stopped, do not leave picks made in memory behind */
+	if (update_deferred_worktree(r, opts) && !res)
+		res = -1;
+	return res;
+}
+
 static int continue_single_pick(struct repository *r, struct replay_opts *opts)
 {
 	struct child_process cmd = CHILD_PROCESS_INIT;
@@ -56,6 +56,7 @@ struct replay_opts {
 	int committer_date_is_author_date;
 	int ignore_date;
 	int commit_use_reference;
+	int defer_worktree_updates;
 
 	int mainline;
 
@@ -167,6 +168,14 @@ int sequencer_skip(struct repository *repo, struct replay_opts *opts);
 void replay_opts_release(struct replay_opts *opts);
 int sequencer_remove_state(struct replay_opts *opts);
 
+/*
+ * If a rebase that only made its picks in memory was interrupted, bring
+ * the index and the working tree up to date with the last of them. With
+ * "discard", only forget about them, for callers that reset the index and
+ * the working tree themselves.
+ */
+int sequencer_update_deferred_worktree(struct repository *r, int discard);
+
 #define TODO_LIST_KEEP_EMPTY (1U << 0)
 #define TODO_LIST_SHORTEN_IDS (1U << 1)
 #define TODO_LIST_ABBREVIATE_CMDS (1U << 2)
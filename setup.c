@@ -677,6 +677,17 @@ static enum extension_result handle_extension(const char *var,
 				     "extensions.refstorage", value);
 		data->ref_storage_format = format;
 		return EXTENSION_OK;
+	} else if (!strcmp(ext, "packedrefsversion")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "1"))
+			data->packed_refs_version = 1;
+		else if (!strcmp(value, "2"))
+			data->packed_refs_version = 2;
+		else
+			return error(_("invalid value for '%s': '%s'"),
+				     "extensions.packedrefsversion", value);
+		return EXTENSION_OK;
 	}
 	return EXTENSION_UNKNOWN;
 }
@@ -1748,6 +1759,8 @@ const char *setup_git_directory_gently(int *nongit_ok)
 						    repo_fmt.ref_storage_format);
 			the_repository->repository_format_worktree_config =
 				repo_fmt.worktree_config;
+			the_repository->repository_format_packed_refs_version =
+				repo_fmt.packed_refs_version;
 			/* take ownership of repo_fmt.partial_clone */
 			the_repository->repository_format_partial_clone =
 				repo_fmt.partial_clone;
@@ -1844,6 +1857,8 @@ void check_repository_format(struct repository_format *fmt)
 				    fmt->ref_storage_format);
 	the_repository->repository_format_worktree_config =
 		fmt->worktree_config;
+	the_repository->repository_format_packed_refs_version =
+		fmt->packed_refs_version;
 	the_repository->repository_format_partial_clone =
 		xstrdup_or_null(fmt->partial_clone);
 	clear_repository_format(&repo_fmt);
@@ -130,6 +130,7 @@ struct repository_format {
 	int hash_algo;
 	int compat_hash_algo;
 	enum ref_storage_format ref_storage_format;
+	int packed_refs_version;
 	int sparse_index;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -6,7 +6,7 @@ test_description='Tests the performance of various pretty format placeholders'
 
 test_perf_default_repo
 
-for format in %H %h %T %t %P %p %h-%h-%h %an-%ae-%s
+for format in %H %h %T %t %P %p %h-%h-%h %an-%ae-%s %H-%an-%ae-%at-%s
 do
 	test_perf "log with $format" "
 		git log --format=\"$format\" >/dev/null
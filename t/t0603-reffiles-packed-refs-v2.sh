@@ -0,0 +1,151 @@
+#!/bin/sh
+
+test_description='packed-refs version 2 format'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+GIT_TEST_DEFAULT_REF_FORMAT=files
+export GIT_TEST_DEFAULT_REF_FORMAT
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+for_each_ref__exclude () {
+	GIT_TRACE2_PERF=1 test-tool ref-store main \
+		for-each-ref--exclude "$@" >actual.raw
+	cut -d ' ' -f 2 actual.raw
+}
+
+test_expect_success 'setup' '
+	git config core.repositoryFormatVersion 1 &&
+	git config extensions.packedRefsVersion 2 &&
+	test_commit --no-tag base &&
+	git tag -a -m annotated annotated &&
+	git tag lightweight &&
+	for name in foo bar baz quux
+	do
+		for i in 1 2 3
+		do
+			echo "create refs/heads/$name/$i HEAD" || return 1
+		done || return 1
+	done >in &&
+	git update-ref --stdin <in &&
+	git show-ref -d >expect &&
+	git pack-refs --all &&
+	test_path_is_file .git/packed-refs
+'
+
+test_expect_success 'packed-refs is written in binary format' '
+	printf PREF >expect.signature &&
+	test_copy_bytes 4 <.git/packed-refs >actual.signature &&
+	test_cmp expect.signature actual.signature
+'
+
+test_expect_success 'show-ref reads all refs with peeled values' '
+	git show-ref -d >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'single ref lookups' '
+	git rev-parse refs/heads/bar/2 refs/heads/quux/3 refs/tags/annotated^{} >actual &&
+	for i in 1 2 3
+	do
+		git rev-parse HEAD || return 1
+	done >expect.lookup &&
+	test_cmp expect.lookup actual &&
+	test_must_fail git rev-parse --verify refs/heads/bar &&
+	test_must_fail git rev-parse --verify refs/heads/zzz
+'
+
+test_expect_success 'prefix iteration' '
+	git for-each-ref --format="%(refname)" refs/heads/baz/ >actual &&
+	cat >expect.prefix <<-\EOF &&
+	refs/heads/baz/1
+	refs/heads/baz/2
+	refs/heads/baz/3
+	EOF
+	test_cmp expect.prefix actual
+'
+
+test_expect_success 'excluded patterns jump over regions' '
+	for_each_ref__exclude refs/heads refs/heads/foo refs/heads/bar >actual 2>perf &&
+	git for-each-ref --format="%(refname)" refs/heads/baz refs/heads/main \
+		refs/heads/quux >expect.exclude &&
+	test_cmp expect.exclude actual &&
+	grep -q "name:jumps_made value:2$" perf
+'
+
+test_expect_success 'updates and deletions rewrite the file' '
+	git update-ref -d refs/heads/foo/2 &&
+	git update-ref refs/heads/aaa HEAD &&
+	git pack-refs --all &&
+	git for-each-ref --format="%(refname)" refs/heads/ >actual &&
+	cat >expect.update <<-\EOF &&
+	refs/heads/aaa
+	refs/heads/bar/1
+	refs/heads/bar/2
+	refs/heads/bar/3
+	refs/heads/baz/1
+	refs/heads/baz/2
+	refs/heads/baz/3
+	refs/heads/foo/1
+	refs/heads/foo/3
+	refs/heads/main
+	refs/heads/quux/1
+	refs/heads/quux/2
+	refs/heads/quux/3
+	EOF
+	test_cmp expect.update actual
+'
+
+test_expect_success 'version 2 files are read without the extension' '
+	git show-ref -d >expect &&
+	git config --unset extensions.packedRefsVersion &&
+	git show-ref -d >actual &&
+	test_cmp expect actual &&
+
+	git pack-refs --all &&
+	head -n 1 .git/packed-refs >actual.header &&
+	test_grep "^# pack-refs with:" actual.header &&
+	git show-ref -d >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting all packed refs leaves an empty file' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	git -C repo config core.repositoryFormatVersion 1 &&
+	git -C repo config extensions.packedRefsVersion 2 &&
+	test_commit -C repo A &&
+	git -C repo pack-refs --all &&
+	git -C repo update-ref -d refs/tags/A &&
+	git -C repo update-ref -d refs/heads/main &&
+	test_file_size repo/.git/packed-refs >actual &&
+	echo 28 >expect &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo show-ref
+'
+
+test_expect_success 'corrupt file is detected' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	git -C repo config core.repositoryFormatVersion 1 &&
+	git -C repo config extensions.packedRefsVersion 2 &&
+	test_commit -C repo A &&
+	git -C repo pack-refs --all &&
+	test_copy_bytes 20 <repo/.git/packed-refs >truncated &&
+	mv truncated repo/.git/packed-refs &&
+	test_must_fail git -C repo show-ref 2>err &&
+	test_grep "corrupt packed-refs file" err
+'
+
+test_expect_success 'invalid extension value is rejected' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	git -C repo config core.repositoryFormatVersion 1 &&
+	git -C repo config extensions.packedRefsVersion 3 &&
+	test_must_fail git -C repo rev-parse HEAD 2>err &&
+	test_grep "invalid value for .extensions.packedrefsversion." err
+'
+
+test_done
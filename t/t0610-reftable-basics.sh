@@ -349,6 +349,37 @@ test_expect_success 'ref transaction: env var disables compaction' '
 	test_line_count -lt $expected repo/.git/reftable/tables.list
 '
 
+test_expect_success 'ref transaction: background compaction' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	git -C repo config reftable.backgroundCompaction true &&
+	git -C repo config maintenance.autoDetach false &&
+	test_commit -C repo --no-tag A &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_subcommand git maintenance run --auto --quiet --task=pack-refs \
+		--no-detach <trace2.txt &&
+	grep "\"key\":\"compaction/attempts\",\"value\":\"1\"" trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction honors env var' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	git -C repo config reftable.backgroundCompaction true &&
+	test_commit -C repo A &&
+
+	GIT_TEST_REFTABLE_AUTOCOMPACTION=false GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_subcommand ! git maintenance run --auto --quiet --task=pack-refs \
+		--no-detach <trace2.txt &&
+	test_subcommand ! git maintenance run --auto --quiet --task=pack-refs \
+		--detach <trace2.txt
+'
+
 test_expect_success 'ref transaction: alternating table sizes are compacted' '
 	test_when_finished "rm -rf repo" &&
 
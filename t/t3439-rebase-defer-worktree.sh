@@ -0,0 +1,144 @@
+#!/bin/sh
+
+test_description='rebase with rebase.deferWorktreeUpdates'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-rebase.sh
+
+test_expect_success 'setup' '
+	test_commit base file &&
+	git checkout -b topic &&
+	for i in $(test_seq 10)
+	do
+		echo $i >>file &&
+		echo $i >new$i &&
+		git add file new$i &&
+		git commit -m "topic $i" || return 1
+	done &&
+	git checkout main &&
+	test_commit other &&
+	git config rebase.deferWorktreeUpdates true
+'
+
+test_expect_success 'picks only update the worktree once' '
+	git checkout -b deferred topic &&
+	GIT_TRACE2_PERF="$(pwd)/trace" git rebase main &&
+	git -c rebase.deferWorktreeUpdates=false rebase -f main topic &&
+	test_cmp_rev topic^{tree} deferred^{tree} &&
+	git checkout deferred &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual &&
+	grep -c "region_enter.*do_write_index" trace >writes &&
+	test $(cat writes) -lt 10
+'
+
+test_expect_success 'exec commands see an up-to-date worktree' '
+	git checkout -b exec topic &&
+	git rebase -x "git diff --quiet HEAD && git diff --cached --quiet HEAD" \
+		--force-rebase main
+'
+
+test_expect_success 'edit stops with an up-to-date worktree' '
+	git checkout -b edit topic &&
+	(
+		set_fake_editor &&
+		FAKE_LINES="1 2 edit 3 4" git rebase -i --no-ff HEAD~4
+	) &&
+	git diff --quiet HEAD &&
+	git diff --cached --quiet HEAD &&
+	test_path_is_file new9 &&
+	test_path_is_missing new10 &&
+	git rebase --continue &&
+	test_cmp_rev edit^{tree} topic^{tree}
+'
+
+test_expect_success 'conflicts show the earlier picks' '
+	git checkout -b conflicting main &&
+	test_commit conflict new7 &&
+	git checkout -b pick-conflict topic &&
+	test_must_fail git rebase --onto conflicting topic~10 &&
+	test_path_is_file new6 &&
+	test_path_is_missing new8 &&
+	git ls-files -u new7 >unmerged &&
+	test_file_not_empty unmerged &&
+	git rebase --abort &&
+	test_cmp_rev pick-conflict topic &&
+	git diff --quiet HEAD
+'
+
+# kill_rebase_at <phase> <n>
+#
+# Install a reference-transaction hook that kills the rebase running it
+# in the <phase> of its <n>th update of HEAD.
+kill_rebase_at () {
+	write_script .git/hooks/reference-transaction <<-EOF
+	if test "\$1" = $1 && grep " HEAD\$" >/dev/null
+	then
+		n=\$((\$(cat .git/head-updates 2>/dev/null || echo 0) + 1))
+		echo \$n >.git/head-updates
+		test \$n = $2 && kill -9 \$PPID
+	fi
+	exit 0
+	EOF
+}
+
+test_expect_success 'continue after being killed once a pick was committed' '
+	test_when_finished "rm -f .git/hooks/reference-transaction .git/head-updates" &&
+	git checkout -b killed-after topic &&
+	kill_rebase_at committed 4 &&
+	test_expect_code 137 git rebase -f main &&
+	git rev-parse HEAD~3 >expect &&
+	git rev-parse main >actual &&
+	test_cmp expect actual &&
+	rm .git/hooks/reference-transaction &&
+	git rebase --continue &&
+	test_cmp_rev killed-after^{tree} topic^{tree} &&
+	git diff --quiet HEAD &&
+	git diff --cached --quiet HEAD
+'
+
+test_expect_success 'continue after being killed before a pick was committed' '
+	test_when_finished "rm -f .git/hooks/reference-transaction .git/head-updates" &&
+	git checkout -b killed-before topic &&
+	kill_rebase_at prepared 4 &&
+	test_expect_code 137 git rebase -f main &&
+	rm -f .git/HEAD.lock .git/index.lock &&
+	git rev-parse HEAD~2 >expect &&
+	git rev-parse main >actual &&
+	test_cmp expect actual &&
+	rm .git/hooks/reference-transaction &&
+	test_must_fail git rebase --continue 2>err &&
+	test_grep "staged changes" err &&
+	git diff --quiet &&
+	test_path_is_file new3 &&
+	test_path_is_missing new4 &&
+	git commit --no-edit -C topic~7 &&
+	git rebase --continue &&
+	test_cmp_rev killed-before^{tree} topic^{tree}
+'
+
+test_expect_success 'skip after being killed' '
+	test_when_finished "rm -f .git/hooks/reference-transaction .git/head-updates" &&
+	git checkout -b killed-skip topic &&
+	kill_rebase_at committed 4 &&
+	test_expect_code 137 git rebase -f main &&
+	rm .git/hooks/reference-transaction &&
+	git rebase --skip &&
+	test_path_is_missing .git/rebase-merge &&
+	test_cmp_rev killed-skip^{tree} topic^{tree} &&
+	git diff --quiet HEAD
+'
+
+test_expect_success 'hooks see an up-to-date worktree' '
+	test_hook post-commit <<-\EOF &&
+	git diff --quiet HEAD || echo dirty >>hook.log
+	EOF
+	git checkout -b hook topic &&
+	git rebase -f main &&
+	test_path_is_missing hook.log
+'
+
+test_done
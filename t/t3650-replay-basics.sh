@@ -73,6 +73,19 @@ test_expect_success 'using replay on bare repo to rebase two branches, one on to
 	test_cmp expect result-bare
 '
 
+test_expect_success 'replay writes the new objects into a pack' '
+	git init --bare packed &&
+	git -C packed fetch .. topic1:topic1 topic2:topic2 main:main &&
+	git -C packed repack -ad &&
+	git -C packed replay --onto main topic1..topic2 >result &&
+	git -C packed count-objects -v >counts &&
+	grep "^count: 0$" counts &&
+	grep "^packs: 2$" counts &&
+	git -C packed log --format=%s $(cut -f 3 -d " " result) >actual &&
+	test_write_lines E D M L B A >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'using replay to rebase with a conflict' '
 	test_expect_code 1 git replay --onto topic1 B..conflict
 '
@@ -196,4 +209,28 @@ test_expect_success 'using replay on bare repo to rebase multiple divergent bran
 	done
 '
 
+test_expect_success 'replay independent branches in several processes' '
+	git -C bare replay --contained --onto main ^main topic2 topic3 topic4 >expect &&
+	git -C bare replay --jobs=3 --contained --onto main ^main topic2 topic3 topic4 >actual &&
+	test_cmp expect actual &&
+
+	git replay --onto main ^topic1 topic2 topic4 >expect &&
+	git replay -j2 --onto main ^topic1 topic2 topic4 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'replay in several processes with a conflict' '
+	git replay --onto topic1 ^topic1 topic4 >expect &&
+	test_line_count = 1 expect &&
+	test_expect_code 1 git replay -j2 --onto topic1 ^B ^topic1 conflict topic4 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'replay worker rejects other arguments' '
+	test_must_fail git replay --worker --onto main topic1 2>err &&
+	test_grep "takes no arguments" err &&
+	test_must_fail git replay --worker --advance main 2>err &&
+	test_grep "requires .--onto." err
+'
+
 test_done
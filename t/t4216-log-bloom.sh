@@ -125,6 +125,31 @@ do
 	done
 done
 
+for path in A A/B/C/file3 file4 file5_renamed
+do
+	for option in "" \
+		      "--full-history" \
+		      "--simplify-merges" \
+		      "--first-parent" \
+		      "--topo-order"
+	do
+		test_expect_success "git log with threaded tree diffs, option: $option for path: $path" '
+			test_config commitGraph.changedPathsThreads 4 &&
+			test_bloom_filters_used "$option -- $path"
+		'
+	done
+done
+
+test_expect_success 'git log computes tree diffs ahead of the walk' '
+	test_config commitGraph.changedPathsThreads 4 &&
+	test_bloom_filters_used "-- A" &&
+	grep "region_enter.*prefetch-tree-diffs" "$TRASH_DIRECTORY/trace.perf" &&
+
+	test_config commitGraph.changedPathsThreads 1 &&
+	test_bloom_filters_used "-- A" &&
+	! grep "prefetch-tree-diffs" "$TRASH_DIRECTORY/trace.perf"
+'
+
 test_expect_success 'git log -- folder works with and without the trailing slash' '
 	test_bloom_filters_used "-- A" &&
 	test_bloom_filters_used "-- A/"
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='line-history index for log -L and blame'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	cat >file.c <<-\EOF &&
+	int a(void)
+	{
+		return 1;
+	}
+
+	int c(void)
+	{
+		return 3;
+	}
+	EOF
+	git add file.c &&
+	test_commit --no-tag one &&
+
+	# Inserting a function is the classic case where the indent
+	# heuristic places the hunk differently.
+	cat >file.c <<-\EOF &&
+	int a(void)
+	{
+		return 1;
+	}
+
+	int b(void)
+	{
+		return 2;
+	}
+
+	int c(void)
+	{
+		return 3;
+	}
+	EOF
+	git commit -q -a -m two &&
+
+	sed -e "s/return 2/return 22/" file.c >file.tmp &&
+	mv file.tmp file.c &&
+	git commit -q -a -m three &&
+
+	git mv file.c moved.c &&
+	sed -e "s/return 3/return 33/" moved.c >moved.tmp &&
+	mv moved.tmp moved.c &&
+	git commit -q -a -m four &&
+
+	sed -e "s/return 1/return 11/" moved.c >moved.tmp &&
+	mv moved.tmp moved.c &&
+	git commit -q -a -m five &&
+
+	git log -L:b:moved.c >expect.log &&
+	git blame moved.c >expect.blame &&
+	git blame -w moved.c >expect.blame-w
+'
+
+test_expect_success 'maintenance task writes the index' '
+	git maintenance run --task=line-history &&
+	test_path_is_file .git/objects/info/line-history
+'
+
+test_expect_success 'log -L replays hunks from the index' '
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" git log -L:b:moved.c >actual &&
+	test_cmp expect.log actual &&
+	grep "line-history.*name:hits" trace.perf
+'
+
+test_expect_success 'blame replays hunks without diffing' '
+	git blame moved.c >actual &&
+	test_cmp expect.blame actual &&
+	git blame --show-stats moved.c >stats &&
+	test_grep "num get patch: 0" stats
+'
+
+test_expect_success 'blame with other diff options ignores the index' '
+	git blame -w moved.c >actual &&
+	test_cmp expect.blame-w actual &&
+	git blame -w --show-stats moved.c >stats &&
+	test_grep ! "num get patch: 0" stats
+'
+
+test_expect_success 'blame with a textconv filter ignores the index' '
+	test_when_finished "rm .git/info/attributes" &&
+	mkdir -p .git/info &&
+	echo "*.c diff=upper" >.git/info/attributes &&
+	test_config diff.upper.textconv "tr a-z A-Z <" &&
+	git blame moved.c >actual &&
+	test_grep "RETURN 22" actual &&
+	git blame --show-stats moved.c >stats &&
+	test_grep ! "num get patch: 0" stats
+'
+
+test_expect_success 'rewriting the index reuses recorded hunks' '
+	echo "int d(void) { return 4; }" >>moved.c &&
+	git commit -q -a -m six &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git maintenance run --task=line-history &&
+	grep "line-history.*reused:4" trace.perf &&
+	grep "line-history.*computed:1" trace.perf
+'
+
+test_expect_success 'corrupt index is ignored' '
+	test_when_finished "rm -f .git/objects/info/line-history" &&
+	git log -L:b:moved.c >expect &&
+	test_copy_bytes 64 <.git/objects/info/line-history >truncated &&
+	mv -f truncated .git/objects/info/line-history &&
+	git log -L:b:moved.c >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "line-history" err
+'
+
+test_done
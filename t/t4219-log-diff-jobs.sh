@@ -0,0 +1,122 @@
+#!/bin/sh
+
+test_description='log, format-patch and diff-tree --stdin with --diff-jobs'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 20)
+	do
+		test_seq $i $(($i * 7)) >file$(($i % 5)) &&
+		echo $i >>log &&
+		git add . &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git checkout -b side HEAD~5 &&
+	echo side >side &&
+	echo side >>common &&
+	git add . &&
+	git commit -m side &&
+	git checkout main &&
+	git merge --no-edit side &&
+	git mv file2 renamed &&
+	git commit -m rename
+'
+
+# compare <git-command> [args]
+#
+# Run the command with and without --diff-jobs, which must not make
+# any difference to the output, and check that workers were used.
+compare () {
+	cmd=$1 &&
+	shift &&
+	git $cmd "$@" >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git $cmd --diff-jobs=3 "$@" >actual &&
+	test_cmp expect actual &&
+	grep "\"child_start\".*--diff-worker" trace >workers &&
+	test_line_count = 3 workers &&
+	rm trace
+}
+
+test_expect_success 'log -p' '
+	compare log -p
+'
+
+test_expect_success 'log with merges, renames and stat' '
+	compare log -m -p --stat -M &&
+	compare log --cc --raw
+'
+
+test_expect_success 'log with pathspec and parents' '
+	compare log -p --parents -- log
+'
+
+test_expect_success 'log with pickaxe' '
+	compare log -S14 --oneline
+'
+
+test_expect_success 'log with a lookahead of one commit' '
+	compare log -p --diff-lookahead=1
+'
+
+test_expect_success 'log --color' '
+	compare log -p --color=always
+'
+
+test_expect_success 'log --exit-code' '
+	test_expect_code 1 git log -p --exit-code --diff-jobs=2 >/dev/null
+'
+
+test_expect_success 'log --stdin is not pipelined' '
+	test_when_finished "rm -f trace" &&
+	printf "%s\n" HEAD~3..HEAD -- log >input &&
+	git log --stdin --stat <input >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git log --stdin --stat --diff-jobs=2 <input >actual &&
+	test_cmp expect actual &&
+	! grep -e --diff-worker trace
+'
+
+test_expect_success 'whatchanged' '
+	compare whatchanged
+'
+
+test_expect_success 'format-patch' '
+	compare format-patch --stdout HEAD~10 &&
+	git format-patch -o expect-dir --cover-letter HEAD~10 &&
+	git format-patch -o actual-dir --cover-letter --diff-jobs=2 HEAD~10 &&
+	for f in expect-dir/*
+	do
+		test_cmp "$f" actual-dir/"${f#expect-dir/}" || return 1
+	done
+'
+
+test_expect_success 'diff-tree --stdin shows lines in order' '
+	git rev-list HEAD >revs &&
+	{
+		head -n 5 revs &&
+		echo sync &&
+		tail -n +6 revs &&
+		echo "$(git rev-parse HEAD~3^{tree}) $(git rev-parse HEAD^{tree})" &&
+		echo "$(git rev-parse HEAD) $(git rev-parse HEAD~5)"
+	} >input &&
+	test_when_finished "rm -f trace" &&
+	git diff-tree --stdin -p --pretty -m <input >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git diff-tree --stdin -p --pretty -m --diff-jobs=3 <input >actual &&
+	test_cmp expect actual &&
+	grep -e --diff-worker trace
+'
+
+test_expect_success 'graph output is not pipelined' '
+	test_when_finished "rm -f trace" &&
+	git log -p --graph >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git log -p --graph --diff-jobs=3 >actual &&
+	test_cmp expect actual &&
+	! grep -e --diff-worker trace
+'
+
+test_done
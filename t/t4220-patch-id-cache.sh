@@ -0,0 +1,101 @@
+#!/bin/sh
+
+test_description='patch-id cache for cherry, log --cherry-pick and rebase'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit base file &&
+	git checkout -b topic &&
+	for i in $(test_seq 5)
+	do
+		test_commit topic-$i file$i || return 1
+	done &&
+	git checkout main &&
+	test_commit upstream-1 other &&
+	git cherry-pick topic~3 topic~1 &&
+	test_commit upstream-2 other &&
+
+	git cherry main topic >expect.cherry &&
+	git log --cherry-pick --left-right --oneline main...topic >expect.log &&
+	git log --cherry-pick --left-right --oneline main...topic -- file2 \
+		>expect.log-path &&
+	git format-patch --stdout --ignore-if-in-upstream main..topic \
+		>expect.patches
+'
+
+test_expect_success 'maintenance task writes the cache' '
+	git maintenance run --task=patch-ids &&
+	test_path_is_file .git/objects/info/patch-ids
+'
+
+test_expect_success 'cherry reads patch IDs from the cache' '
+	test_when_finished "rm -f trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git cherry main topic >actual &&
+	test_cmp expect.cherry actual &&
+	grep "\"category\":\"patch-id-cache\",\"name\":\"hits\"" trace.event
+'
+
+test_expect_success 'log --cherry-pick and format-patch use the cache' '
+	git log --cherry-pick --left-right --oneline main...topic >actual &&
+	test_cmp expect.log actual &&
+	git format-patch --stdout --ignore-if-in-upstream main..topic >actual &&
+	test_cmp expect.patches actual
+'
+
+test_expect_success 'pathspec limited patch IDs ignore the cache' '
+	test_when_finished "rm -f trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git log --cherry-pick --left-right --oneline main...topic -- file2 \
+		>actual &&
+	test_cmp expect.log-path actual &&
+	! grep "\"category\":\"patch-id-cache\"" trace.event
+'
+
+test_expect_success 'rebase drops commits already upstream' '
+	git checkout -b rebased topic &&
+	git rebase main &&
+	git log --format=%s main..rebased >actual &&
+	test_write_lines topic-5 topic-3 topic-1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rewriting the cache reuses recorded patch IDs' '
+	test_when_finished "rm -f trace.event" &&
+	git checkout main &&
+	git maintenance run --task=patch-ids &&
+	git rev-list --all --no-merges >before &&
+	test_commit upstream-3 other &&
+	git rev-list --all --no-merges >after &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" GIT_TRACE2_EVENT_NESTING=5 \
+		git maintenance run --task=patch-ids &&
+	reused=$(wc -l <before) &&
+	computed=$(($(wc -l <after) - $reused)) &&
+	grep "\"key\":\"reused\",\"value\":\"$reused\"" trace.event &&
+	grep "\"key\":\"computed\",\"value\":\"$computed\"" trace.event
+'
+
+test_expect_success 'a commit with other parents is not answered' '
+	test_when_finished "git replace -d topic~1" &&
+	git replace --graft topic~1 topic~3 &&
+	mv .git/objects/info/patch-ids patch-ids &&
+	git cherry -v main topic >expect &&
+	mv patch-ids .git/objects/info/patch-ids &&
+	git cherry -v main topic >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt cache is ignored' '
+	test_when_finished "rm -f .git/objects/info/patch-ids" &&
+	test_copy_bytes 64 <.git/objects/info/patch-ids >truncated &&
+	mv -f truncated .git/objects/info/patch-ids &&
+	git cherry main topic >actual 2>err &&
+	test_cmp expect.cherry actual &&
+	test_grep "patch-id cache" err
+'
+
+test_done
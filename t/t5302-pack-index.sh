@@ -68,6 +68,15 @@ test_expect_success 'index-pack results should match pack-objects ones' '
 	cmp "test-2-${pack2}.idx" "2.idx"
 '
 
+test_expect_success PTHREADS 'threaded index-pack results should match pack-objects ones' '
+	git index-pack --threads=4 --index-version=2 -o 2-threads.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-threads.idx &&
+	git index-pack --threads=4 --index-version=2 -o 2-stdin.idx \
+		--stdin 2-stdin.pack <"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-stdin.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -947,4 +947,39 @@ test_expect_success 'stale commit cannot be parsed when traversing graph' '
 	)
 '
 
+test_expect_success 'rev-list --count walks the commit-graph directly' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit A &&
+		test_commit B &&
+		git checkout -b side A &&
+		test_commit C &&
+		git merge -m D B &&
+		test_commit E &&
+		git commit-graph write --reachable &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git rev-list --count side ^B >actual &&
+		echo 3 >expect &&
+		test_cmp expect actual &&
+		test_region rev-list graph-count trace.event &&
+
+		git rev-list --count --max-count=2 side >actual &&
+		echo 2 >expect &&
+		test_cmp expect actual &&
+
+		# A tip that is not in the commit-graph uses the regular walk.
+		oid=$(git commit-tree -p side -m F side^{tree}) &&
+		git update-ref refs/heads/side $oid &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git rev-list --count side ^B >actual &&
+		echo 4 >expect &&
+		test_cmp expect actual &&
+		test_region ! rev-list graph-count trace.event
+	)
+'
+
 test_done
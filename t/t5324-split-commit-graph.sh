@@ -719,6 +719,29 @@ test_expect_success 'write generation data chunk when commit-graph chain is repl
 	)
 '
 
+test_expect_success 'reachability index requires labelled base layers' '
+	git init reach-split &&
+	(
+		cd reach-split &&
+		test_commit A &&
+		git commit-graph write --reachable --split &&
+		test_commit B &&
+		git commit-graph write --reachable --split=no-merge \
+			--reachability-index 2>err &&
+		test_grep "not writing a reachability index" err &&
+		git commit-graph write --reachable --split=replace \
+			--reachability-index 2>err &&
+		test_must_be_empty err &&
+		test_commit C &&
+		git commit-graph write --reachable --split=no-merge 2>err &&
+		test_must_be_empty err &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		git commit-graph verify &&
+		git merge-base --is-ancestor A C &&
+		test_must_fail git merge-base --is-ancestor C B
+	)
+'
+
 test_expect_success 'temporary graph layer is discarded upon failure' '
 	git init layer-discard &&
 	(
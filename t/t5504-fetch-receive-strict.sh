@@ -95,6 +95,30 @@ test_expect_success 'push with !receive.fsckobjects' '
 	test_cmp exp act
 '
 
+test_expect_success 'fetch into a repository with bitmaps' '
+	rm -rf dst &&
+	git init dst &&
+	test_commit -C dst base &&
+	git -C dst repack -adb &&
+	git -C dst config transfer.fsckobjects false &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C dst fetch ../.git main 2>err &&
+	test_grep "did not send all necessary objects" err &&
+	grep "\"category\":\"connectivity\",\"label\":\"walk\"" trace
+'
+
+test_expect_success 'push into a repository with bitmaps' '
+	rm -rf dst trace &&
+	git init dst &&
+	test_commit -C dst base &&
+	git -C dst repack -adb &&
+	git -C dst config transfer.fsckobjects false &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git push --porcelain dst main:refs/heads/test >act &&
+	test_cmp exp act &&
+	grep "\"category\":\"connectivity\",\"label\":\"walk\"" trace
+'
+
 cat >exp <<EOF
 To dst
 !	refs/heads/main:refs/heads/test	[remote rejected] (unpacker error)
@@ -130,6 +154,47 @@ test_expect_success 'repair the "corrupt or missing" object' '
 	git fsck
 '
 
+test_expect_success 'push and fetch into repositories with bitmaps' '
+	rm -rf dst trace &&
+	git init dst &&
+	test_commit -C dst base &&
+	git -C dst repack -adb &&
+	git push dst main:refs/heads/test &&
+	git rev-parse main >expect &&
+	git -C dst rev-parse test >actual &&
+	test_cmp expect actual &&
+	git -C dst repack -adb &&
+	git commit --allow-empty -m "one more" &&
+	env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C dst fetch ../.git main:refs/heads/fetched &&
+	git rev-parse main >expect &&
+	git -C dst rev-parse fetched >actual &&
+	test_cmp expect actual &&
+	grep "\"category\":\"connectivity\",\"label\":\"walk\"" trace
+'
+
+test_expect_success 'fetch after an in-process check still offers alternate refs' '
+	rm -rf up alt dst trace &&
+	git init up &&
+	test_commit -C up --no-tag one &&
+	git clone --bare up alt &&
+	test_commit -C up --no-tag two &&
+	git init dst &&
+	echo "$(pwd)/alt/objects" >dst/.git/objects/info/alternates &&
+	test_commit -C dst base &&
+	git -C dst fetch ../alt main:refs/heads/one &&
+	git -C dst repack -adb &&
+
+	# Make the quick connectivity check before the fetch walk and fail.
+	git -C up cat-file commit main >two &&
+	git -C dst hash-object -w -t commit --stdin <two &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE_PACKET="$(pwd)/packet" \
+		git -C dst fetch --negotiation-tip=main ../up main:refs/heads/two &&
+	grep "\"category\":\"connectivity\",\"label\":\"walk\"" trace &&
+	grep "fetch> have $(git -C alt rev-parse main)" packet
+'
+
 cat >bogus-commit <<EOF
 tree $EMPTY_TREE
 author Bugs Bunny 1234567890 +0000
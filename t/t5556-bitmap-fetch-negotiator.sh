@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='test bitmap fetch negotiator'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server --no-tag base &&
+	for i in $(test_seq 20)
+	do
+		test_commit -C server --no-tag s$i || return 1
+	done &&
+	git clone server client &&
+	for i in $(test_seq 40)
+	do
+		git -C client checkout -b topic$i origin/main &&
+		test_commit -C client --no-tag local$i || return 1
+	done &&
+	git -C client checkout main &&
+	test_commit -C server --no-tag new
+'
+
+# fetch_with <algorithm> [args]
+#
+# Fetch "new" from the server into a fresh copy of the client, using the
+# given negotiation algorithm, and list the "have" lines sent.
+fetch_with () {
+	algorithm=$1; shift
+	rm -rf work trace &&
+	cp -R client work &&
+	git -C work config fetch.negotiationAlgorithm $algorithm &&
+	trace_fetch work "$(pwd)/server" "$@" &&
+	sed -n "s/.*fetch> have //p" trace
+}
+
+test_expect_success 'without a bitmap, behave like the skipping negotiator' '
+	fetch_with skipping >expect &&
+	fetch_with bitmap >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'remote-tracking tips are sent first' '
+	git -C client repack -adb &&
+	fetch_with bitmap >actual &&
+	git -C client rev-parse origin/main >expect &&
+	head -n 1 actual >first &&
+	test_cmp expect first &&
+	git -C server rev-parse main >expect &&
+	git -C work rev-parse FETCH_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fewer haves than the consecutive negotiator' '
+	fetch_with bitmap >bitmap &&
+	fetch_with consecutive >consecutive &&
+	test_line_count -lt $(wc -l <consecutive) bitmap
+'
+
+test_expect_success 'only commits reachable from negotiation tips are sent' '
+	fetch_with bitmap --negotiation-tip=topic1 >actual &&
+	git -C client rev-list topic1 >reachable &&
+	test_file_not_empty actual &&
+	! grep -v -f reachable actual
+'
+
+test_done
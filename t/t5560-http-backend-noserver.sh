@@ -62,6 +62,62 @@ expect_aliased() {
 	unset REQUEST_METHOD
 }
 
+# Like GET, but with a Range header and a binary response, which ends up
+# split into act.hdr and act.body.
+GET_RANGE() {
+	REQUEST_METHOD="GET" && export REQUEST_METHOD &&
+	HTTP_RANGE="$1" && export HTTP_RANGE &&
+	run_backend "/repo.git/$2" &&
+	sane_unset REQUEST_METHOD HTTP_RANGE &&
+	perl -0777 -ne "print \$1 if /^(.*?\r\n)\r\n/s" act.out >act.hdr &&
+	perl -0777 -pe "s/^.*?\r\n\r\n//s" act.out >act.body &&
+	if ! grep "Status" act.hdr >act
+	then
+		printf "Status: 200 OK\r\n" >act
+	fi
+	printf "Status: $3\r\n" >exp &&
+	test_cmp exp act
+}
+
+test_expect_success 'http-backend serves a single byte range' '
+	config http.getanyfile true &&
+	PACK="$HTTPD_DOCUMENT_ROOT_PATH/repo.git/$PACK_URL" &&
+	size=$(test_file_size "$PACK") &&
+
+	GET_RANGE bytes=4-11 "$PACK_URL" "206 Partial Content" &&
+	grep "^Content-Range: bytes 4-11/$size" act.hdr &&
+	grep "^Content-Length: 8" act.hdr &&
+	tail -c +5 "$PACK" | test_copy_bytes 8 >expect &&
+	test_cmp expect act.body &&
+
+	GET_RANGE bytes=12- "$PACK_URL" "206 Partial Content" &&
+	tail -c +13 "$PACK" >expect &&
+	test_cmp expect act.body &&
+
+	GET_RANGE bytes=-20 "$PACK_URL" "206 Partial Content" &&
+	tail -c 20 "$PACK" >expect &&
+	test_cmp expect act.body
+'
+
+test_expect_success 'http-backend rejects unsatisfiable ranges' '
+	GET_RANGE bytes=$size- "$PACK_URL" "416 Range Not Satisfiable" &&
+	grep "^Content-Range: bytes \*/$size" act.hdr
+'
+
+test_expect_success 'http-backend sends the whole file when it cannot serve the range' '
+	GET_RANGE bytes=0-1,4-5 "$PACK_URL" "200 OK" &&
+	test_cmp "$PACK" act.body &&
+
+	HTTP_IF_RANGE="Thu, 1 Jan 1970 00:00:00 +0000" &&
+	export HTTP_IF_RANGE &&
+	GET_RANGE bytes=4-11 "$PACK_URL" "200 OK" &&
+	sane_unset HTTP_IF_RANGE &&
+	test_cmp "$PACK" act.body &&
+
+	GET_RANGE bytes=0-3 "$LOOSE_URL" "206 Partial Content" &&
+	grep "^Accept-Ranges: bytes" act.hdr
+'
+
 test_expect_success 'http-backend blocks bad PATH_INFO' '
 	config http.getanyfile true &&
 
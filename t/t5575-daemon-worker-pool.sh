@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='git daemon serving protocol v2 from repository workers'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test -z "$NO_UNIX_SOCKETS" || {
+	skip_all='skipping worker pool tests, unix sockets not available'
+	test_done
+}
+if test_have_prereq MINGW
+then
+	skip_all='skipping worker pool tests, no descriptor passing on Windows'
+	test_done
+fi
+
+. "$TEST_DIRECTORY"/lib-git-daemon.sh
+
+GIT_TRACE2_EVENT="$PWD/trace" &&
+export GIT_TRACE2_EVENT &&
+start_git_daemon --worker-pool="$PWD/pool" &&
+sane_unset GIT_TRACE2_EVENT
+
+REPO="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git"
+
+# Number of upload-pack processes the daemon has run so far.
+upload_pack_runs () {
+	grep -c '"event":"cmd_name".*"name":"upload-pack"' trace
+}
+
+wait_for_worker () {
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test -n "$(ls pool)" && return 0
+		sleep 1
+	done
+	return 1
+}
+
+test_expect_success 'setup repository' '
+	test_commit one &&
+	git init --bare "$REPO" &&
+	: >"$REPO/git-daemon-export-ok" &&
+	git push "$REPO" main
+'
+
+test_expect_success 'first v2 request starts a worker' '
+	git -c protocol.version=2 ls-remote "$GIT_DAEMON_URL/repo.git" >actual &&
+	git ls-remote "$REPO" >expect &&
+	test_cmp expect actual &&
+	test_path_is_dir pool &&
+	wait_for_worker
+'
+
+test_expect_success 'v2 requests are served by the worker' '
+	before=$(upload_pack_runs) &&
+	git -c protocol.version=2 ls-remote "$GIT_DAEMON_URL/repo.git" >actual &&
+	test_cmp expect actual &&
+	git -c protocol.version=2 clone "$GIT_DAEMON_URL/repo.git" clone &&
+	git -C clone log -1 --format=%s >actual &&
+	echo one >expect &&
+	test_cmp expect actual &&
+	test "$before" = "$(upload_pack_runs)"
+'
+
+test_expect_success 'v0 requests are not handed over' '
+	before=$(upload_pack_runs) &&
+	git -c protocol.version=0 ls-remote "$GIT_DAEMON_URL/repo.git" >actual &&
+	git ls-remote "$REPO" >expect &&
+	test_cmp expect actual &&
+	test "$before" -lt "$(upload_pack_runs)"
+'
+
+test_expect_success 'workers see ref updates' '
+	test_commit two &&
+	git push "$REPO" main &&
+	git -c protocol.version=2 fetch "$GIT_DAEMON_URL/repo.git" main &&
+	git rev-parse two >expect &&
+	git rev-parse FETCH_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a new pack retires the worker' '
+	git -C "$REPO" repack -ad &&
+	git -c protocol.version=2 clone "$GIT_DAEMON_URL/repo.git" clone2 &&
+	git -C clone2 log -1 --format=%s >actual &&
+	echo two >expect &&
+	test_cmp expect actual &&
+	wait_for_worker &&
+	before=$(upload_pack_runs) &&
+	git -c protocol.version=2 ls-remote "$GIT_DAEMON_URL/repo.git" >actual &&
+	git ls-remote "$REPO" >expect &&
+	test_cmp expect actual &&
+	test "$before" = "$(upload_pack_runs)"
+'
+
+test_expect_success POSIXPERM 'the pool is only accessible to the daemon user' '
+	ls -ld pool >actual &&
+	test_grep "^drwx------" actual
+'
+
+test_expect_success POSIXPERM 'a pool accessible to others is refused' '
+	mkdir loose &&
+	chmod 755 loose &&
+	test_must_fail git daemon --inetd --log-destination=stderr \
+		--worker-pool="$PWD/loose" </dev/null 2>err &&
+	test_grep "must be owned by the daemon user and have mode 0700" err
+'
+
+test_done
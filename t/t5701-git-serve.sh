@@ -236,6 +236,31 @@ test_expect_success 'ignore very large set of prefixes' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-refs with an advertisement larger than its buffer' '
+	git init many-refs &&
+	test_commit -C many-refs base &&
+	oid=$(git -C many-refs rev-parse HEAD) &&
+	perl -le "print \"create refs/heads/branch-\$_ $oid\" for (1..2000)" |
+	git -C many-refs update-ref --stdin &&
+
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	{
+		git -C many-refs for-each-ref --format="%(objectname) %(refname)" \
+			refs/heads/ &&
+		echo 0000
+	} >expect &&
+	test-tool -C many-refs serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'peel parameter' '
 	test-tool pkt-line pack >in <<-EOF &&
 	command=ls-refs
@@ -280,6 +305,73 @@ test_expect_success 'symrefs parameter' '
 	test_cmp expect actual
 '
 
+# Backdate the ref store, so that its state is not considered racy.
+age_refs () {
+	for f in .git/HEAD .git/packed-refs .git/reftable/tables.list \
+		$(find .git/refs -type d)
+	do
+		if test -e "$f"
+		then
+			test-tool chmtime =-10 "$f" || return 1
+		fi
+	done
+}
+
+test_expect_success 'ls-refs responses are cached with lsrefs.cache' '
+	test_config lsrefs.cache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	symrefs
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	age_refs &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >out &&
+	test_grep "\"key\":\"cache\",\"value\":\"stored\"" trace &&
+	test-tool pkt-line unpack <out >expect &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >out &&
+	test_grep "\"key\":\"cache\",\"value\":\"hit\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual &&
+
+	test_config uploadpack.hideRefs refs/heads/dev &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >out &&
+	test_grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	test_grep ! refs/heads/dev actual
+'
+
+test_expect_success 'cached ls-refs responses follow ref updates' '
+	test_config lsrefs.cache true &&
+	dev=$(git rev-parse refs/heads/dev) &&
+	test_when_finished "git update-ref refs/heads/dev $dev" &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	git update-ref refs/heads/dev refs/heads/main &&
+	age_refs &&
+
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/main) refs/heads/dev
+	$(git rev-parse refs/heads/main) refs/heads/main
+	$(git rev-parse refs/heads/main) refs/heads/release symref-target:refs/heads/main
+	0000
+	EOF
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool serve-v2 --stateless-rpc <in >out &&
+	test_grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual &&
+
+	git update-ref -d refs/heads/dev &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_grep ! refs/heads/dev actual
+'
+
 test_expect_success 'sending server-options' '
 	test-tool pkt-line pack >in <<-EOF &&
 	command=ls-refs
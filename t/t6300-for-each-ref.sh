@@ -1314,6 +1314,32 @@ test_expect_success 'equivalent sorts fall back on refname' '
 	test_cmp expected actual
 '
 
+test_expect_success '--count with multiple sort keys' '
+	cat >expected <<-\EOF &&
+	200000 <user2@example.com> refs/tags/multi-ref1-200000-user2
+	200000 <user2@example.com> refs/tags/multi-ref2-200000-user2
+	200000 <user1@example.com> refs/tags/multi-ref1-200000-user1
+	EOF
+	git for-each-ref \
+		--format="%(taggerdate:unix) %(taggeremail) %(refname)" \
+		--sort=refname \
+		--sort=-taggeremail \
+		--sort=-taggerdate \
+		--count=3 \
+		"refs/tags/multi-*" >actual &&
+	test_cmp expected actual &&
+
+	for count in 1 7 8 9
+	do
+		git for-each-ref --sort=-objectsize --sort=taggerdate \
+			--format="%(objectsize) %(refname)" >all &&
+		head -n $count all >expected &&
+		git for-each-ref --sort=-objectsize --sort=taggerdate \
+			--format="%(objectsize) %(refname)" --count=$count >actual &&
+		test_cmp expected actual || return 1
+	done
+'
+
 test_expect_success '--no-sort cancels the previous sort keys' '
 	cat >expected <<-\EOF &&
 	100000 <user1@example.com> refs/tags/multi-ref1-100000-user1
@@ -2104,4 +2130,25 @@ test_expect_success GPG 'show lack of signature with custom format' '
 	test_cmp expect actual
 '
 
+test_expect_success 'objects are read on several threads' '
+	test_when_finished "rm -rf threads trace" &&
+	git init threads &&
+	for i in $(test_seq 5)
+	do
+		test_commit -C threads $i &&
+		git -C threads tag -a -m "tag $i" annotated-$i || return 1
+	done &&
+	format="%(refname) %(objectsize) %(subject) %(*objectname) %(*authordate)" &&
+	git -C threads for-each-ref --sort=-committerdate --format="$format" >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_REF_FILTER_THREADS=1 \
+		git -C threads for-each-ref --sort=-committerdate --format="$format" >actual &&
+	test_cmp expect actual &&
+	grep "populate_values/parallel" trace &&
+
+	git -C threads for-each-ref --count=3 --format="$format" >expect &&
+	GIT_TEST_REF_FILTER_THREADS=1 \
+		git -C threads for-each-ref --count=3 --format="$format" >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -301,4 +301,128 @@ test_expect_success !WINDOWS 'custom merge driver that is killed with a signal o
 	test_must_be_empty output
 '
 
+test_expect_success 'content merges on several threads' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 40)
+		do
+			test_write_lines 1 2 3 4 5 6 7 8 9 >f$i || return 1
+		done &&
+		test_write_lines 1 2 3 4 5 6 7 8 9 >custom &&
+		printf "base\0" >binary &&
+		git add . &&
+		git commit -m base &&
+		git branch side &&
+
+		for i in $(test_seq 40)
+		do
+			test_write_lines 1 main 3 4 5 6 7 8 9 >f$i || return 1
+		done &&
+		test_write_lines 1 main 3 4 5 6 7 8 9 >custom &&
+		printf "main\0" >binary &&
+		git commit -am main &&
+
+		git checkout side &&
+		for i in $(test_seq 40)
+		do
+			if test $(($i % 2)) = 0
+			then
+				line=2
+			else
+				line=8
+			fi &&
+			sed "${line}s/.*/side/" f$i >f$i.new &&
+			mv f$i.new f$i || return 1
+		done &&
+		test_write_lines 1 side 3 4 5 6 7 8 9 >custom &&
+		printf "side\0" >binary &&
+		git commit -am side &&
+
+		echo "custom merge=custom" >.git/info/attributes &&
+		git config merge.custom.driver "echo custom >%A" &&
+		test_expect_code 1 env GIT_TEST_MERGE_ORT_THREADS=1 \
+			git merge-tree --write-tree main side >expect &&
+		test_expect_code 1 env GIT_TEST_MERGE_ORT_THREADS=3 \
+			GIT_TRACE2_PERF="$(pwd)/trace" \
+			git merge-tree --write-tree main side >actual &&
+		test_cmp expect actual &&
+		grep "content_merges/taken:41" trace &&
+		grep "Merge conflict in f2" actual &&
+		grep "Auto-merging f1$" actual &&
+		grep "Cannot merge binary files: binary" actual &&
+		git cat-file -p $(head -n 1 actual):custom >custom &&
+		echo custom >expect &&
+		test_cmp expect custom
+	)
+'
+
+test_expect_success 'driver without a command line is not run on a thread' '
+	test_when_finished "rm -rf nocmd" &&
+	git init nocmd &&
+	(
+		cd nocmd &&
+		test_write_lines 1 2 3 >file &&
+		test_write_lines 1 2 3 >other &&
+		git add file other &&
+		git commit -m base &&
+		git branch side &&
+		test_write_lines 1 main 3 >file &&
+		test_write_lines 1 main 3 >other &&
+		git commit -am main &&
+		git checkout side &&
+		test_write_lines 1 2 side >file &&
+		test_write_lines 1 2 side >other &&
+		git commit -am side &&
+
+		echo "file merge=nocmd" >.git/info/attributes &&
+		git config merge.nocmd.name "no command line" &&
+		test_must_fail env GIT_TEST_MERGE_ORT_THREADS=3 \
+			GIT_TRACE2_PERF="$(pwd)/trace" \
+			git merge-tree --write-tree main side 2>err &&
+		test_grep "custom merge driver nocmd lacks command line" err &&
+		grep "region_leave.*label:content merges" trace
+	)
+'
+
+test_expect_success 'content merges on several threads with attr.tree' '
+	test_when_finished "rm -rf attrtree" &&
+	git init attrtree &&
+	(
+		cd attrtree &&
+		for f in a b c d
+		do
+			test_write_lines 1 2 3 >$f || return 1
+		done &&
+		echo "* merge=union" >.gitattributes &&
+		git add . &&
+		git commit -m base &&
+		git branch side &&
+		for f in a b c d
+		do
+			test_write_lines 1 main 3 >$f || return 1
+		done &&
+		git commit -am main &&
+		git checkout side &&
+		for f in a b c d
+		do
+			test_write_lines 1 side 3 >$f || return 1
+		done &&
+		git commit -am side &&
+
+		env GIT_TEST_MERGE_ORT_THREADS=1 \
+			git -c attr.tree=HEAD merge-tree main side >expect &&
+		env GIT_TEST_MERGE_ORT_THREADS=2 \
+			git -c attr.tree=HEAD merge-tree main side >actual &&
+		test_cmp expect actual &&
+		env GIT_TEST_MERGE_ORT_THREADS=2 \
+			git --attr-source=HEAD merge-tree main side >actual &&
+		test_cmp expect actual &&
+		git cat-file -p $(cat actual):a >merged &&
+		test_write_lines 1 main side 3 >expect &&
+		test_cmp expect merged
+	)
+'
+
 test_done
@@ -58,11 +58,20 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git commit-graph write --reachable --reachability-index &&
+	mv .git/objects/info/commit-graph commit-graph-reach &&
+	chmod u+w commit-graph-reach &&
+	git show-ref -s commit-5-5 |
+		git commit-graph write --stdin-commits --split --reachability-index &&
+	git commit-graph write --reachable --split=no-merge &&
+	test_line_count = 2 .git/objects/info/commit-graphs/commit-graph-chain &&
+	mv .git/objects/info/commit-graphs commit-graphs-reach-split &&
 	git config core.commitGraph true
 '
 
 run_all_modes () {
-	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	test_when_finished rm -rf .git/objects/info/commit-graph \
+		.git/objects/info/commit-graphs &&
 	"$@" <input >actual &&
 	test_cmp expect actual &&
 	cp commit-graph-full .git/objects/info/commit-graph &&
@@ -73,6 +82,13 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
+	test_cmp expect actual &&
+	rm .git/objects/info/commit-graph &&
+	cp -R commit-graphs-reach-split .git/objects/info/commit-graphs &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -80,6 +96,16 @@ test_all_modes () {
 	run_all_modes test-tool reach "$@"
 }
 
+test_expect_success 'reachability index avoids walks' '
+	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	git commit-graph verify &&
+	test_must_fail env GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git merge-base --is-ancestor commit-6-8 commit-5-9 &&
+	grep "commit-graph.*name:reachability_excluded" trace.perf &&
+	git merge-base --is-ancestor commit-5-7 commit-8-8
+'
+
 test_expect_success 'ref_newer:miss' '
 	cat >input <<-\EOF &&
 	A:commit-5-7
@@ -529,6 +555,35 @@ test_expect_success 'for-each-ref ahead-behind:none' '
 		--format="%(refname) %(ahead-behind:commit-8-4)" --stdin
 '
 
+test_expect_success 'for-each-ref ahead-behind on multiple threads' '
+	cat >input <<-\EOF &&
+	refs/heads/commit-1-1
+	refs/heads/commit-5-3
+	refs/heads/commit-7-8
+	refs/heads/commit-4-8
+	refs/heads/commit-9-9
+	EOF
+	cat >expect <<-\EOF &&
+	refs/heads/commit-1-1 0 53 0 53
+	refs/heads/commit-4-8 8 30 0 22
+	refs/heads/commit-5-3 0 39 0 39
+	refs/heads/commit-7-8 14 12 8 6
+	refs/heads/commit-9-9 27 0 27 0
+	EOF
+	run_all_modes env GIT_TEST_AHEAD_BEHIND_THREADS=1 git for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:commit-6-9)" \
+		--stdin &&
+
+	test_when_finished rm -f .git/objects/info/commit-graph &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_AHEAD_BEHIND_THREADS=1 \
+		git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:commit-6-9)" \
+		<input >actual &&
+	test_cmp expect actual &&
+	grep "ahead_behind/parallel" trace
+'
+
 test_expect_success 'for-each-ref merged:linear' '
 	cat >input <<-\EOF &&
 	refs/heads/commit-1-1
@@ -554,6 +554,9 @@ enum trace2_counter_id {
 	TRACE2_COUNTER_ID_TEST2,     /* emits summary and thread events */
 
 	TRACE2_COUNTER_ID_PACKED_REFS_JUMPS, /* counts number of jumps */
+	TRACE2_COUNTER_ID_LINE_HISTORY_HITS, /* diffs replayed from the index */
+	TRACE2_COUNTER_ID_PATCH_ID_CACHE_HITS, /* patch IDs read from the cache */
+	TRACE2_COUNTER_ID_COMMIT_GRAPH_REACH_EXCLUDED, /* walks avoided */
 
 	/* counts number of fsyncs */
 	TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY,
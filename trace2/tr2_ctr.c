@@ -31,6 +31,21 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "jumps_made",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_LINE_HISTORY_HITS] = {
+		.category = "line-history",
+		.name = "hits",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PATCH_ID_CACHE_HITS] = {
+		.category = "patch-id-cache",
+		.name = "hits",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_COMMIT_GRAPH_REACH_EXCLUDED] = {
+		.category = "commit-graph",
+		.name = "reachability_excluded",
+		.want_per_thread_events = 0,
+	},
 	[TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY] = {
 		.category = "fsync",
 		.name = "writeout-only",
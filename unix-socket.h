@@ -12,4 +12,13 @@ int unix_stream_connect(const char *path, int disallow_chdir);
 int unix_stream_listen(const char *path,
 		       const struct unix_stream_listen_opts *opts);
 
+/*
+ * Pass the file descriptor 'fd' to the process at the other end of the
+ * connected socket 'sock', which receives it with unix_stream_recv_fd().
+ * Both return -1 and set errno on failure, e.g. to ENOSYS on platforms
+ * that cannot pass descriptors.
+ */
+int unix_stream_send_fd(int sock, int fd);
+int unix_stream_recv_fd(int sock);
+
 #endif /* UNIX_SOCKET_H */
@@ -1251,7 +1251,7 @@ static void write_v0_ref(struct upload_pack_data *data,
 
 		format_symref_info(&symref_info, &data->symref);
 		format_session_id(&session_id, data);
-		packet_fwrite_fmt(stdout, "%s %s%c%s%s%s%s%s%s%s object-format=%s agent=%s\n",
+		packet_writer_write(&data->writer, "%s %s%c%s%s%s%s%s%s%s object-format=%s agent=%s\n",
 			     oid_to_hex(oid), refname_nons,
 			     0, capabilities,
 			     (data->allow_uor & ALLOW_TIP_SHA1) ?
@@ -1268,11 +1268,11 @@ static void write_v0_ref(struct upload_pack_data *data,
 		strbuf_release(&session_id);
 		data->sent_capabilities = 1;
 	} else {
-		packet_fwrite_fmt(stdout, "%s %s\n", oid_to_hex(oid), refname_nons);
+		packet_writer_write(&data->writer, "%s %s\n", oid_to_hex(oid), refname_nons);
 	}
 	capabilities = NULL;
 	if (!peel_iterated_oid(the_repository, oid, &peeled))
-		packet_fwrite_fmt(stdout, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
+		packet_writer_write(&data->writer, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
 	return;
 }
 
@@ -1425,6 +1425,7 @@ void upload_pack(const int advertise_refs, const int stateless_rpc,
 		reset_timeout(data.timeout);
 		if (advertise_refs)
 			data.no_done = 1;
+		packet_writer_init_buffered(&data.writer, 1);
 		refs_head_ref_namespaced(get_main_ref_store(the_repository),
 					 send_ref, &data);
 		for_each_namespaced_ref_1(send_ref, &data);
@@ -1433,10 +1434,10 @@ void upload_pack(const int advertise_refs, const int stateless_rpc,
 			write_v0_ref(&data, refname, refname, null_oid());
 		}
 		/*
-		 * fflush stdout before calling advertise_shallow_grafts because send_ref
-		 * uses stdio.
+		 * Send what is buffered before advertise_shallow_grafts()
+		 * writes to fd 1 directly, and stop buffering.
 		 */
-		fflush_or_die(stdout);
+		packet_writer_release(&data.writer);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {